@@ -28,8 +28,38 @@
 #include <errno.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 #include "common.h"
 
+/* Nesting limit of ${name:-default} and ${name:+alt} scopes */
+#define MAX_EXPANSION_DEPTH 16
+
+extern char **environ;
+
+/* Number of variable values remembered between expansion passes */
+#define EXPANSION_VALUES 16
+
+/* State of an expand_env_vars call, shared by its two passes */
+struct expansion {
+	char *out; /* NULL while measuring */
+	size_t len;
+	/* values looked up while measuring, reused when writing */
+	const char *values[EXPANSION_VALUES];
+	unsigned int nvalues;
+	unsigned int ivalue;
+};
+
+static int expand_span(struct expansion*, const char*, const char*, int);
+static const char* get_value(struct expansion*, const char*, size_t, int);
+static const char* lookup_env_var(const char*, size_t, int);
+static void copy_value(struct expansion*, const char*);
+static int is_executable(const char*, int*);
+
 /* Reliable signal handling (using POSIX sigaction) */
 sigfunc_t rsignal(int sig, sigfunc_t handler)
 {
@@ -59,148 +89,368 @@ sigfunc_t rsignal(int sig, sigfunc_t handler)
  */
 int expand_env_vars(const char *in, char **out)
 {
-	char *src;
-	char *buf;
-	char **parts;
-	size_t nparts = 0;
-	char *s, *p;
-	int res = 0;
+	const char *end = in + strlen(in);
+	struct expansion x;
+	int res;
+	
+	/* measure first, so that the result is written in one go */
+	x.out = NULL;
+	x.len = 0;
+	x.nvalues = 0;
+	x.ivalue = 0;
+	if((res = expand_span(&x, in, end, 0))) return res;
+	
+	if(!(x.out = malloc(x.len + 1))) return ENOMEM;
+	x.len = 0;
+	expand_span(&x, in, end, 0);
+	x.out[x.len] = '\0';
 	
-	src = strdup(in);
-	if(!src) return ENOMEM;
+	*out = x.out;
+	return 0;
+}
 
-	s = p = src;
+/*
+ * Expands the string in 'm->in' unless it has already been expanded.
+ * On success the result is in 'm->out'.
+ * Returns zero on success, errno otherwise.
+ */
+int expand_env_vars_memo(struct env_memo *m)
+{
+	char *out;
+	int res;
 	
-	/* count parts and allocate temporary storage */
-	while(*p) {
-		if((*p == '$') && (p[1] != '$')) nparts++;
-		p++;
-	}
+	if(m->out) return 0;
 	
-	if(!nparts) {
-		*out = src;
-		return 0;
-	}
+	if((res = expand_env_vars(m->in, &out))) return res;
 	
-	parts = calloc((nparts + 1) * 2, sizeof(char*));
-	if(!parts) {
-		free(src);
-		return ENOMEM;
-	}
+	m->out = out;
+	return 0;
+}
+
+/* Frees memoized expansion, leaving the input string intact */
+void free_env_memo(struct env_memo *m)
+{
+	free(m->out);
+	m->out = NULL;
+}
+
+/*
+ * Expands variables in the span between p and end. If x->out is NULL, only
+ * adds the length of the result to x->len, otherwise writes it at
+ * x->out + x->len as well. Writing must be preceded by a measuring pass,
+ * which does all the validation. Returns zero on success, errno otherwise.
+ */
+static int expand_span(struct expansion *x,
+	const char *p, const char *end, int depth)
+{
+	const char *q;
+	const char *name, *value;
+	size_t name_len;
 	
-	/* reset for parsing */
-	nparts = 0;
-	s = p = src;
+	if(depth > MAX_EXPANSION_DEPTH) return EINVAL;
 	
-	while(*p) {
-		if(*p == '$') {
-			char vc = *p;
+	while(p != end) {
+		/* literal part up to the next variable */
+		q = memchr(p, '$', end - p);
+		if(!q) q = end;
+		if(x->out) memcpy(x->out + x->len, p, q - p);
+		x->len += q - p;
+		if(q == end) break;
+		p = q + 1;
+		
+		/* double special char stands for literal */
+		if(p != end && *p == '$') {
+			if(x->out) x->out[x->len] = '$';
+			x->len++;
+			p++;
+			continue;
+		}
+		
+		if(p != end && *p == '{') {
+			/* explicit scope ${name}, ${name:-default}, ${name:+alt} */
+			const char *word;
+			int nest = 1;
+			char op;
 			
-			/* double special char stands for literal */
-			if(p[1] == vc) {
-				memmove(p, p + 1, strlen(p));
+			name = ++p;
+			while(p != end && *p != '}' && *p != ':') p++;
+			if(p == end || p == name) return EINVAL;
+			name_len = p - name;
+			
+			if(*p == '}') {
 				p++;
+				value = get_value(x, name, name_len, 1);
+				if(value) copy_value(x, value);
 				continue;
 			}
 			
-			/* starting point of the next part */
-			parts[nparts++] = s;
+			if(end - p < 2 || (p[1] != '-' && p[1] != '+')) return EINVAL;
+			op = p[1];
+			word = p += 2;
 			
-			/* explicit scope ${...} */
-			if(p[1] == '{') {
-				p[0] = '\0';
-				p += 2;
-				s = p;
-				
-				while(*p && *p != '}') p++;
-
-				if(*p == '\0') {
-					res = EINVAL;
-					break;
-				}
-				
-				if(!(p - s)) break;
-				
-				buf = malloc((p - s) + 1);
-				if(!buf) {
-					res = errno;
-					break;
+			/* find the closing brace, minding nested scopes */
+			while(p != end) {
+				if(*p == '$' && p + 1 != end && (p[1] == '$' || p[1] == '{')) {
+					if(p[1] == '{') nest++;
+					p += 2;
+					continue;
 				}
-				memcpy(buf, s, p - s);
-				buf[p - s] = '\0';
-				
-				s--;
-				memmove(s, p + 1, strlen(p));
-				
-				p = s;
-			} else { 
-				/* implicit scope $...
-				 * (eventually terminated by a space, dot, quotes or slash) */
-				p[0] = '\0';
+				if(*p == '}' && !(--nest)) break;
 				p++;
-				s = p;
-				
-				while(*p && *p != ' ' && *p != '\"' && *p != '\'' &&
-					*p != '\t' && *p != '.'&& *p != '\\' && *p != '/') p++;
-				
-				if(!(p - s)) {
-					res = EINVAL;
-					break;
-				}
-				
-				buf = malloc((p - s) + 1);
-				if(!buf) {
-					res = errno;
-					break;
-				}
-				memcpy(buf, s, p - s);
-				buf[p - s] = '\0';
-
-				memmove(s , p, strlen(p) + 1);
-				
-				p = s;
 			}
+			if(p == end) return EINVAL;
 
-			parts[nparts] = getenv(buf);
-			if(parts[nparts] == NULL)
-				fprintf(stderr, "Undefined environment variable %s\n", buf);
+			value = get_value(x, name, name_len, 0);
+			if(value && !*value) value = NULL;
 
-			nparts++;
-			free(buf);
+			if(op == '-' && value) {
+				copy_value(x, value);
+			} else if((op == '-' && !value) || (op == '+' && value)) {
+				int res = expand_span(x, word, p, depth + 1);
+				if(res) return res;
+			}
+			p++;
+		} else {
+			/* implicit scope $name (eventually terminated by a space,
+			 * dot, quotes, slash or another variable) */
+			name = p;
+			while(p != end && *p != ' ' && *p != '\"' && *p != '\'' &&
+				*p != '\t' && *p != '.' && *p != '\\' && *p != '/' &&
+				*p != '$') p++;
+			if(p == name) return EINVAL;
+			
+			value = get_value(x, name, p - name, 1);
+			if(value) copy_value(x, value);
 		}
-		p++;
 	}
+	return 0;
+}
+
+/*
+ * Returns value of the environment variable with the name of 'len'
+ * characters, or NULL if not set. Values are looked up in the measuring
+ * pass, and taken in the same order in the writing pass, where undefined
+ * variables are reported if 'warn' is set.
+ */
+static const char* get_value(struct expansion *x,
+	const char *name, size_t len, int warn)
+{
+	const char *value;
 	
-	if(!res) {
-		size_t i, len = 1;
-		
-		/* add trailing part (if string didn't end with a variable) */
-		if(p != s) parts[nparts++] = s;
-		p = src;
+	if(!x->out) {
+		value = lookup_env_var(name, len, 0);
+		if(x->nvalues < EXPANSION_VALUES) x->values[x->nvalues++] = value;
+		return value;
+	}
+	
+	if(x->ivalue < x->nvalues) {
+		value = x->values[x->ivalue++];
+		if(!value && warn) lookup_env_var(name, len, warn);
+		return value;
+	}
+	return lookup_env_var(name, len, warn);
+}
 
-		for(i = 0; i < nparts; i++) {
-			if(parts[i] && *parts[i]) len += strlen(parts[i]);
+/*
+ * Returns value of the environment variable with the name of 'len'
+ * characters, or NULL if not set (reported to stderr if 'warn' is set).
+ */
+static const char* lookup_env_var(const char *name, size_t len, int warn)
+{
+	char **env;
+	
+	for(env = environ; *env; env++) {
+		if(**env == *name && !strncmp(*env, name, len) &&
+			(*env)[len] == '=')
+			return *env + len + 1;
+	}
+	if(warn) fprintf(stderr, "Undefined environment variable %.*s\n",
+		(int)len, name);
+	return NULL;
+}
+
+static void copy_value(struct expansion *x, const char *value)
+{
+	size_t len = strlen(value);
+	
+	if(x->out) memcpy(x->out + x->len, value, len);
+	x->len += len;
+}
+
+/*
+ * Splits a command string into separate arguments. On success, *str
+ * receives the buffer holding them and *argv the NULL terminated argument
+ * vector, both of which must be freed by the caller. Returns errno otherwise.
+ */
+int split_command(const char *cmd_spec, char **str_ret, char ***argv_ret)
+{
+	char *str;
+	char *p, *t;
+	char pc = 0;
+	int done = 0;
+	char **argv = NULL;
+	size_t argv_size = 0;
+	unsigned int argc = 0;
+	
+	str = strdup(cmd_spec);
+	if(!str) return ENOMEM;
+
+	p = str;
+	t = NULL;
+	
+	/* split the command string into separate arguments */
+	while(!done){
+		if(!t){
+			while(*p && isblank((int)*p)) p++;
+			if(*p == '\0') break;
+			t = p;
 		}
 		
-		/* compose parts into a single string */
-		buf = malloc(len);
-		if(buf) {
-			buf[0] = '\0';
-
-			for(i = 0; i < nparts; i++) {
-				if(parts[i] && *parts[i]) strcat(buf, parts[i]);
+		if(*p == '\"' || *p == '\''){
+			if(pc == '\\'){
+				/* literal " or ' */
+				memmove(p - 1, p, strlen(p) + 1);
+			}else{
+				/* quotation marks, remove them ignoring blanks within */
+				memmove(p, p + 1, strlen(p));
+				while(*p != '\"' && *p != '\''){
+					if(*p == '\0'){
+						free(str);
+						if(argv) free(argv);
+						return EINVAL;
+					}
+					p++;
+				}
+				memmove(p, p + 1, strlen(p));
 			}
-			*out = buf;
-		} else {
-			res = ENOMEM;
 		}
+		if(isblank((int)*p) || *p == '\0'){
+			if(*p == '\0') done = 1;
+			if(argv_size < argc+2){
+				char **new_ptr;
+				new_ptr = realloc(argv, (argv_size += 64) * sizeof(char*));
+				if(!new_ptr){
+					free(str);
+					if(argv) free(argv);
+					return ENOMEM;
+				}
+				argv=new_ptr;
+			}
+			*p = '\0';
+			argv[argc] = t;
+			
+			#ifdef DEBUG_EXEC
+			printf("argv[%d]: %s\n",argc,argv[argc]);
+			#endif
+			
+			t = NULL;
+			argc++;
+		}
+		pc = *p;
+		p++;
+	}
+	
+	if(!argc) {
+		free(str);
+		return EINVAL;
+	}
+	argv[argc] = NULL;
+	
+	*str_ret = str;
+	*argv_ret = argv;
+	return 0;
+}
+
+/*
+ * Looks up an executable file in directories listed in PATH, or checks the
+ * name as is if it contains a slash. On success *path_ret receives the
+ * malloc()ed path to the file. Returns errno otherwise.
+ */
+int find_in_path(const char *name, char **path_ret)
+{
+	const char *dirs;
+	const char *p, *end;
+	char *path;
+	size_t name_len;
+	int res = ENOENT;
+	
+	if(!*name) return ENOENT;
+	
+	if(strchr(name, '/')) {
+		if(!is_executable(name, &res)) return res;
+		if(!(path = strdup(name))) return ENOMEM;
+		*path_ret = path;
+		return 0;
 	}
+
+	dirs = getenv("PATH");
+	if(!dirs) dirs = DEFAULT_PATH;
+	name_len = strlen(name);
 	
-	free(parts);
-	free(src);
+	path = malloc(strlen(dirs) + name_len + 3);
+	if(!path) return ENOMEM;
+
+	for(p = dirs; ; p = end + 1) {
+		size_t len;
+		
+		end = strchr(p, ':');
+		if(!end) end = p + strlen(p);
+		len = end - p;
+		
+		/* empty PATH element stands for the current directory */
+		if(len) {
+			memcpy(path, p, len);
+		} else {
+			path[0] = '.';
+			len = 1;
+		}
+		path[len] = '/';
+		memcpy(path + len + 1, name, name_len + 1);
+		
+		if(is_executable(path, &res)) {
+			*path_ret = path;
+			return 0;
+		}
+		if(*end == '\0') break;
+	}
+	free(path);
 	return res;
 }
 
+/*
+ * Returns non-zero if path is an executable regular file. Otherwise, *err
+ * is set to EACCES if it's a file that can't be executed.
+ */
+static int is_executable(const char *path, int *err)
+{
+	struct stat st;
+	
+	if(stat(path, &st) || S_ISDIR(st.st_mode)) return 0;
+	if(access(path, X_OK)) {
+		*err = EACCES;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * Returns the number of heap bytes currently allocated, or -1 if the
+ * C library provides no way to tell.
+ */
+long heap_in_use(void)
+{
+	#if defined(__GLIBC__) && \
+		(__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+	struct mallinfo2 mi = mallinfo2();
+	return (long)(mi.uordblks + mi.hblkhd);
+	#elif defined(__GLIBC__)
+	struct mallinfo mi = mallinfo();
+	return (long)mi.uordblks + mi.hblkhd;
+	#else
+	return -1;
+	#endif
+}
+
 char* get_login(void)
 {
 	static char *login = NULL;
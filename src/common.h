@@ -35,9 +35,51 @@ sigfunc_t rsignal(int sig, sigfunc_t);
  * Expands sh style environment variables found in 'in' and returns the
  * expanded string in 'out', which is allocated from the heap and must be
  * freed by the caller. Returns zero on success, errno otherwise.
+ * Recognized forms are $name, ${name}, ${name:-default} (default if name
+ * is unset or empty) and ${name:+alt} (alt if name is set and non-empty).
+ * Default and alt strings are expanded as well. $$ stands for literal $.
  */
 int expand_env_vars(const char *in, char **out);
 
+/* Memoized expansion of a string, see expand_env_vars_memo */
+struct env_memo {
+	const char *in;
+	char *out;
+};
+
+/*
+ * Expands the string in 'm->in' unless it has already been expanded.
+ * On success the result is in 'm->out'.
+ * Returns zero on success, errno otherwise.
+ */
+int expand_env_vars_memo(struct env_memo *m);
+
+/* Frees memoized expansion, leaving the input string intact */
+void free_env_memo(struct env_memo *m);
+
+/*
+ * Splits a command string into separate arguments. On success, *str
+ * receives the buffer holding them and *argv the NULL terminated argument
+ * vector, both of which must be freed by the caller. Returns errno otherwise.
+ */
+int split_command(const char *cmd_spec, char **str, char ***argv);
+
+/* Search path used if PATH is not set */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/*
+ * Looks up an executable file in directories listed in PATH, or checks the
+ * name as is if it contains a slash. On success *path receives the
+ * malloc()ed path to the file. Returns errno otherwise.
+ */
+int find_in_path(const char *name, char **path);
+
+/*
+ * Returns the number of heap bytes currently allocated, or -1 if the
+ * C library provides no way to tell.
+ */
+long heap_in_use(void);
+
 char* get_login(void);
 
 void print_version(const char*);
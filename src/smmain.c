@@ -64,6 +64,7 @@
 #include "smglobal.h"
 #include "smconf.h"
 #include "common.h"
+#include "xmstr.h"
 
 /* Local prototypes */
 static Boolean set_privileges(Boolean);
@@ -592,12 +593,12 @@ static void set_unlock_message(const char *msg)
 	XmString str;
 
 	if(msg){
-		str = XmStringCreateLocalized((char*)msg);
+		str = xmstr_get(msg);
 	}else{
-		str = XmStringCreateSimple(" ");
+		str = xmstr_get(" ");
 	}
 	XtVaSetValues(wmessage,XmNlabelString,str,NULL);
-	XmStringFree(str);
+	xmstr_release(str);
 }
 
 /*
@@ -714,10 +715,10 @@ static void create_locking_widgets(void)
 		
 	locked_by=malloc(strlen(login)+strlen(host)+2);
 	sprintf(locked_by,"%s@%s",login,host);
-	label = XmStringCreateLocalized(locked_by);
+	label = xmstr_get(locked_by);
 	free(locked_by);
 	XtVaSetValues(wtmp,XmNlabelString,label,NULL);
-	XmStringFree(label);
+	xmstr_release(label);
 	XtManageChild(wtmp);
 	
 	/* Since we're disabling most of the input capabilities for the password
@@ -1263,12 +1264,12 @@ static void error_dialog(void)
 		return;
 	}
 	
-	xm_message = XmStringCreateLocalized(
+	xm_message = xmstr_get(
 		"The session manager has encountered an error,\n"
 		"most likely due to improper configuration.\n"
 		"See the log file for details.");
-	xm_title = XmStringCreateLocalized("XmSm");
-	xm_dismiss = XmStringCreateLocalized("Dismiss");
+	xm_title = xmstr_get("XmSm");
+	xm_dismiss = xmstr_get("Dismiss");
 
 	n=0;
 	XtSetArg(args[n], XmNdialogTitle, xm_title); n++;
@@ -1278,9 +1279,9 @@ static void error_dialog(void)
 
 	wdlg = XmCreateErrorDialog(wshell,"messageDialog",args,n);
 
-	XmStringFree(xm_title);
-	XmStringFree(xm_message);
-	XmStringFree(xm_dismiss);
+	xmstr_release(xm_title);
+	xmstr_release(xm_message);
+	xmstr_release(xm_dismiss);
 
 	XtUnmanageChild(XmMessageBoxGetChild(wdlg, XmDIALOG_CANCEL_BUTTON));
 	XtUnmanageChild(XmMessageBoxGetChild(wdlg, XmDIALOG_HELP_BUTTON));
@@ -1356,15 +1357,15 @@ static void exit_session_dialog(void)
 			XmNmwmFunctions, 0, XmNuseAsyncGeometry, False,
 			XmNmappedWhenManaged, False, NULL);
 		
-		string = XmStringCreateLocalized("Leaving Session");
+		string = xmstr_get("Leaving Session");
 		wdialog = XmVaCreateManagedForm(wdlgshell,"confirmExit",
 			XmNmarginHeight, 5, XmNverticalSpacing, 2,
 			XmNdialogTitle, string, XmNfractionBase, 5,
 			XmNdialogStyle, XmDIALOG_SYSTEM_MODAL,
 			XmNautoUnmanage, True, NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		
-		string = XmStringCreateLocalized(
+		string = xmstr_get(
 			"Choose an action to proceed with:");
 		wlabel = XmVaCreateManagedLabelGadget(wdialog,"label",
 			XmNlabelString,string,XmNalignment,XmALIGNMENT_BEGINNING,
@@ -1372,7 +1373,7 @@ static void exit_session_dialog(void)
 			XmNleftAttachment,XmATTACH_POSITION,XmNleftPosition,1,
 			XmNrightAttachment,XmATTACH_POSITION,XmNrightPosition,4,
 			NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		
 	
 		wrc = XmVaCreateManagedRowColumn(wdialog,"rowColumn",
@@ -1382,22 +1383,22 @@ static void exit_session_dialog(void)
 			XmNrightAttachment,XmATTACH_POSITION,XmNrightPosition,4,
 			XmNmarginHeight,1,XmNradioAlwaysOne,True,NULL);
 	
-		string = XmStringCreateLocalized("Log out");
+		string = xmstr_get("Log out");
 		XmVaCreateManagedToggleButtonGadget(wrc,"logOut",
 			XmNlabelString,string,XmNindicatorType,XmONE_OF_MANY,
 			XmNset,True,NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		
-		string = XmStringCreateLocalized("Shut down");
+		string = xmstr_get("Shut down");
 		wshutdown = XmVaCreateToggleButtonGadget(wrc,"shutDown",
 			XmNlabelString,string,XmNindicatorType,XmONE_OF_MANY,NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		if(app_res.show_shutdown) XtManageChild(wshutdown);
 	
-		string = XmStringCreateLocalized("Reboot");
+		string = xmstr_get("Reboot");
 		wreboot = XmVaCreateToggleButtonGadget(wrc,"reboot",
 			XmNlabelString,string,XmNindicatorType,XmONE_OF_MANY,NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		if(app_res.show_reboot) XtManageChild(wreboot);
 
 		wsep = XmVaCreateManagedSeparatorGadget(wdialog,"separator",
@@ -1405,23 +1406,23 @@ static void exit_session_dialog(void)
 			XmNleftAttachment,XmATTACH_FORM,
 			XmNrightAttachment,XmATTACH_FORM,NULL);
 		
-		string = XmStringCreateLocalized("OK");
+		string = xmstr_get("OK");
 		wok = XmVaCreateManagedPushButtonGadget(wdialog,"ok",
 			XmNlabelString,string,XmNactivateCallback,button_cb,
 			XmNtopAttachment,XmATTACH_WIDGET,XmNtopWidget,wsep,
 			XmNleftAttachment,XmATTACH_POSITION,XmNleftPosition,1,
 			XmNrightAttachment,XmATTACH_POSITION,XmNrightPosition,2,
 			XmNbottomAttachment,XmATTACH_FORM,NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 
-		string = XmStringCreateLocalized("Cancel");
+		string = xmstr_get("Cancel");
 		wcancel = XmVaCreateManagedPushButtonGadget(wdialog,"cancel",
 			XmNlabelString,string,XmNactivateCallback,button_cb,
 			XmNtopAttachment,XmATTACH_WIDGET,XmNtopWidget,wsep,
 			XmNleftAttachment,XmATTACH_POSITION,XmNleftPosition,3,
 			XmNrightAttachment,XmATTACH_POSITION,XmNrightPosition,4,
 			XmNbottomAttachment,XmATTACH_FORM,NULL);
-		XmStringFree(string);
+		xmstr_release(string);
 		
 		XtVaSetValues(wdialog, XmNinitialFocus, wok, 
 			XmNdefaultButton, wok, NULL);
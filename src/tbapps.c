@@ -0,0 +1,1193 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Applications menu built from XDG desktop entry files. Files are parsed by
+ * a pool of worker threads, and the results saved in an index along with
+ * signatures of directories they were read from, so that only directories
+ * modified since the index was written need to be read again.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tbparse.h"
+#include "tbcache.h"
+#include "tbapps.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define INDEX_NAME "applications"
+#define INDEX_MAGIC "XMTBAPPS 1"
+
+/* Worker threads used to parse desktop files, including the calling one */
+#define MAX_WORKERS 8
+/* Number of files below which a single thread is used */
+#define FILES_PER_WORKER 32
+/* Desktop files larger than this are ignored */
+#define MAX_DESKTOP_FILE (64 * 1024)
+
+/* Command prefix for applications that need a terminal */
+#define TERMINAL_COMMAND "xterm -e "
+
+#define NAME_POOL_GROW 4096
+#define NAMES_GROW 64
+
+/* Application read from a desktop file, or the index */
+struct app {
+	const char *file; /* name of the desktop file */
+	const char *name;
+	const char *categories;
+	const char *exec;
+	/* not shown, but still overrides same id in lower precedence dirs */
+	int hidden;
+	char *data; /* malloc()ed strings, unless these are in the index */
+};
+
+/* Applications directory, or a subdirectory of one */
+struct app_dir {
+	char *path;
+	unsigned int root; /* index of the applications directory it's in */
+	size_t root_len; /* length of its path */
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t stamp; /* when the directory was read */
+	int fresh; /* read now, rather than taken from the index */
+	struct app *apps;
+	size_t napps;
+	const char **subdirs;
+	size_t nsubdirs;
+	char *pool; /* names in a freshly read directory */
+};
+
+/* A list of directories, as walked or as read from the index */
+struct dir_list {
+	struct app_dir *dirs;
+	size_t count;
+	size_t size;
+};
+
+/* Locale suffixes of localized keys to look for, e.g. [de_AT] and [de] */
+struct locale_names {
+	char full[32];
+	char lang[16];
+};
+
+/* Desktop files shared among worker threads */
+struct parse_jobs {
+	pthread_mutex_t lock;
+	struct app **apps;
+	const char **dirs;
+	size_t count;
+	size_t next;
+	const struct locale_names *loc;
+};
+
+/* Application to be shown, with its main category */
+struct menu_app {
+	const char *name;
+	const char *exec;
+	int category;
+};
+
+/* Main categories (of the freedesktop.org menu specification), and titles
+ * of the cascades they are shown in, in the order cascades are shown */
+static const struct {
+	const char *name;
+	int cascade;
+} main_categories[] = {
+	{ "AudioVideo", 4 }, { "Audio", 4 }, { "Video", 4 },
+	{ "Development", 1 }, { "Education", 2 }, { "Game", 3 },
+	{ "Graphics", 5 }, { "Network", 6 }, { "Office", 7 },
+	{ "Science", 8 }, { "Settings", 9 }, { "System", 10 },
+	{ "Utility", 0 }
+};
+
+static const char *cascade_titles[] = {
+	"Accessories", "Development", "Education", "Games", "Graphics",
+	"Internet", "Multimedia", "Office", "Science", "Settings", "System",
+	"Other"
+};
+
+#define NUM_MAIN_CATEGORIES \
+	(sizeof(main_categories) / sizeof(main_categories[0]))
+#define NUM_CASCADES (sizeof(cascade_titles) / sizeof(cascade_titles[0]))
+#define OTHER_CASCADE (NUM_CASCADES - 1)
+
+static int get_app_roots(char ***roots, size_t *count);
+static int walk_dirs(char **roots, size_t nroots,
+	struct dir_list *index, struct dir_list *out);
+static struct app_dir* add_dir(struct dir_list*);
+static int take_indexed(struct dir_list *index,
+	const struct stat*, struct app_dir*);
+static int read_app_dir(struct app_dir*);
+static int parse_all(struct dir_list*);
+static void* parse_worker(void*);
+static void parse_desktop_file(const char *dir,
+	struct app*, const struct locale_names*);
+static char* unescape_value(char *value);
+static size_t make_command(char *out, const char *exec, int terminal);
+static void get_locale_names(struct locale_names*);
+static int build_menu(struct tb_parser*, struct dir_list*);
+static int main_category(const char *categories);
+static int compare_apps(const void*, const void*);
+static int id_seen(char **ids, size_t size, const char *id);
+static char* make_id(const struct app_dir*, const char *file);
+static int read_index(const char *path, char **buf, struct dir_list*);
+static int write_index(const char *dir, const struct dir_list*);
+static void put_field(FILE*, const char*);
+static void free_dirs(struct dir_list*);
+
+
+int tb_apps_load(struct tb_parser *p, const struct tb_menu **menu)
+{
+	struct dir_list index;
+	struct dir_list dirs;
+	char **roots = NULL;
+	size_t nroots = 0;
+	char *index_buf = NULL;
+	char *user_dir;
+	char *index_path = NULL;
+	size_t i;
+	int changed = 0;
+	int err;
+	
+	memset(&index, 0, sizeof(index));
+	memset(&dirs, 0, sizeof(dirs));
+
+	if((err = get_app_roots(&roots, &nroots))) return err;
+	
+	user_dir = tb_user_cache_dir();
+	if(user_dir) {
+		size_t len = strlen(user_dir) + strlen(INDEX_NAME) + 2;
+
+		if((index_path = malloc(len))) {
+			snprintf(index_path, len, "%s/%s", user_dir, INDEX_NAME);
+			/* a missing or damaged index just means reading everything */
+			if(read_index(index_path, &index_buf, &index)) {
+				free_dirs(&index);
+				memset(&index, 0, sizeof(index));
+			}
+		}
+	}
+	
+	err = walk_dirs(roots, nroots, &index, &dirs);
+	if(!err) err = parse_all(&dirs);
+	if(!err) err = build_menu(p, &dirs);
+	
+	if(!err && user_dir) {
+		/* rewrite the index if anything was read anew, or went away */
+		for(i = 0; i < dirs.count && !changed; i++)
+			if(dirs.dirs[i].fresh) changed = 1;
+		for(i = 0; i < index.count && !changed; i++)
+			if(index.dirs[i].path) changed = 1;
+		if(changed || !index_buf) {
+			tb_make_cache_dir(user_dir);
+			write_index(user_dir, &dirs);
+		}
+	}
+
+	for(i = 0; i < nroots; i++) free(roots[i]);
+	free(roots);
+	free_dirs(&index);
+	free_dirs(&dirs);
+	free(index_buf);
+	free(index_path);
+	free(user_dir);
+	
+	if(err) return err;
+	*menu = tb_parser_menu(p);
+	return 0;
+}
+
+/*
+ * Makes a list of applications directories, in order of precedence.
+ */
+static int get_app_roots(char ***ret, size_t *count)
+{
+	const char *home = getenv("HOME");
+	const char *data_home = getenv("XDG_DATA_HOME");
+	const char *data_dirs = getenv("XDG_DATA_DIRS");
+	const char *p;
+	char **roots;
+	size_t n = 2;
+	
+	if(!data_dirs || !*data_dirs) data_dirs = "/usr/local/share:/usr/share";
+	for(p = data_dirs; *p; p++) {
+		if(*p == ':') n++;
+	}
+	if(!(roots = calloc(n, sizeof(char*)))) return ENOMEM;
+	n = 0;
+	
+	if(data_home && *data_home) {
+		size_t len = strlen(data_home) + 16;
+
+		if((roots[n] = malloc(len)))
+			snprintf(roots[n++], len, "%s/applications", data_home);
+	} else if(home) {
+		size_t len = strlen(home) + 32;
+
+		if((roots[n] = malloc(len)))
+			snprintf(roots[n++], len, "%s/.local/share/applications", home);
+	}
+	
+	for(p = data_dirs; *p; ) {
+		const char *end = strchr(p, ':');
+		size_t len = end ? (size_t)(end - p) : strlen(p);
+		
+		if(len && (roots[n] = malloc(len + 16))) {
+			memcpy(roots[n], p, len);
+			strcpy(roots[n] + len, "/applications");
+			n++;
+		}
+		p += len;
+		if(*p == ':') p++;
+	}
+	
+	*ret = roots;
+	*count = n;
+	return 0;
+}
+
+/*
+ * Walks applications directories and their subdirectories, taking contents
+ * of those unchanged from the index, and reading the rest. Index entries
+ * taken have their path set to NULL.
+ */
+static int walk_dirs(char **roots, size_t nroots,
+	struct dir_list *index, struct dir_list *out)
+{
+	struct app_dir *dir;
+	struct stat st;
+	size_t i, j;
+	int err;
+	
+	for(i = 0; i < nroots; i++) {
+		if(!(dir = add_dir(out))) return ENOMEM;
+		if(!(dir->path = strdup(roots[i]))) return ENOMEM;
+		dir->root = i;
+		dir->root_len = strlen(roots[i]);
+	}
+	
+	/* subdirectories are appended as found, and walked in turn */
+	for(i = 0; i < out->count; i++) {
+		dir = &out->dirs[i];
+		
+		if(stat(dir->path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+			free(dir->path);
+			dir->path = NULL;
+			continue;
+		}
+
+		/* the same directory listed twice, or a symlink loop */
+		for(j = 0; j < i; j++) {
+			if(out->dirs[j].path && out->dirs[j].dev == st.st_dev &&
+				out->dirs[j].ino == st.st_ino) break;
+		}
+		if(j < i) {
+			free(dir->path);
+			dir->path = NULL;
+			continue;
+		}
+		
+		dir->dev = st.st_dev;
+		dir->ino = st.st_ino;
+		dir->mtime = st.st_mtime;
+		
+		if(!take_indexed(index, &st, dir)) {
+			dir->fresh = 1;
+			dir->stamp = time(NULL);
+			if((err = read_app_dir(dir)) && err != EACCES) return err;
+		}
+
+		for(j = 0; j < dir->nsubdirs; j++) {
+			struct app_dir *sub;
+			const char *parent;
+			size_t len;
+
+			if(!(sub = add_dir(out))) return ENOMEM;
+			dir = &out->dirs[i]; /* add_dir may have moved it */
+			parent = dir->path;
+			len = strlen(parent) + strlen(dir->subdirs[j]) + 2;
+			if(!(sub->path = malloc(len))) return ENOMEM;
+			snprintf(sub->path, len, "%s/%s", parent, dir->subdirs[j]);
+			sub->root = dir->root;
+			sub->root_len = dir->root_len;
+		}
+	}
+	return 0;
+}
+
+/* Appends a zeroed directory to the list. Returns NULL if out of memory. */
+static struct app_dir* add_dir(struct dir_list *list)
+{
+	struct app_dir *dir;
+
+	if(list->count == list->size) {
+		size_t new_size = list->size ? list->size * 2 : NAMES_GROW;
+		struct app_dir *new_ptr;
+		
+		new_ptr = realloc(list->dirs, new_size * sizeof(struct app_dir));
+		if(!new_ptr) return NULL;
+		list->dirs = new_ptr;
+		list->size = new_size;
+	}
+	dir = &list->dirs[list->count++];
+	memset(dir, 0, sizeof(struct app_dir));
+	return dir;
+}
+
+/*
+ * Moves contents of the directory from the index, if it's there and wasn't
+ * modified since. As with tbdir.c, contents read within the same second
+ * the directory was last modified in may be incomplete, and aren't used.
+ * Returns non-zero if taken.
+ */
+static int take_indexed(struct dir_list *index,
+	const struct stat *st, struct app_dir *dir)
+{
+	struct app_dir *in;
+	size_t i;
+	
+	for(i = 0; i < index->count; i++) {
+		in = &index->dirs[i];
+		if(in->path && !strcmp(in->path, dir->path)) break;
+	}
+	if(i == index->count) return 0;
+	
+	if(in->dev != st->st_dev || in->ino != st->st_ino ||
+		in->mtime != st->st_mtime || in->mtime >= in->stamp) return 0;
+	
+	dir->stamp = in->stamp;
+	dir->apps = in->apps;
+	dir->napps = in->napps;
+	dir->subdirs = in->subdirs;
+	dir->nsubdirs = in->nsubdirs;
+	
+	free(in->path);
+	memset(in, 0, sizeof(struct app_dir));
+	return 1;
+}
+
+/*
+ * Lists desktop files and subdirectories of the directory. Desktop files
+ * are only recorded here, and parsed later by parse_all.
+ */
+static int read_app_dir(struct app_dir *dir)
+{
+	DIR *dh;
+	struct dirent *de;
+	size_t *offsets = NULL;
+	char *is_file = NULL;
+	size_t nnames = 0;
+	size_t names_size = 0;
+	size_t pool_len = 0;
+	size_t pool_size = 0;
+	size_t path_len = strlen(dir->path);
+	size_t i, nfiles = 0;
+	int err = 0;
+	
+	if(!(dh = opendir(dir->path))) return errno;
+	
+	while((de = readdir(dh))) {
+		size_t len = strlen(de->d_name);
+		int file;
+		
+		if(de->d_name[0] == '.') continue;
+		
+		#ifdef DT_DIR
+		if(de->d_type == DT_DIR) {
+			file = 0;
+		} else if(de->d_type == DT_REG) {
+			file = 1;
+		} else
+		#endif
+		{
+			struct stat st;
+			char *path = malloc(path_len + len + 2);
+			
+			if(!path) {
+				err = ENOMEM;
+				break;
+			}
+			sprintf(path, "%s/%s", dir->path, de->d_name);
+			if(stat(path, &st) == -1) {
+				free(path);
+				continue;
+			}
+			free(path);
+			file = !S_ISDIR(st.st_mode);
+		}
+		
+		if(file && (len <= 8 || strcmp(de->d_name + len - 8, ".desktop")))
+			continue;
+		
+		if(nnames == names_size) {
+			size_t *new_offsets;
+			char *new_flags;
+			
+			names_size += NAMES_GROW;
+			new_offsets = realloc(offsets, names_size * sizeof(size_t));
+			if(new_offsets) offsets = new_offsets;
+			new_flags = realloc(is_file, names_size);
+			if(new_flags) is_file = new_flags;
+			if(!new_offsets || !new_flags) {
+				err = ENOMEM;
+				break;
+			}
+		}
+		
+		if(pool_len + len + 1 > pool_size) {
+			char *new_pool;
+			
+			pool_size += (len + 1 > NAME_POOL_GROW) ?
+				len + 1 : NAME_POOL_GROW;
+			if(!(new_pool = realloc(dir->pool, pool_size))) {
+				err = ENOMEM;
+				break;
+			}
+			dir->pool = new_pool;
+		}
+		memcpy(dir->pool + pool_len, de->d_name, len + 1);
+		offsets[nnames] = pool_len;
+		is_file[nnames] = file;
+		pool_len += len + 1;
+		nnames++;
+		if(file) nfiles++;
+	}
+	closedir(dh);
+	
+	if(!err && nnames) {
+		dir->apps = calloc(nfiles + 1, sizeof(struct app));
+		dir->subdirs = calloc(nnames - nfiles + 1, sizeof(char*));
+		if(!dir->apps || !dir->subdirs) err = ENOMEM;
+	}
+	
+	for(i = 0; i < nnames && !err; i++) {
+		if(is_file[i])
+			dir->apps[dir->napps++].file = dir->pool + offsets[i];
+		else
+			dir->subdirs[dir->nsubdirs++] = dir->pool + offsets[i];
+	}
+	
+	free(offsets);
+	free(is_file);
+	return err;
+}
+
+/*
+ * Parses desktop files in directories read anew, using a pool of threads
+ * proportional to their number.
+ */
+static int parse_all(struct dir_list *list)
+{
+	struct parse_jobs jobs;
+	struct locale_names loc;
+	pthread_t threads[MAX_WORKERS - 1];
+	size_t nthreads = 0;
+	size_t i, j, n = 0;
+	long ncpus;
+	
+	for(i = 0; i < list->count; i++) {
+		if(list->dirs[i].fresh) n += list->dirs[i].napps;
+	}
+	if(!n) return 0;
+	
+	memset(&jobs, 0, sizeof(jobs));
+	jobs.apps = malloc(n * sizeof(struct app*));
+	jobs.dirs = malloc(n * sizeof(char*));
+	if(!jobs.apps || !jobs.dirs) {
+		free(jobs.apps);
+		free(jobs.dirs);
+		return ENOMEM;
+	}
+
+	for(i = 0; i < list->count; i++) {
+		struct app_dir *dir = &list->dirs[i];
+
+		if(!dir->fresh) continue;
+		for(j = 0; j < dir->napps; j++) {
+			jobs.apps[jobs.count] = &dir->apps[j];
+			jobs.dirs[jobs.count] = dir->path;
+			jobs.count++;
+		}
+	}
+	
+	get_locale_names(&loc);
+	jobs.loc = &loc;
+	pthread_mutex_init(&jobs.lock, NULL);
+	
+	#ifdef _SC_NPROCESSORS_ONLN
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	#else
+	ncpus = 1;
+	#endif
+	if(ncpus > MAX_WORKERS) ncpus = MAX_WORKERS;
+	if(ncpus > (long)(n / FILES_PER_WORKER)) ncpus = n / FILES_PER_WORKER;
+	
+	/* the calling thread works as well, so failing to start others
+	 * only makes it slower */
+	while((long)nthreads + 1 < ncpus) {
+		if(pthread_create(&threads[nthreads], NULL,
+			parse_worker, &jobs)) break;
+		nthreads++;
+	}
+	parse_worker(&jobs);
+	
+	for(i = 0; i < nthreads; i++) pthread_join(threads[i], NULL);
+	
+	pthread_mutex_destroy(&jobs.lock);
+	free(jobs.apps);
+	free(jobs.dirs);
+	return 0;
+}
+
+static void* parse_worker(void *arg)
+{
+	struct parse_jobs *jobs = (struct parse_jobs*)arg;
+	size_t i;
+	
+	for(;;) {
+		pthread_mutex_lock(&jobs->lock);
+		i = jobs->next++;
+		pthread_mutex_unlock(&jobs->lock);
+		
+		if(i >= jobs->count) break;
+		parse_desktop_file(jobs->dirs[i], jobs->apps[i], jobs->loc);
+	}
+	return NULL;
+}
+
+/*
+ * Reads application's name, categories and command from a desktop file.
+ * Applications that aren't meant to be shown, or whose file can't be
+ * read or lacks required keys, are marked hidden.
+ */
+static void parse_desktop_file(const char *dir,
+	struct app *app, const struct locale_names *loc)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	char *buf, *line, *next;
+	char *name = NULL, *exec = NULL, *categories = NULL;
+	int name_rank = -1;
+	int in_group = 0;
+	int terminal = 0;
+	size_t len;
+	ssize_t rv;
+	int fd;
+	
+	app->hidden = 1;
+	
+	snprintf(path, sizeof(path), "%s/%s", dir, app->file);
+	if((fd = open(path, O_RDONLY)) == -1) return;
+	
+	if(fstat(fd, &st) == -1 || st.st_size > MAX_DESKTOP_FILE ||
+		!(buf = malloc(st.st_size + 1))) {
+		close(fd);
+		return;
+	}
+	rv = read(fd, buf, st.st_size);
+	close(fd);
+	if(rv < 0) {
+		free(buf);
+		return;
+	}
+	buf[rv] = '\0';
+	app->hidden = 0;
+	
+	for(line = buf; line; line = next) {
+		char *key, *value, *p;
+		
+		if((next = strchr(line, '\n'))) *next++ = '\0';
+		
+		if(*line == '[') {
+			/* keys of interest are in the first group only */
+			if(in_group) break;
+			in_group = !strncmp(line, "[Desktop Entry]", 15);
+			continue;
+		}
+		if(!in_group || *line == '#' || !(p = strchr(line, '='))) continue;
+		
+		value = p + 1;
+		while(p != line && (p[-1] == ' ' || p[-1] == '\t')) p--;
+		*p = '\0';
+		key = line;
+		while(*value == ' ' || *value == '\t') value++;
+		
+		if(!strcmp(key, "Type")) {
+			if(strcmp(value, "Application")) app->hidden = 1;
+		} else if(!strcmp(key, "NoDisplay") || !strcmp(key, "Hidden")) {
+			if(!strcmp(value, "true")) app->hidden = 1;
+		} else if(!strcmp(key, "Terminal")) {
+			terminal = !strcmp(value, "true");
+		} else if(!strcmp(key, "Exec")) {
+			exec = unescape_value(value);
+		} else if(!strcmp(key, "Categories")) {
+			categories = unescape_value(value);
+		} else if(!strncmp(key, "Name", 4)) {
+			int rank = -1;
+			
+			if(key[4] == '\0') {
+				rank = 0;
+			} else if(key[4] == '[' && (len = strlen(key + 5)) &&
+				key[4 + len] == ']') {
+				if(len - 1 == strlen(loc->full) &&
+					!strncmp(key + 5, loc->full, len - 1)) rank = 2;
+				else if(len - 1 == strlen(loc->lang) &&
+					!strncmp(key + 5, loc->lang, len - 1)) rank = 1;
+			}
+			if(rank > name_rank) {
+				name = unescape_value(value);
+				name_rank = rank;
+			}
+		}
+	}
+	
+	if(!name || !*name || !exec || !*exec) app->hidden = 1;
+	
+	if(!app->hidden) {
+		size_t name_len = strlen(name) + 1;
+		size_t cat_len = categories ? strlen(categories) + 1 : 1;
+		/* '$' may double, and the terminal may be prepended */
+		size_t exec_size = strlen(exec) * 2 + sizeof(TERMINAL_COMMAND);
+		
+		if((app->data = malloc(name_len + cat_len + exec_size))) {
+			char *out = app->data;
+			
+			memcpy(out, name, name_len);
+			app->name = out;
+			out += name_len;
+			
+			if(categories) memcpy(out, categories, cat_len);
+			else *out = '\0';
+			app->categories = out;
+			out += cat_len;
+			
+			make_command(out, exec, terminal);
+			app->exec = out;
+			if(!*app->exec) app->hidden = 1;
+		} else {
+			app->hidden = 1;
+		}
+	}
+	free(buf);
+}
+
+/*
+ * Unescapes a desktop entry string value in place. Control characters
+ * are replaced with spaces, since the index is line and tab delimited.
+ */
+static char* unescape_value(char *value)
+{
+	char *in = value, *out = value;
+	
+	while(*in) {
+		if(*in == '\\' && in[1]) {
+			in++;
+			switch(*in) {
+				case 's': case 'n': case 't': case 'r':
+				*out++ = ' ';
+				break;
+				default:
+				*out++ = *in;
+				break;
+			}
+			in++;
+		} else {
+			*out++ = ((unsigned char)*in < 0x20) ? ' ' : *in;
+			in++;
+		}
+	}
+	*out = '\0';
+	return value;
+}
+
+/*
+ * Converts an Exec key value into a toolbox command string: field codes
+ * are removed (along with quotes enclosing them), and '$' is escaped.
+ * Returns length of the result.
+ */
+static size_t make_command(char *out, const char *exec, int terminal)
+{
+	char *start = out;
+	
+	if(terminal) {
+		strcpy(out, TERMINAL_COMMAND);
+		out += strlen(TERMINAL_COMMAND);
+	}
+	
+	while(*exec) {
+		if(*exec == '%' && exec[1]) {
+			if(exec[1] == '%') {
+				*out++ = '%';
+			} else if(out != start && out[-1] == '\"' && exec[2] == '\"') {
+				/* a quoted field code; drop the quotes too */
+				out--;
+				exec++;
+			}
+			exec += 2;
+			/* and the blank separating it */
+			if(out != start && out[-1] == ' ' && *exec == ' ') exec++;
+		} else if(*exec == '$') {
+			*out++ = '$';
+			*out++ = '$';
+			exec++;
+		} else {
+			*out++ = *exec++;
+		}
+	}
+	
+	/* trailing blanks left from removed field codes */
+	while(out != start && out[-1] == ' ') out--;
+	*out = '\0';
+	return out - start;
+}
+
+/*
+ * Figures out locale suffixes of localized keys from LC_ALL, LC_MESSAGES
+ * or LANG, e.g. de_AT.UTF-8@euro gives de_AT and de.
+ */
+static void get_locale_names(struct locale_names *loc)
+{
+	const char *vars[] = { "LC_ALL", "LC_MESSAGES", "LANG" };
+	const char *value = NULL;
+	size_t i, len;
+	
+	memset(loc, 0, sizeof(struct locale_names));
+	
+	for(i = 0; i < sizeof(vars) / sizeof(vars[0]); i++) {
+		value = getenv(vars[i]);
+		if(value && *value) break;
+	}
+	if(!value || !*value || !strcmp(value, "C") || !strcmp(value, "POSIX"))
+		return;
+	
+	len = strcspn(value, ".@");
+	if(len >= sizeof(loc->full)) return;
+	memcpy(loc->full, value, len);
+	
+	len = strcspn(loc->full, "_");
+	if(len >= sizeof(loc->lang)) return;
+	memcpy(loc->lang, loc->full, len);
+}
+
+/*
+ * Places visible applications in the parser as a menu tree; cascades
+ * for categories at the top level, and commands within them. Desktop
+ * file ids already seen in higher precedence directories are skipped.
+ */
+static int build_menu(struct tb_parser *p, struct dir_list *list)
+{
+	struct menu_app *apps;
+	struct tb_entry *entries;
+	unsigned int counts[NUM_CASCADES];
+	char **ids;
+	size_t nids = 0;
+	size_t napps = 0;
+	size_t nentries;
+	size_t pool_size = 0;
+	size_t i, j, r, k;
+	unsigned int max_root = 0;
+	char *pool, *out;
+	int err = 0;
+	
+	for(i = 0; i < list->count; i++) {
+		nids += list->dirs[i].napps;
+		if(list->dirs[i].root > max_root) max_root = list->dirs[i].root;
+	}
+	
+	if(!nids) {
+		tb_parser_release(p);
+		return 0;
+	}
+	
+	/* open addressing hash table of ids, at most half full */
+	apps = calloc(nids, sizeof(struct menu_app));
+	ids = calloc(nids * 2, sizeof(char*));
+	if(!apps || !ids) {
+		free(apps);
+		free(ids);
+		return ENOMEM;
+	}
+	
+	memset(counts, 0, sizeof(counts));
+
+	for(r = 0; r <= max_root && !err; r++) {
+		for(i = 0; i < list->count && !err; i++) {
+			struct app_dir *dir = &list->dirs[i];
+
+			if(!dir->path || dir->root != r) continue;
+
+			for(j = 0; j < dir->napps; j++) {
+				struct app *app = &dir->apps[j];
+				char *id = make_id(dir, app->file);
+				
+				if(!id) {
+					err = ENOMEM;
+					break;
+				}
+				if(id_seen(ids, nids * 2, id)) {
+					free(id);
+					continue;
+				}
+				if(app->hidden) continue;
+				
+				apps[napps].name = app->name;
+				apps[napps].exec = app->exec;
+				apps[napps].category = main_category(app->categories);
+				counts[apps[napps].category]++;
+				pool_size += strlen(app->name) + strlen(app->exec) + 2;
+				napps++;
+			}
+		}
+	}
+	
+	nentries = napps;
+	for(k = 0; k < NUM_CASCADES; k++) {
+		if(counts[k]) {
+			nentries++;
+			pool_size += strlen(cascade_titles[k]) + 1;
+		}
+	}
+	
+	if(!err && !napps) {
+		tb_parser_release(p);
+	} else if(!err) {
+		qsort(apps, napps, sizeof(struct menu_app), compare_apps);
+
+		/* strings go into anonymous memory, so that the parser
+		 * can own them like a cache image */
+		pool = mmap(NULL, pool_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		entries = calloc(nentries, sizeof(struct tb_entry));
+		
+		if(pool == MAP_FAILED || !entries) {
+			if(pool != MAP_FAILED) munmap(pool, pool_size);
+			free(entries);
+			err = ENOMEM;
+		} else {
+			int category = -1;
+			
+			out = pool;
+			for(i = 0, j = 0; i < napps; i++) {
+				if(apps[i].category != category) {
+					category = apps[i].category;
+					entries[j].type = TBE_CASCADE;
+					entries[j].level = 0;
+					entries[j].title = out;
+					out = stpcpy(out, cascade_titles[category]) + 1;
+					j++;
+				}
+				entries[j].type = TBE_COMMAND;
+				entries[j].level = 1;
+				entries[j].ttl = TB_DEFAULT_TTL;
+				entries[j].title = out;
+				out = stpcpy(out, apps[i].name) + 1;
+				entries[j].command = out;
+				out = stpcpy(out, apps[i].exec) + 1;
+				j++;
+			}
+			
+			if((err = tb_parser_adopt_image(p, pool,
+				pool_size, entries, nentries))) {
+				munmap(pool, pool_size);
+				free(entries);
+			}
+		}
+	}
+	
+	for(i = 0; i < nids * 2; i++) free(ids[i]);
+	free(ids);
+	free(apps);
+	return err;
+}
+
+/* Returns cascade index of the first main category in the list */
+static int main_category(const char *categories)
+{
+	const char *p = categories;
+	size_t i, len;
+	
+	while(*p) {
+		len = strcspn(p, ";");
+		for(i = 0; i < NUM_MAIN_CATEGORIES; i++) {
+			if(strlen(main_categories[i].name) == len &&
+				!strncmp(main_categories[i].name, p, len))
+				return main_categories[i].cascade;
+		}
+		p += len;
+		if(*p == ';') p++;
+	}
+	return OTHER_CASCADE;
+}
+
+static int compare_apps(const void *pa, const void *pb)
+{
+	const struct menu_app *a = (const struct menu_app*)pa;
+	const struct menu_app *b = (const struct menu_app*)pb;
+	
+	if(a->category != b->category) return a->category - b->category;
+	return strcoll(a->name, b->name);
+}
+
+/*
+ * Adds the id to the hash table, unless already there. Returns non-zero
+ * if it was there. The table takes ownership of the id if added.
+ */
+static int id_seen(char **ids, size_t size, const char *id)
+{
+	unsigned int hash = 2166136261U;
+	const char *p;
+	size_t i;
+	
+	for(p = id; *p; p++) {
+		hash ^= (unsigned char)*p;
+		hash *= 16777619U;
+	}
+	
+	for(i = hash % size; ids[i]; i = (i + 1) % size) {
+		if(!strcmp(ids[i], id)) return 1;
+	}
+	ids[i] = (char*)id;
+	return 0;
+}
+
+/*
+ * Returns malloc()ed desktop file id, which is its path relative to the
+ * applications directory, with slashes replaced by dashes.
+ */
+static char* make_id(const struct app_dir *dir, const char *file)
+{
+	const char *rel = dir->path + dir->root_len;
+	size_t len;
+	char *id, *p;
+	
+	if(*rel == '/') rel++;
+	len = strlen(rel) + strlen(file) + 2;
+	if(!(id = malloc(len))) return NULL;
+	
+	if(*rel) snprintf(id, len, "%s/%s", rel, file);
+	else strcpy(id, file);
+	
+	for(p = id; *p; p++) {
+		if(*p == '/') *p = '-';
+	}
+	return id;
+}
+
+/*
+ * Reads the index file into *buf, and builds the list of directories in it.
+ * Strings in the list refer to the buffer, except directory paths, which
+ * are malloc()ed. Returns zero on success.
+ */
+static int read_index(const char *path, char **ret_buf, struct dir_list *list)
+{
+	struct stat st;
+	struct app_dir *dir = NULL;
+	char *buf, *line, *next;
+	size_t napps = 0, nsubdirs = 0;
+	ssize_t rv;
+	int fd;
+	
+	if((fd = open(path, O_RDONLY)) == -1) return errno;
+	if(fstat(fd, &st) == -1 || !(buf = malloc(st.st_size + 1))) {
+		close(fd);
+		return ENOMEM;
+	}
+	rv = read(fd, buf, st.st_size);
+	close(fd);
+	*ret_buf = buf;
+	if(rv != st.st_size) return EIO;
+	buf[rv] = '\0';
+	
+	line = buf;
+	if((next = strchr(line, '\n'))) *next++ = '\0';
+	if(strcmp(line, INDEX_MAGIC)) return EINVAL;
+	
+	/* D <dev> <ino> <mtime> <stamp> <napps> <nsubdirs> <path>
+	 * A <file> <hidden> <name> <categories> <command>
+	 * S <name> */
+	for(line = next; line && *line; line = next) {
+		char *fields[8];
+		size_t i, n = 0;
+		char *p = line;
+		
+		if((next = strchr(line, '\n'))) *next++ = '\0';
+		
+		fields[n++] = p;
+		while(n < 8 && (p = strchr(p, '\t'))) {
+			*p++ = '\0';
+			fields[n++] = p;
+		}
+		
+		if(!strcmp(fields[0], "D") && n == 8) {
+			if(dir && (napps != dir->napps || nsubdirs != dir->nsubdirs))
+				return EINVAL;
+			if(!(dir = add_dir(list))) return ENOMEM;
+			dir->dev = (dev_t)strtoull(fields[1], NULL, 10);
+			dir->ino = (ino_t)strtoull(fields[2], NULL, 10);
+			dir->mtime = (time_t)strtoll(fields[3], NULL, 10);
+			dir->stamp = (time_t)strtoll(fields[4], NULL, 10);
+			dir->napps = strtoul(fields[5], NULL, 10);
+			dir->nsubdirs = strtoul(fields[6], NULL, 10);
+			dir->apps = calloc(dir->napps + 1, sizeof(struct app));
+			dir->subdirs = calloc(dir->nsubdirs + 1, sizeof(char*));
+			if(!(dir->path = strdup(fields[7])) ||
+				!dir->apps || !dir->subdirs) return ENOMEM;
+			napps = 0;
+			nsubdirs = 0;
+		} else if(!strcmp(fields[0], "A") && n == 6 && dir) {
+			struct app *app;
+			
+			if(napps == dir->napps) return EINVAL;
+			app = &dir->apps[napps++];
+			app->file = fields[1];
+			app->hidden = (fields[2][0] == '1');
+			app->name = fields[3];
+			app->categories = fields[4];
+			app->exec = fields[5];
+		} else if(!strcmp(fields[0], "S") && n == 2 && dir) {
+			if(nsubdirs == dir->nsubdirs) return EINVAL;
+			dir->subdirs[nsubdirs++] = fields[1];
+		} else {
+			return EINVAL;
+		}
+		for(i = 0; i < n; i++) {
+			if(!*fields[i] && i != 4) return EINVAL;
+		}
+	}
+	if(dir && (napps != dir->napps || nsubdirs != dir->nsubdirs))
+		return EINVAL;
+	return 0;
+}
+
+/* Writes the index for directories in the list */
+static int write_index(const char *user_dir, const struct dir_list *list)
+{
+	char *path, *tmp_path;
+	size_t len = strlen(user_dir) + strlen(INDEX_NAME) + 16;
+	size_t i, j;
+	FILE *f;
+	int fd, err = 0;
+	
+	path = malloc(len);
+	tmp_path = malloc(len);
+	if(!path || !tmp_path) {
+		free(path);
+		free(tmp_path);
+		return ENOMEM;
+	}
+	snprintf(path, len, "%s/%s", user_dir, INDEX_NAME);
+	snprintf(tmp_path, len, "%s/.tbaXXXXXX", user_dir);
+	
+	if((fd = mkstemp(tmp_path)) == -1 || !(f = fdopen(fd, "w"))) {
+		err = errno;
+		if(fd != -1) {
+			close(fd);
+			unlink(tmp_path);
+		}
+		free(path);
+		free(tmp_path);
+		return err;
+	}
+	
+	fprintf(f, "%s\n", INDEX_MAGIC);
+	for(i = 0; i < list->count; i++) {
+		const struct app_dir *dir = &list->dirs[i];
+		
+		if(!dir->path) continue;
+		fprintf(f, "D\t%llu\t%llu\t%lld\t%lld\t%lu\t%lu\t",
+			(unsigned long long)dir->dev, (unsigned long long)dir->ino,
+			(long long)dir->mtime, (long long)dir->stamp,
+			(unsigned long)dir->napps, (unsigned long)dir->nsubdirs);
+		put_field(f, dir->path);
+		fputc('\n', f);
+		
+		for(j = 0; j < dir->napps; j++) {
+			const struct app *app = &dir->apps[j];
+			
+			fputs("A\t", f);
+			put_field(f, app->file);
+			if(app->hidden) {
+				fputs("\t1\t-\t\t-\n", f);
+				continue;
+			}
+			fputs("\t0\t", f);
+			put_field(f, app->name);
+			fputc('\t', f);
+			put_field(f, app->categories);
+			fputc('\t', f);
+			put_field(f, app->exec);
+			fputc('\n', f);
+		}
+		for(j = 0; j < dir->nsubdirs; j++) {
+			fputs("S\t", f);
+			put_field(f, dir->subdirs[j]);
+			fputc('\n', f);
+		}
+	}
+	
+	if(ferror(f)) err = EIO;
+	if(fclose(f) && !err) err = errno;
+	if(!err && rename(tmp_path, path) == -1) err = errno;
+	if(err) unlink(tmp_path);
+	
+	free(path);
+	free(tmp_path);
+	return err;
+}
+
+/* Writes a string, replacing characters that delimit index fields */
+static void put_field(FILE *f, const char *s)
+{
+	for(; *s; s++) fputc((*s == '\t' || *s == '\n') ? ' ' : *s, f);
+}
+
+static void free_dirs(struct dir_list *list)
+{
+	size_t i, j;
+	
+	for(i = 0; i < list->count; i++) {
+		struct app_dir *dir = &list->dirs[i];
+
+		for(j = 0; j < dir->napps; j++) free(dir->apps[j].data);
+		free(dir->apps);
+		free(dir->subdirs);
+		free(dir->pool);
+		free(dir->path);
+	}
+	free(list->dirs);
+}
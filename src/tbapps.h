@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbapps_h
+#define tbapps_h
+
+#include "tbparse.h"
+
+/*
+ * Builds the menu of applications installed in XDG applications directories
+ * ($XDG_DATA_HOME and $XDG_DATA_DIRS), with a cascade per main category, each
+ * holding command entries of applications in it. Desktop files are parsed
+ * by a pool of threads, and results are saved in a per-user index along
+ * with signatures of directories they were read from, so that subsequent
+ * calls only read the index, and directories modified since.
+ *
+ * The menu is placed in the parser, replacing its current entries. Returns
+ * zero on success, errno otherwise. Safe to call from a thread other than
+ * the main one, as long as the parser is not used elsewhere meanwhile.
+ */
+int tb_apps_load(struct tb_parser*, const struct tb_menu **menu);
+
+#endif /* tbapps_h */
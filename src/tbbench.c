@@ -0,0 +1,678 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Microbenchmarks for the parts of xmtoolbox that don't need X: rc file
+ * parsing, environment variable expansion, command tokenizing and command
+ * palette searches, run
+ * against generated rc file corpora. Results are printed one benchmark
+ * per line, as tab separated fields, for scripts to compare between runs.
+ * Alternatively, a reload soak test parses modified corpora repeatedly,
+ * and checks that memory use doesn't grow.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "tbparse.h"
+#include "tbsearch.h"
+#include "common.h"
+
+/* Default minimum run time of each benchmark, in seconds */
+#define DEF_MIN_TIME 0.5
+
+/* Environment variables referenced by the generated commands */
+#define NUM_BENCH_VARS 8
+
+/* Reloads before memory use is expected to settle; the previous menu is
+ * held while reloading, and parser bookkeeping grows to its working size */
+#define SOAK_WARMUP 10
+
+/* Number of results the command palette shows */
+#define SEARCH_RESULTS 50
+
+struct bench_ctx {
+	const char *path;
+	struct tb_parser *parser;
+	char **commands;
+	char **expanded;
+	char **results; /* scratch space for expand_env_vars results */
+	unsigned int ncommands;
+	struct tb_search *search;
+};
+
+/* What a single op of a benchmark is */
+enum bench_op {
+	OP_PASS,
+	OP_COMMAND,
+	OP_KEYSTROKE, /* a query typed a character further */
+	OP_QUERY
+};
+
+struct corpus {
+	const char *name;
+	void (*generate)(FILE*);
+};
+
+struct bench {
+	const char *name;
+	/* Runs a single pass and returns the heap growth it caused */
+	long (*run)(struct bench_ctx*);
+	enum bench_op op;
+};
+
+static void gen_deep(FILE*);
+static void gen_wide(FILE*);
+static void gen_escaped(FILE*);
+static void gen_vars(FILE*);
+static void gen_large(FILE*);
+static long bench_parse(struct bench_ctx*);
+static long bench_reparse(struct bench_ctx*);
+static long bench_expand(struct bench_ctx*);
+static long bench_tokenize(struct bench_ctx*);
+static long bench_search(struct bench_ctx*);
+static long bench_search_full(struct bench_ctx*);
+static int write_corpus(const struct corpus*, const char *dir, char **path);
+static int load_corpus(struct bench_ctx*, const char *path);
+static void free_corpus(struct bench_ctx*);
+static void run_bench(const char *corpus, const struct bench*,
+	struct bench_ctx*, double min_time);
+static int soak_reload(const char *corpus, const char *path,
+	unsigned long reloads);
+static double now_ns(void);
+static long peak_rss(void);
+static void usage(const char*);
+
+static const struct corpus corpora[] = {
+	{ "deep", gen_deep },
+	{ "wide", gen_wide },
+	{ "escaped", gen_escaped },
+	{ "vars", gen_vars },
+	{ "large", gen_large }
+};
+
+static const struct bench benchmarks[] = {
+	{ "parse", bench_parse, OP_PASS },
+	{ "reparse", bench_reparse, OP_PASS },
+	{ "expand", bench_expand, OP_COMMAND },
+	{ "tokenize", bench_tokenize, OP_COMMAND },
+	{ "search", bench_search, OP_KEYSTROKE },
+	{ "search_full", bench_search_full, OP_QUERY }
+};
+
+/*
+ * Command palette queries; typed a character at a time by bench_search,
+ * so that all but the first character of each are incremental, and run
+ * whole by bench_search_full, none extending the previous one.
+ */
+static const char *queries[] = {
+	"term", "item 42", "edt", "xterm -e", "lvl 3", "cut paste", "zzz"
+};
+
+#define NUM_QUERIES (sizeof(queries) / sizeof(queries[0]))
+
+#define NUM_CORPORA (sizeof(corpora) / sizeof(corpora[0]))
+#define NUM_BENCHMARKS (sizeof(benchmarks) / sizeof(benchmarks[0]))
+
+
+int main(int argc, char **argv)
+{
+	double min_time = DEF_MIN_TIME;
+	const char *gen_dir = NULL;
+	const char *only_corpus = NULL;
+	unsigned long reloads = 0;
+	char tmp_dir[] = "/tmp/tbbenchXXXXXX";
+	const char *dir;
+	unsigned int i, j;
+	int status = EXIT_SUCCESS;
+	int c;
+	
+	while((c = getopt(argc, argv, "t:g:c:r:h")) != -1) {
+		switch(c) {
+			case 't':
+			min_time = atof(optarg);
+			if(min_time <= 0) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+			case 'g':
+			gen_dir = optarg;
+			break;
+			case 'c':
+			only_corpus = optarg;
+			break;
+			case 'r':
+			reloads = strtoul(optarg, NULL, 10);
+			if(!reloads) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+			default:
+			usage(argv[0]);
+			return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	
+	for(i = 0; i < NUM_BENCH_VARS; i++) {
+		char name[32];
+		char value[32];
+		
+		snprintf(name, sizeof(name), "TBBENCH_VAR%u", i);
+		snprintf(value, sizeof(value), "/opt/tbbench/value%u", i);
+		setenv(name, value, 1);
+	}
+
+	if(gen_dir) {
+		dir = gen_dir;
+		if(mkdir(dir, 0755) && errno != EEXIST) {
+			perror(dir);
+			return EXIT_FAILURE;
+		}
+	} else if(!(dir = mkdtemp(tmp_dir))) {
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	if(reloads) {
+		printf("benchmark\treloads\tns_per_op\tfirst_heap_bytes\t"
+			"last_heap_bytes\tfirst_peak_rss_kb\tlast_peak_rss_kb\n");
+	} else if(!gen_dir) {
+		printf("benchmark\tops\tns_per_op\theap_bytes_per_op\tpeak_rss_kb\n");
+	}
+	
+	for(i = 0; i < NUM_CORPORA; i++) {
+		struct bench_ctx ctx;
+		char *path;
+		int errval;
+		
+		if(only_corpus && strcmp(only_corpus, corpora[i].name)) continue;
+		
+		if((errval = write_corpus(&corpora[i], dir, &path))) {
+			fprintf(stderr, "%s: %s\n", corpora[i].name, strerror(errval));
+			return EXIT_FAILURE;
+		}
+		if(gen_dir) {
+			printf("%s\n", path);
+			free(path);
+			continue;
+		}
+		if(reloads) {
+			if(soak_reload(corpora[i].name, path, reloads))
+				status = EXIT_FAILURE;
+			unlink(path);
+			free(path);
+			continue;
+		}
+		
+		if((errval = load_corpus(&ctx, path))) {
+			const char *msg = ctx.parser ? tb_parser_error(ctx.parser) : NULL;
+			
+			fprintf(stderr, "%s: %s\n", path, msg ? msg : strerror(errval));
+			return EXIT_FAILURE;
+		}
+
+		for(j = 0; j < NUM_BENCHMARKS; j++)
+			run_bench(corpora[i].name, &benchmarks[j], &ctx, min_time);
+		
+		free_corpus(&ctx);
+		unlink(path);
+		free(path);
+	}
+	
+	if(!gen_dir) rmdir(dir);
+	return status;
+}
+
+/* A few hundred levels of nested menus, repeatedly */
+static void gen_deep(FILE *f)
+{
+	int i, j;
+	
+	for(i = 0; i < 32; i++) {
+		for(j = 0; j < 128; j++) {
+			fprintf(f, "Level %d.%d {\n", i, j);
+			fprintf(f, "\tItem %d.%d: xterm -T \"Level %d\"\n", i, j, j);
+		}
+		for(j = 0; j < 128; j++) fputs("}\n", f);
+	}
+}
+
+/* A handful of menus with thousands of entries each */
+static void gen_wide(FILE *f)
+{
+	int i, j;
+	
+	for(i = 0; i < 4; i++) {
+		fprintf(f, "Wide %d\n{\n", i);
+		for(j = 0; j < 5000; j++) {
+			fprintf(f, "\t&Item %d: xterm -T item%d -e tool --index %d\n",
+				j, j, j);
+			if(!(j % 100)) fputs("\tSEPARATOR\n", f);
+		}
+		fputs("}\n", f);
+	}
+}
+
+/* Long titles full of escapes, and long quoted command lines */
+static void gen_escaped(FILE *f)
+{
+	int i, j, k;
+	
+	for(i = 0; i < 10; i++) {
+		fprintf(f, "Escaped \\& Quoted %d {\n", i);
+		for(j = 0; j < 1000; j++) {
+			fprintf(f, "\tCut \\& Paste \\: %d &", j);
+			for(k = 0; k < 8; k++) fputs("long \\\\ title \\: part ", f);
+			fputs(": sh -c \'", f);
+			for(k = 0; k < 16; k++) fprintf(f, "echo \"arg %d\" ", k);
+			fprintf(f, "\' \\\"literal\\\" %d\n", j);
+		}
+		fputs("}\n", f);
+	}
+}
+
+/* Commands referencing many environment variables */
+static void gen_vars(FILE *f)
+{
+	int i, j, k;
+	
+	for(i = 0; i < 10; i++) {
+		fprintf(f, "Vars %d {\n", i);
+		for(j = 0; j < 1000; j++) {
+			fprintf(f, "\tTool %d: $TBBENCH_VAR0/bin/tool", j);
+			for(k = 1; k < NUM_BENCH_VARS; k++) {
+				fprintf(f, (k & 1) ? " --opt%d=${TBBENCH_VAR%d}/etc" :
+					" $TBBENCH_VAR%d/lib", k, k);
+			}
+			fputs(" --cost=$$5\n", f);
+		}
+		fputs("}\n", f);
+	}
+}
+
+/* Fifty thousand commands in two levels of categories */
+static void gen_large(FILE *f)
+{
+	static const char *tools[] = {
+		"Terminal", "Editor", "Browser", "Viewer", "Player", "Monitor"
+	};
+	int i, j, k;
+	
+	for(i = 0; i < 50; i++) {
+		fprintf(f, "Category %d {\n", i);
+		for(j = 0; j < 20; j++) {
+			fprintf(f, "\tGroup %d.%d {\n", i, j);
+			for(k = 0; k < 50; k++) {
+				fprintf(f, "\t\t%s %d: /usr/bin/%s%d --profile p%d.%d\n",
+					tools[k % 6], k, tools[(k + j) % 6], k, i, j);
+			}
+			fputs("\t}\n", f);
+		}
+		fputs("}\n", f);
+	}
+}
+
+/* Full parse of an rc file, with a fresh parser each time */
+static long bench_parse(struct bench_ctx *ctx)
+{
+	struct tb_parser *parser;
+	const struct tb_menu *menu;
+	long start = heap_in_use();
+	long bytes;
+	
+	if(!(parser = tb_parser_create())) return 0;
+	tb_parser_parse(parser, ctx->path, &menu);
+	bytes = heap_in_use();
+	tb_parser_destroy(parser);
+	return bytes - start;
+}
+
+/* Repeated parse of an unchanged rc file, as done on reload */
+static long bench_reparse(struct bench_ctx *ctx)
+{
+	const struct tb_menu *menu;
+	long start = heap_in_use();
+	long bytes;
+	
+	tb_parser_parse(ctx->parser, ctx->path, &menu);
+	bytes = heap_in_use();
+	return bytes - start;
+}
+
+static long bench_expand(struct bench_ctx *ctx)
+{
+	char **results = ctx->results;
+	long start = heap_in_use();
+	long bytes;
+	unsigned int i;
+	
+	for(i = 0; i < ctx->ncommands; i++) {
+		if(expand_env_vars(ctx->commands[i], &results[i]))
+			results[i] = NULL;
+	}
+	bytes = heap_in_use();
+	for(i = 0; i < ctx->ncommands; i++) free(results[i]);
+	return bytes - start;
+}
+
+static long bench_tokenize(struct bench_ctx *ctx)
+{
+	char **strs;
+	char ***argvs;
+	long start, bytes;
+	unsigned int i;
+	
+	strs = calloc(ctx->ncommands, sizeof(char*));
+	argvs = calloc(ctx->ncommands, sizeof(char**));
+	if(!strs || !argvs) {
+		free(strs);
+		free(argvs);
+		return 0;
+	}
+	
+	start = heap_in_use();
+	for(i = 0; i < ctx->ncommands; i++) {
+		if(split_command(ctx->expanded[i], &strs[i], &argvs[i])) {
+			strs[i] = NULL;
+			argvs[i] = NULL;
+		}
+	}
+	bytes = heap_in_use();
+	
+	for(i = 0; i < ctx->ncommands; i++) {
+		free(strs[i]);
+		free(argvs[i]);
+	}
+	free(strs);
+	free(argvs);
+	return bytes - start;
+}
+
+/* Command palette search, typing each query a character at a time */
+static long bench_search(struct bench_ctx *ctx)
+{
+	unsigned int results[SEARCH_RESULTS];
+	char pattern[TB_SEARCH_MAX_PATTERN + 1];
+	long start = heap_in_use();
+	unsigned int i;
+	size_t len;
+	
+	for(i = 0; i < NUM_QUERIES; i++) {
+		for(len = 1; len <= strlen(queries[i]); len++) {
+			memcpy(pattern, queries[i], len);
+			pattern[len] = '\0';
+			tb_search_query(ctx->search, pattern,
+				results, SEARCH_RESULTS, NULL);
+		}
+	}
+	return heap_in_use() - start;
+}
+
+/* Command palette search over the whole index each time */
+static long bench_search_full(struct bench_ctx *ctx)
+{
+	unsigned int results[SEARCH_RESULTS];
+	long start = heap_in_use();
+	unsigned int i;
+	
+	for(i = 0; i < NUM_QUERIES; i++) {
+		tb_search_query(ctx->search, queries[i],
+			results, SEARCH_RESULTS, NULL);
+	}
+	return heap_in_use() - start;
+}
+
+/*
+ * Writes the corpus to a file in 'dir'. On success *path receives
+ * the malloc()ed path to the file. Returns errno otherwise.
+ */
+static int write_corpus(const struct corpus *c, const char *dir, char **path)
+{
+	size_t len = strlen(dir) + strlen(c->name) + 8;
+	struct timeval times[2];
+	FILE *f;
+	
+	if(!(*path = malloc(len))) return ENOMEM;
+	snprintf(*path, len, "%s/%s.rc", dir, c->name);
+	
+	if(!(f = fopen(*path, "w"))) {
+		int errval = errno;
+		free(*path);
+		return errval;
+	}
+	c->generate(f);
+	
+	if(fclose(f)) {
+		int errval = errno;
+		free(*path);
+		return errval;
+	}
+	
+	/* the parser doesn't trust files modified within the current second,
+	 * which would make reparse measure full parses */
+	gettimeofday(&times[0], NULL);
+	times[0].tv_sec -= 60;
+	times[1] = times[0];
+	utimes(*path, times);
+	return 0;
+}
+
+/*
+ * Parses the corpus and sets up the context with its commands,
+ * along with their expanded versions for the tokenizer to work on.
+ */
+static int load_corpus(struct bench_ctx *ctx, const char *path)
+{
+	const struct tb_menu *menu;
+	unsigned int i;
+	int errval;
+	
+	memset(ctx, 0, sizeof(struct bench_ctx));
+	ctx->path = path;
+	
+	if(!(ctx->parser = tb_parser_create())) return ENOMEM;
+	if((errval = tb_parser_parse(ctx->parser, path, &menu))) return errval;
+	
+	ctx->commands = calloc(menu->count + 1, sizeof(char*));
+	ctx->expanded = calloc(menu->count + 1, sizeof(char*));
+	ctx->results = calloc(menu->count + 1, sizeof(char*));
+	if(!ctx->commands || !ctx->expanded || !ctx->results) return ENOMEM;
+	
+	if(!(ctx->search = tb_search_create())) return ENOMEM;
+	if((errval = tb_search_index(ctx->search, menu))) return errval;
+	
+	for(i = 0; i < menu->count; i++) {
+		const struct tb_entry *e = &menu->entries[i];
+		
+		if(e->type != TBE_COMMAND) continue;
+		
+		if((errval = expand_env_vars(e->command,
+			&ctx->expanded[ctx->ncommands]))) return errval;
+		ctx->commands[ctx->ncommands++] = e->command;
+	}
+	return 0;
+}
+
+static void free_corpus(struct bench_ctx *ctx)
+{
+	unsigned int i;
+	
+	for(i = 0; i < ctx->ncommands; i++) free(ctx->expanded[i]);
+	free(ctx->expanded);
+	free(ctx->results);
+	free(ctx->commands);
+	tb_search_destroy(ctx->search);
+	tb_parser_destroy(ctx->parser);
+}
+
+/*
+ * Runs a benchmark for at least min_time seconds and prints results.
+ * Heap growth is that of the last pass, divided among its ops.
+ */
+static void run_bench(const char *corpus, const struct bench *b,
+	struct bench_ctx *ctx, double min_time)
+{
+	double start, elapsed;
+	unsigned long passes = 0;
+	unsigned long ops, pass_ops;
+	unsigned int i;
+	long bytes = 0;
+	
+	start = now_ns();
+	do {
+		bytes = b->run(ctx);
+		passes++;
+		elapsed = now_ns() - start;
+	} while(elapsed < min_time * 1e9);
+	
+	switch(b->op) {
+		case OP_COMMAND:
+		pass_ops = ctx->ncommands;
+		break;
+		case OP_KEYSTROKE:
+		for(i = 0, pass_ops = 0; i < NUM_QUERIES; i++)
+			pass_ops += strlen(queries[i]);
+		break;
+		case OP_QUERY:
+		pass_ops = NUM_QUERIES;
+		break;
+		default:
+		pass_ops = 1;
+		break;
+	}
+	ops = passes * pass_ops;
+	if(!ops) return;
+	
+	printf("%s/%s\t%lu\t%.1f\t", b->name, corpus, ops, elapsed / ops);
+	if(heap_in_use() < 0)
+		printf("-");
+	else
+		printf("%.1f", (double)bytes / pass_ops);
+	printf("\t%ld\n", peak_rss());
+	fflush(stdout);
+}
+
+/*
+ * Parses the rc file at path as many times as given with the same parser,
+ * changing its modification time before each, so that it's parsed anew
+ * like on reloads after it was edited. Heap use and peak RSS after the
+ * warm-up (or the first reload, for runs no longer than it) and after the
+ * last reload are printed. Returns non-zero if heap use grew in between,
+ * or peak RSS where heap use can't be read.
+ */
+static int soak_reload(const char *corpus, const char *path,
+	unsigned long reloads)
+{
+	struct tb_parser *parser;
+	const struct tb_menu *menu;
+	struct timeval now, times[2];
+	long first_heap = 0, first_rss = 0;
+	long last_heap, last_rss;
+	double start, elapsed;
+	unsigned long warmup = SOAK_WARMUP;
+	unsigned long i;
+	int errval;
+	
+	if(!(parser = tb_parser_create())) {
+		perror("malloc");
+		return ENOMEM;
+	}
+	gettimeofday(&now, NULL);
+	
+	/* short runs are compared with the first reload */
+	if(reloads <= warmup) warmup = 1;
+	
+	start = now_ns();
+	for(i = 0; i < reloads; i++) {
+		/* alternate between two past times, so that the signature changes */
+		times[0].tv_sec = now.tv_sec - 60 - (i & 1);
+		times[0].tv_usec = 0;
+		times[1] = times[0];
+		utimes(path, times);
+		
+		if((errval = tb_parser_parse(parser, path, &menu))) {
+			const char *msg = tb_parser_error(parser);
+			
+			fprintf(stderr, "%s: %s\n", path, msg ? msg : strerror(errval));
+			tb_parser_destroy(parser);
+			return errval;
+		}
+		if(i + 1 == warmup) {
+			first_heap = heap_in_use();
+			first_rss = peak_rss();
+		}
+	}
+	elapsed = now_ns() - start;
+	last_heap = heap_in_use();
+	last_rss = peak_rss();
+	tb_parser_destroy(parser);
+	
+	printf("reload/%s\t%lu\t%.1f\t", corpus, reloads, elapsed / reloads);
+	if(last_heap < 0)
+		printf("-\t-");
+	else
+		printf("%ld\t%ld", first_heap, last_heap);
+	printf("\t%ld\t%ld\n", first_rss, last_rss);
+	fflush(stdout);
+	
+	if(last_heap < 0) return (last_rss > first_rss);
+	return (last_heap > first_heap);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Returns peak resident set size of the process in kilobytes */
+static long peak_rss(void)
+{
+	struct rusage ru;
+	
+	if(getrusage(RUSAGE_SELF, &ru)) return -1;
+	return (long)ru.ru_maxrss;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-t seconds] [-g directory] [-c corpus] "
+		"[-r reloads]\n"
+		"  -t  minimum run time of each benchmark (default %.1f)\n"
+		"  -g  write rc file corpora into the directory and exit\n"
+		"  -c  use the named corpus only\n"
+		"  -r  instead of benchmarks, reload each corpus this many times,\n"
+		"      and fail if heap use grew\n",
+		name, DEF_MIN_TIME);
+}
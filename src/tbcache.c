@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Compiled toolbox menu cache. The image consists of a header, a flat table
+ * of entries and a string pool, and is mapped read-only, so that sessions
+ * sharing the same menu file also share the page cache pages of its image.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tbparse.h"
+#include "tbcache.h"
+
+#ifndef CACHEDIR
+#define CACHEDIR "/var/cache/xmtoolbox"
+#endif
+
+#define CACHE_MAGIC "XMTBC\0\0\0"
+#define CACHE_VERSION 6
+#define CACHE_SUFFIX ".tbc"
+#define NO_STRING ((uint32_t)-1)
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nsources;
+	uint32_t nentries;
+	uint32_t pool_size;
+	/* when sources were read; ones modified within that second or later
+	 * might have changed without changing their signature */
+	int64_t stamp;
+};
+
+/* Signature of a file the image was compiled from; the menu file itself,
+ * included files and the drop-in directory. Zero for absent files. */
+struct cache_source {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t path;
+	uint32_t reserved;
+};
+
+struct cache_entry {
+	uint32_t title;
+	uint32_t command;
+	uint32_t icon;
+	int32_t ttl;
+	uint16_t level;
+	uint8_t type;
+	uint8_t mnemonic;
+};
+
+static char* cache_path(const char *dir, const char *filename);
+static int map_image(struct tb_parser *p,
+	const char *path, const struct stat *src_st);
+static int write_image(struct tb_parser *p, const char *dir,
+	const char *filename, const struct stat *src_st,
+	const struct tb_menu *menu, time_t stamp);
+
+/* FNV-1a hash of the source file name, used to name its cache image */
+static uint64_t name_hash(const char *s)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	
+	while(*s) {
+		h ^= (unsigned char)*s++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static char* cache_path(const char *dir, const char *filename)
+{
+	size_t len = strlen(dir) + 32;
+	char *path;
+	
+	if(!(path = malloc(len))) return NULL;
+	snprintf(path, len, "%s/%016llx" CACHE_SUFFIX,
+		dir, (unsigned long long)name_hash(filename));
+	return path;
+}
+
+char* tb_user_cache_dir(void)
+{
+	char *base = getenv("XDG_CACHE_HOME");
+	char *path;
+	size_t len;
+	
+	if(base && *base) {
+		len = strlen(base) + 16;
+		if(!(path = malloc(len))) return NULL;
+		snprintf(path, len, "%s/xmtoolbox", base);
+	} else {
+		if(!(base = getenv("HOME"))) return NULL;
+		len = strlen(base) + 24;
+		if(!(path = malloc(len))) return NULL;
+		snprintf(path, len, "%s/.cache/xmtoolbox", base);
+	}
+	return path;
+}
+
+/*
+ * Maps the image at 'path' if it is trustworthy and up to date with regard
+ * to all of its source files, and hands it over to the parser. Returns zero on
+ * success, errno otherwise.
+ */
+static int map_image(struct tb_parser *p,
+	const char *path, const struct stat *src_st)
+{
+	int fd;
+	struct stat st;
+	void *addr;
+	const struct cache_header *hdr;
+	const struct cache_source *cs;
+	const struct cache_entry *ce;
+	const char *pool;
+	struct tb_entry *entries;
+	struct stat src;
+	size_t i;
+	
+	if((fd = open(path, O_RDONLY)) == -1) return errno;
+	
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return errno;
+	}
+
+	/* The image decides which commands are run, so only accept ones
+	 * written by us, or by the owner of the source file */
+	if((st.st_uid != getuid() && st.st_uid != src_st->st_uid) ||
+		(st.st_mode & (S_IWGRP | S_IWOTH)) || !S_ISREG(st.st_mode) ||
+		st.st_size < sizeof(struct cache_header)) {
+		close(fd);
+		return EINVAL;
+	}
+
+	addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED) return errno;
+	
+	hdr = addr;
+	if(memcmp(hdr->magic, CACHE_MAGIC, sizeof(hdr->magic)) ||
+		hdr->version != CACHE_VERSION ||
+		!hdr->nsources || !hdr->nentries || !hdr->pool_size ||
+		st.st_size != sizeof(struct cache_header) +
+			(size_t)hdr->nsources * sizeof(struct cache_source) +
+			(size_t)hdr->nentries * sizeof(struct cache_entry) +
+			hdr->pool_size) {
+		munmap(addr, st.st_size);
+		return EINVAL;
+	}
+
+	cs = (const struct cache_source*)(hdr + 1);
+	ce = (const struct cache_entry*)(cs + hdr->nsources);
+	pool = (const char*)(ce + hdr->nentries);
+	
+	if(pool[hdr->pool_size - 1] != '\0') {
+		munmap(addr, st.st_size);
+		return EINVAL;
+	}
+
+	/* Stale if any of the source files changed, appeared or vanished */
+	for(i = 0; i < hdr->nsources; i++) {
+		if(cs[i].path >= hdr->pool_size) {
+			munmap(addr, st.st_size);
+			return EINVAL;
+		}
+		if(stat(pool + cs[i].path, &src) == -1)
+			memset(&src, 0, sizeof(struct stat));
+
+		if(cs[i].dev != (uint64_t)src.st_dev ||
+			cs[i].ino != (uint64_t)src.st_ino ||
+			cs[i].size != (uint64_t)src.st_size ||
+			cs[i].mtime != (int64_t)src.st_mtime ||
+			cs[i].mtime >= hdr->stamp) {
+			munmap(addr, st.st_size);
+			return ESTALE;
+		}
+	}
+
+	if(!(entries = calloc(hdr->nentries, sizeof(struct tb_entry)))) {
+		munmap(addr, st.st_size);
+		return ENOMEM;
+	}
+
+	for(i = 0; i < hdr->nentries; i++) {
+		if((ce[i].title != NO_STRING && ce[i].title >= hdr->pool_size) ||
+			(ce[i].command != NO_STRING && ce[i].command >= hdr->pool_size) ||
+			(ce[i].icon != NO_STRING && ce[i].icon >= hdr->pool_size) ||
+			ce[i].type >= TBE_INCLUDE) {
+			free(entries);
+			munmap(addr, st.st_size);
+			return EINVAL;
+		}
+		entries[i].type = ce[i].type;
+		entries[i].level = ce[i].level;
+		entries[i].mnemonic = (char)ce[i].mnemonic;
+		entries[i].ttl = ce[i].ttl;
+		entries[i].title = (ce[i].title == NO_STRING) ?
+			NULL : (char*)pool + ce[i].title;
+		entries[i].command = (ce[i].command == NO_STRING) ?
+			NULL : (char*)pool + ce[i].command;
+		entries[i].icon = (ce[i].icon == NO_STRING) ?
+			NULL : (char*)pool + ce[i].icon;
+	}
+	
+	if(tb_parser_adopt_image(p, addr, st.st_size, entries, hdr->nentries)) {
+		free(entries);
+		munmap(addr, st.st_size);
+		return EINVAL;
+	}
+	
+	for(i = 0; i < hdr->nsources; i++) {
+		if(stat(pool + cs[i].path, &src) == -1)
+			tb_parser_add_source(p, pool + cs[i].path, NULL);
+		else
+			tb_parser_add_source(p, pool + cs[i].path, &src);
+	}
+	return 0;
+}
+
+/* Adds a string to the pool being built, returns its offset */
+static uint32_t pool_add(char *pool, uint32_t *pool_size, const char *s)
+{
+	uint32_t off = *pool_size;
+	size_t len;
+
+	if(!s) return NO_STRING;
+
+	len = strlen(s) + 1;
+	memcpy(pool + off, s, len);
+	*pool_size += len;
+	return off;
+}
+
+/*
+ * Compiles parsed entries into a cache image in 'dir'. The image is written
+ * to a temporary file first and renamed, so that concurrently starting
+ * sessions never see a partially written one. 'stamp' is the time parsing
+ * started at; no image is written if any source was modified since then,
+ * since it wouldn't be trusted anyway.
+ */
+static int write_image(struct tb_parser *p, const char *dir,
+	const char *filename, const struct stat *src_st,
+	const struct tb_menu *menu, time_t stamp)
+{
+	const struct tb_entry *cur;
+	const struct tb_source *sources;
+	struct cache_header hdr;
+	struct cache_source *cs;
+	struct cache_entry *ce;
+	char *pool;
+	char *path, *tmp_path;
+	size_t nsources;
+	size_t nentries = menu->count;
+	size_t pool_size = 0;
+	uint32_t pool_used = 0;
+	size_t i, len;
+	int fd, err = 0;
+
+	sources = tb_parser_sources(p, &nsources);
+	for(i = 0; i < nsources; i++) {
+		if(sources[i].mtime >= stamp) return ESTALE;
+		pool_size += strlen(sources[i].path) + 1;
+	}
+
+	for(i = 0; i < nentries; i++) {
+		cur = &menu->entries[i];
+		if(cur->title) pool_size += strlen(cur->title) + 1;
+		if(cur->command) pool_size += strlen(cur->command) + 1;
+		if(cur->icon) pool_size += strlen(cur->icon) + 1;
+	}
+	if(!nentries || !nsources || pool_size >= NO_STRING) return EINVAL;
+	
+	cs = calloc(nsources, sizeof(struct cache_source));
+	ce = calloc(nentries, sizeof(struct cache_entry));
+	pool = calloc(pool_size, 1);
+	if(!cs || !ce || !pool) {
+		free(cs);
+		free(ce);
+		free(pool);
+		return ENOMEM;
+	}
+	
+	for(i = 0; i < nsources; i++) {
+		cs[i].dev = sources[i].dev;
+		cs[i].ino = sources[i].ino;
+		cs[i].size = sources[i].size;
+		cs[i].mtime = sources[i].mtime;
+		cs[i].path = pool_add(pool, &pool_used, sources[i].path);
+	}
+	
+	for(i = 0; i < nentries; i++) {
+		cur = &menu->entries[i];
+		ce[i].type = cur->type;
+		ce[i].level = cur->level;
+		ce[i].mnemonic = (uint8_t)cur->mnemonic;
+		ce[i].ttl = cur->ttl;
+		ce[i].title = pool_add(pool, &pool_used, cur->title);
+		ce[i].command = pool_add(pool, &pool_used, cur->command);
+		ce[i].icon = pool_add(pool, &pool_used, cur->icon);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = CACHE_VERSION;
+	hdr.nsources = nsources;
+	hdr.nentries = nentries;
+	hdr.pool_size = pool_size;
+	hdr.stamp = stamp;
+	
+	path = cache_path(dir, filename);
+	len = strlen(dir) + 24;
+	tmp_path = malloc(len);
+
+	if(!path || !tmp_path) {
+		err = ENOMEM;
+	} else {
+		snprintf(tmp_path, len, "%s/.tbcXXXXXX", dir);
+		if((fd = mkstemp(tmp_path)) == -1) {
+			err = errno;
+		} else {
+			errno = 0;
+			if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+				write(fd, cs, nsources * sizeof(struct cache_source)) !=
+					nsources * sizeof(struct cache_source) ||
+				write(fd, ce, nentries * sizeof(struct cache_entry)) !=
+					nentries * sizeof(struct cache_entry) ||
+				write(fd, pool, pool_size) != pool_size) {
+				err = errno ? errno : EIO;
+			}
+			fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+			if(close(fd) == -1 && !err) err = errno;
+			
+			if(!err && rename(tmp_path, path) == -1) err = errno;
+			if(err) unlink(tmp_path);
+		}
+	}
+
+	if(!err) err = map_image(p, path, src_st);
+	
+	free(path);
+	free(tmp_path);
+	free(cs);
+	free(ce);
+	free(pool);
+	return err;
+}
+
+/* Maps the system or the per-user image for filename, if either is valid */
+static int map_cached(struct tb_parser *p, const char *filename,
+	const char *user_dir, const struct stat *src_st)
+{
+	char *path;
+	int err = ENOENT;
+
+	if((path = cache_path(CACHEDIR, filename))) {
+		err = map_image(p, path, src_st);
+		free(path);
+		if(!err) return 0;
+	}
+	
+	if(user_dir && (path = cache_path(user_dir, filename))) {
+		err = map_image(p, path, src_st);
+		free(path);
+	}
+	return err;
+}
+
+void tb_make_cache_dir(char *user_dir)
+{
+	char *p = user_dir;
+
+	while((p = strchr(p + 1, '/'))) {
+		*p = '\0';
+		mkdir(user_dir, S_IRWXU);
+		*p = '/';
+	}
+	mkdir(user_dir, S_IRWXU);
+}
+
+int tb_load_config(struct tb_parser *p,
+	const char *filename, const struct tb_menu **menu)
+{
+	struct stat st;
+	char *user_dir;
+	time_t stamp;
+	int err;
+	
+	if(stat(filename, &st) == -1) return errno;
+
+	user_dir = tb_user_cache_dir();
+
+	if(map_cached(p, filename, user_dir, &st)) {
+		/* stale or missing; parse the source and compile a new image */
+		stamp = time(NULL);
+		if((err = tb_parser_parse(p, filename, menu))) {
+			free(user_dir);
+			return err;
+		}
+
+		if(write_image(p, CACHEDIR, filename, &st, *menu, stamp)) {
+			if(user_dir) tb_make_cache_dir(user_dir);
+
+			/* if not cached, parsed entries are valid regardless */
+			if(user_dir)
+				write_image(p, user_dir, filename, &st, *menu, stamp);
+		}
+	}
+	
+	free(user_dir);
+	*menu = tb_parser_menu(p);
+	return 0;
+}
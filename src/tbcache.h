@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbcache_h
+#define tbcache_h
+
+#include "tbparse.h"
+
+/*
+ * Loads the toolbox menu file from its compiled cache image, if an up to
+ * date one exists, or parses it with tb_parser_parse and writes a new image
+ * otherwise. Return value and menu semantics are those of tb_parser_parse.
+ *
+ * Cache images are looked up in the system cache directory first, and then
+ * in the per-user one ($XDG_CACHE_HOME/xmtoolbox). New images are written
+ * to the first of these that is writable.
+ */
+int tb_load_config(struct tb_parser*,
+	const char *filename, const struct tb_menu **menu);
+
+/* Returns a malloc()ed per-user cache directory path, or NULL */
+char* tb_user_cache_dir(void);
+
+/* Creates the per-user cache directory and its parents as needed */
+void tb_make_cache_dir(char *user_dir);
+
+#endif /* tbcache_h */
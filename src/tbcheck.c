@@ -0,0 +1,263 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Headless rc file validation and profiling (-check)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "tbparse.h"
+#include "common.h"
+#include "tbpath.h"
+#include "tbcheck.h"
+
+enum check_phase {
+	PH_PARSE,
+	PH_EXPAND,
+	PH_TOKENIZE,
+	PH_RESOLVE,
+	NUM_PHASES
+};
+
+struct phase_stats {
+	const char *name;
+	unsigned int items;
+	unsigned int errors;
+	struct timespec start;
+	double msecs;
+	long heap_start;
+	long heap;
+};
+
+/* Per-entry state carried from one phase to the next */
+struct check_item {
+	char *command;
+	char *str;
+	char **argv;
+};
+
+static void begin_phase(struct phase_stats*);
+static void end_phase(struct phase_stats*);
+static void report_entry(const struct tb_menu*, unsigned int,
+	const char*, const char*, int);
+static void print_entry_path(const struct tb_menu*, int);
+static void print_stats(const struct phase_stats*);
+
+
+int tb_check_config(const char *rc_file)
+{
+	struct phase_stats stats[NUM_PHASES] = {
+		{ "parse" }, { "expand" }, { "tokenize" }, { "resolve" }
+	};
+	struct tb_parser *parser;
+	const struct tb_menu *menu;
+	struct check_item *items;
+	unsigned int i, nerrors = 0;
+	int errval;
+	
+	if(!(parser = tb_parser_create())) {
+		perror("malloc");
+		return ENOMEM;
+	}
+
+	/* the cache is bypassed, since parsing is what is being measured */
+	begin_phase(&stats[PH_PARSE]);
+	errval = tb_parser_parse(parser, rc_file, &menu);
+	end_phase(&stats[PH_PARSE]);
+	
+	if(errval) {
+		const char *msg = tb_parser_error(parser);
+		
+		fprintf(stderr, "%s: %s\n", rc_file, msg ? msg : strerror(errval));
+		tb_parser_destroy(parser);
+		return errval;
+	}
+	stats[PH_PARSE].items = menu->count;
+
+	items = calloc(menu->count + 1, sizeof(struct check_item));
+	if(!items) {
+		perror("malloc");
+		tb_parser_destroy(parser);
+		return ENOMEM;
+	}
+
+	begin_phase(&stats[PH_EXPAND]);
+	for(i = 0; i < menu->count; i++) {
+		const struct tb_entry *e = &menu->entries[i];
+
+		if(e->type != TBE_COMMAND && e->type != TBE_PIPE &&
+			e->type != TBE_DIRECTORY) continue;
+
+		stats[PH_EXPAND].items++;
+		if((errval = expand_env_vars(e->command, &items[i].command))) {
+			report_entry(menu, i, "Failed to parse command string",
+				e->command, errval);
+			stats[PH_EXPAND].errors++;
+		}
+	}
+	end_phase(&stats[PH_EXPAND]);
+
+	begin_phase(&stats[PH_TOKENIZE]);
+	for(i = 0; i < menu->count; i++) {
+		if(!items[i].command || menu->entries[i].type == TBE_DIRECTORY)
+			continue;
+
+		stats[PH_TOKENIZE].items++;
+		if((errval = split_command(items[i].command,
+			&items[i].str, &items[i].argv))) {
+			report_entry(menu, i, "Failed to parse command string",
+				items[i].command, errval);
+			stats[PH_TOKENIZE].errors++;
+		}
+	}
+	end_phase(&stats[PH_TOKENIZE]);
+
+	begin_phase(&stats[PH_RESOLVE]);
+	for(i = 0; i < menu->count; i++) {
+		const char *path;
+		struct stat st;
+
+		if(items[i].argv) {
+			stats[PH_RESOLVE].items++;
+			if((errval = tb_path_resolve(items[i].argv[0], &path))) {
+				report_entry(menu, i, "Command not found",
+					items[i].argv[0], errval);
+				stats[PH_RESOLVE].errors++;
+			}
+		} else if(items[i].command &&
+			menu->entries[i].type == TBE_DIRECTORY) {
+			stats[PH_RESOLVE].items++;
+			if(stat(items[i].command, &st)) {
+				errval = errno;
+			} else {
+				errval = S_ISDIR(st.st_mode) ? 0 : ENOTDIR;
+			}
+			if(errval) {
+				report_entry(menu, i, "Cannot list directory",
+					items[i].command, errval);
+				stats[PH_RESOLVE].errors++;
+			}
+		}
+		
+		if(menu->entries[i].icon) {
+			char *icon;
+			
+			stats[PH_RESOLVE].items++;
+			if(!(errval = expand_env_vars(menu->entries[i].icon, &icon))) {
+				if(access(icon, R_OK)) errval = errno;
+				free(icon);
+			}
+			if(errval) {
+				report_entry(menu, i, "Cannot read icon",
+					menu->entries[i].icon, errval);
+				stats[PH_RESOLVE].errors++;
+			}
+		}
+	}
+	end_phase(&stats[PH_RESOLVE]);
+
+	for(i = 0; i < menu->count; i++) {
+		free(items[i].command);
+		free(items[i].str);
+		free(items[i].argv);
+	}
+	free(items);
+	tb_parser_destroy(parser);
+
+	printf("%s: %u entries\n", rc_file, stats[PH_PARSE].items);
+	print_stats(stats);
+	
+	for(i = 0; i < NUM_PHASES; i++) nerrors += stats[i].errors;
+	return nerrors ? EINVAL : 0;
+}
+
+static void begin_phase(struct phase_stats *ps)
+{
+	ps->heap_start = heap_in_use();
+	clock_gettime(CLOCK_MONOTONIC, &ps->start);
+}
+
+static void end_phase(struct phase_stats *ps)
+{
+	struct timespec now;
+	long heap;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ps->msecs = (now.tv_sec - ps->start.tv_sec) * 1000.0 +
+		(now.tv_nsec - ps->start.tv_nsec) / 1000000.0;
+
+	heap = heap_in_use();
+	ps->heap = (heap < 0 || ps->heap_start < 0) ? -1 : heap - ps->heap_start;
+}
+
+/*
+ * Reports a problem with an entry, identified by its titles path within
+ * the menu tree, e.g. "Applications/Editors/Vim".
+ */
+static void report_entry(const struct tb_menu *menu, unsigned int index,
+	const char *msg, const char *arg, int errval)
+{
+	print_entry_path(menu, index);
+	fprintf(stderr, ": %s \"%s\": %s\n", msg, arg, strerror(errval));
+}
+
+static void print_entry_path(const struct tb_menu *menu, int index)
+{
+	const struct tb_entry *e = &menu->entries[index];
+
+	if(e->parent != -1) {
+		print_entry_path(menu, e->parent);
+		fputc('/', stderr);
+	}
+	fputs(e->title, stderr);
+}
+
+static void print_stats(const struct phase_stats *stats)
+{
+	struct rusage ru;
+	unsigned int i;
+	
+	printf("%-10s %8s %8s %12s %12s\n",
+		"phase", "items", "errors", "time(ms)", "heap(bytes)");
+
+	for(i = 0; i < NUM_PHASES; i++) {
+		printf("%-10s %8u %8u %12.3f ", stats[i].name,
+			stats[i].items, stats[i].errors, stats[i].msecs);
+		if(stats[i].heap < 0)
+			printf("%12s\n", "-");
+		else
+			printf("%12ld\n", stats[i].heap);
+	}
+	
+	if(!getrusage(RUSAGE_SELF, &ru))
+		printf("peak RSS: %ld KB\n", (long)ru.ru_maxrss);
+}
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Build time rc file compiler. Parses a toolbox menu file with the same
+ * parser xmtoolbox uses, and writes its entries out as static C tables
+ * defining tb_default_menu, so that the default menu needs neither
+ * reading nor parsing at runtime.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "tbparse.h"
+
+static const char* type_name(enum tb_entry_type);
+static void put_string(FILE*, const char*);
+static void put_char(FILE*, char);
+
+int main(int argc, char **argv)
+{
+	struct tb_parser *parser;
+	const struct tb_menu *menu;
+	unsigned int i;
+	int errval;
+	
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s rcfile > file.c\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	
+	if(!(parser = tb_parser_create())) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	
+	if((errval = tb_parser_parse(parser, argv[1], &menu))) {
+		fprintf(stderr, "%s: %s\n", argv[1], tb_parser_error(parser) ?
+			tb_parser_error(parser) : strerror(errval));
+		return EXIT_FAILURE;
+	}
+	
+	for(i = 0; i < menu->count; i++) {
+		if(!type_name(menu->entries[i].type)) {
+			fprintf(stderr, "%s: entry type %d not supported\n",
+				argv[1], (int)menu->entries[i].type);
+			return EXIT_FAILURE;
+		}
+	}
+	
+	printf("/* Generated by tbcompile from %s. Do not edit. */\n\n", argv[1]);
+	printf("#include <stddef.h>\n#include \"tbparse.h\"\n"
+		"#include \"tbdefault.h\"\n\n");
+	
+	printf("static struct tb_entry entries[] = {\n");
+	for(i = 0; i < menu->count; i++) {
+		const struct tb_entry *e = &menu->entries[i];
+		
+		printf("\t{ .type = %s, .level = %d, .title = ",
+			type_name(e->type), e->level);
+		put_string(stdout, e->title);
+		printf(", .mnemonic = ");
+		put_char(stdout, e->mnemonic);
+		printf(",\n\t\t.command = ");
+		put_string(stdout, e->command);
+		printf(", .icon = ");
+		put_string(stdout, e->icon);
+		printf(",\n\t\t.ttl = %d, .parent = %d, .sibling = %d,"
+			" .nchildren = %u },\n",
+			e->ttl, e->parent, e->sibling, e->nchildren);
+	}
+	/* an empty initializer list isn't valid C */
+	if(!menu->count) printf("\t{ .type = TBE_SEPARATOR }\n");
+	printf("};\n\n");
+	
+	printf("const struct tb_menu tb_default_menu = { entries, %u, %d };\n",
+		menu->count, menu->max_level);
+	
+	tb_parser_destroy(parser);
+	
+	if(fflush(stdout) || ferror(stdout)) {
+		perror("stdout");
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Returns the enumerator name, or NULL if unknown to the compiler */
+static const char* type_name(enum tb_entry_type type)
+{
+	switch(type) {
+		case TBE_CASCADE: return "TBE_CASCADE";
+		case TBE_COMMAND: return "TBE_COMMAND";
+		case TBE_SEPARATOR: return "TBE_SEPARATOR";
+		case TBE_PIPE: return "TBE_PIPE";
+		case TBE_DIRECTORY: return "TBE_DIRECTORY";
+		case TBE_APPLICATIONS: return "TBE_APPLICATIONS";
+		default: return NULL;
+	}
+}
+
+/* Writes a C string literal, or NULL */
+static void put_string(FILE *f, const char *s)
+{
+	if(!s) {
+		fputs("NULL", f);
+		return;
+	}
+	fputc('\"', f);
+	for(; *s; s++) {
+		unsigned char c = (unsigned char)*s;
+		
+		if(c == '\"' || c == '\\') {
+			fprintf(f, "\\%c", c);
+		} else if(c < 0x20 || c > 0x7e) {
+			/* octal escapes are always three digits, so that
+			 * a following digit isn't taken as part of one */
+			fprintf(f, "\\%03o", c);
+		} else {
+			fputc(c, f);
+		}
+	}
+	fputc('\"', f);
+}
+
+static void put_char(FILE *f, char c)
+{
+	if(c >= '0' && c <= 'z' && c != '\\')
+		fprintf(f, "\'%c\'", c);
+	else
+		fprintf(f, "%d", (int)c);
+}
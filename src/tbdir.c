@@ -0,0 +1,282 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Cached directory listings for @dir menus. Entry types are taken from
+ * d_type, so listing a directory doesn't stat() every file in it.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "tbdir.h"
+
+/* Number of hash table buckets, and snapshots kept when unused */
+#define DIR_CACHE_BUCKETS 64
+#define DIR_CACHE_MAX 128
+
+#define NAME_POOL_GROW 4096
+#define ENTRIES_GROW 256
+
+static struct tb_dir *dir_cache[DIR_CACHE_BUCKETS];
+static unsigned int dir_cache_count = 0;
+
+static unsigned int path_hash(const char*);
+static int read_dir(const char*, const struct stat*, struct tb_dir**);
+static int compare_dirents(const void*, const void*);
+static void cache_remove(struct tb_dir*);
+static void trim_cache(void);
+static void free_dir(struct tb_dir*);
+
+int tb_dir_open(const char *path, struct tb_dir **ret)
+{
+	struct stat st;
+	struct tb_dir *dir;
+	unsigned int bucket;
+	int err;
+	
+	if(stat(path, &st) == -1) return errno;
+	if(!S_ISDIR(st.st_mode)) return ENOTDIR;
+	
+	bucket = path_hash(path) % DIR_CACHE_BUCKETS;
+	for(dir = dir_cache[bucket]; dir; dir = dir->next) {
+		if(!strcmp(dir->path, path)) break;
+	}
+	
+	/* A snapshot taken within the same second the directory was last
+	 * modified in may have missed subsequent changes; never reuse those */
+	if(dir && dir->dev == st.st_dev && dir->ino == st.st_ino &&
+		dir->mtime == st.st_mtime && dir->mtime < dir->stamp) {
+		dir->refs++;
+		*ret = dir;
+		return 0;
+	}
+	
+	if((err = read_dir(path, &st, ret))) return err;
+	
+	if(dir) cache_remove(dir);
+	
+	(*ret)->next = dir_cache[bucket];
+	dir_cache[bucket] = (*ret);
+	dir_cache_count++;
+	(*ret)->refs = 2; /* the cache and the caller */
+	
+	if(dir_cache_count > DIR_CACHE_MAX) trim_cache();
+
+	return 0;
+}
+
+void tb_dir_release(struct tb_dir *dir)
+{
+	dir->refs--;
+	if(!dir->refs) free_dir(dir);
+}
+
+/*
+ * Reads the directory into a new, unreferenced snapshot
+ */
+static int read_dir(const char *path, const struct stat *st,
+	struct tb_dir **ret)
+{
+	DIR *dh;
+	struct dirent *de;
+	struct tb_dir *dir;
+	char *pool = NULL;
+	size_t pool_len = 0;
+	size_t pool_size = 0;
+	size_t *offsets = NULL;
+	size_t ents_size = 0;
+	size_t path_len = strlen(path);
+	size_t i;
+	int err = 0;
+	
+	dir = calloc(1, sizeof(struct tb_dir));
+	if(!dir) return ENOMEM;
+	
+	dir->dev = st->st_dev;
+	dir->ino = st->st_ino;
+	dir->mtime = st->st_mtime;
+	dir->stamp = time(NULL);
+	
+	if(!(dir->path = strdup(path))) {
+		free(dir);
+		return ENOMEM;
+	}
+
+	if(!(dh = opendir(path))) {
+		err = errno;
+		free_dir(dir);
+		return err;
+	}
+	
+	while((de = readdir(dh))) {
+		size_t len;
+		int is_dir = 0;
+		
+		if(de->d_name[0] == '.') continue;
+
+		len = strlen(de->d_name) + 1;
+		
+		if(pool_len + len > pool_size) {
+			char *new_ptr;
+			size_t new_size = pool_size + NAME_POOL_GROW;
+			
+			while(pool_len + len > new_size) new_size += NAME_POOL_GROW;
+			
+			new_ptr = realloc(pool, new_size);
+			if(!new_ptr) {
+				err = ENOMEM;
+				break;
+			}
+			pool = new_ptr;
+			pool_size = new_size;
+		}
+		
+		if(dir->count == ents_size) {
+			void *new_ents, *new_offsets;
+			
+			new_ents = realloc(dir->ents,
+				(ents_size + ENTRIES_GROW) * sizeof(struct tb_dirent));
+			if(new_ents) dir->ents = new_ents;
+			new_offsets = realloc(offsets,
+				(ents_size + ENTRIES_GROW) * sizeof(size_t));
+			if(new_offsets) offsets = new_offsets;
+			
+			if(!new_ents || !new_offsets) {
+				err = ENOMEM;
+				break;
+			}
+			ents_size += ENTRIES_GROW;
+		}
+		
+		#ifdef DT_DIR
+		if(de->d_type == DT_DIR) {
+			is_dir = 1;
+		} else if(de->d_type == DT_LNK || de->d_type == DT_UNKNOWN)
+		#endif
+		{
+			/* symbolic links, and file systems that don't report
+			 * types need to be resolved with stat() */
+			char *fpath = malloc(path_len + len + 1);
+			struct stat fst;
+			
+			if(!fpath) {
+				err = ENOMEM;
+				break;
+			}
+			sprintf(fpath, "%s/%s", path, de->d_name);
+			if(!stat(fpath, &fst) && S_ISDIR(fst.st_mode)) is_dir = 1;
+			free(fpath);
+		}
+		
+		memcpy(pool + pool_len, de->d_name, len);
+		offsets[dir->count] = pool_len;
+		dir->ents[dir->count].is_dir = is_dir;
+		pool_len += len;
+		dir->count++;
+	}
+	closedir(dh);
+	
+	if(err) {
+		free(offsets);
+		free(pool);
+		free_dir(dir);
+		return err;
+	}
+	
+	/* the pool is final; convert name offsets to pointers */
+	for(i = 0; i < dir->count; i++)
+		dir->ents[i].name = pool + offsets[i];
+	free(offsets);
+	dir->pool = pool;
+	
+	qsort(dir->ents, dir->count, sizeof(struct tb_dirent), compare_dirents);
+	
+	*ret = dir;
+	return 0;
+}
+
+static int compare_dirents(const void *pa, const void *pb)
+{
+	const struct tb_dirent *a = (const struct tb_dirent*)pa;
+	const struct tb_dirent *b = (const struct tb_dirent*)pb;
+	
+	if(a->is_dir != b->is_dir) return b->is_dir - a->is_dir;
+	return strcoll(a->name, b->name);
+}
+
+static unsigned int path_hash(const char *path)
+{
+	unsigned int hash = 2166136261U;
+	
+	while(*path) {
+		hash ^= (unsigned char)*path++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Unlinks the snapshot from the cache, and drops the cache's reference
+ */
+static void cache_remove(struct tb_dir *dir)
+{
+	struct tb_dir **pp;
+	
+	pp = &dir_cache[path_hash(dir->path) % DIR_CACHE_BUCKETS];
+	while(*pp != dir) pp = &(*pp)->next;
+	*pp = dir->next;
+	dir->next = NULL;
+	dir_cache_count--;
+	tb_dir_release(dir);
+}
+
+/*
+ * Drops snapshots that aren't referenced by anyone but the cache
+ */
+static void trim_cache(void)
+{
+	unsigned int i;
+	
+	for(i = 0; i < DIR_CACHE_BUCKETS; i++) {
+		struct tb_dir *dir = dir_cache[i];
+		
+		while(dir) {
+			struct tb_dir *next = dir->next;
+			if(dir->refs == 1) cache_remove(dir);
+			dir = next;
+		}
+	}
+}
+
+static void free_dir(struct tb_dir *dir)
+{
+	free(dir->pool);
+	free(dir->ents);
+	free(dir->path);
+	free(dir);
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef tbdir_h
+#define tbdir_h
+
+#include <sys/types.h>
+
+/* Directory listing entry */
+struct tb_dirent {
+	const char *name;
+	int is_dir;
+};
+
+/*
+ * Snapshot of a directory listing. Hidden entries are omitted, directories
+ * are sorted before files, and each group is sorted by name.
+ */
+struct tb_dir {
+	char *path;
+	size_t count;
+	struct tb_dirent *ents;
+	
+	/* private to tbdir.c */
+	char *pool;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	time_t stamp;
+	unsigned int refs;
+	struct tb_dir *next;
+};
+
+/*
+ * Retrieves a snapshot of the directory at 'path'. Snapshots are cached, and
+ * reused for as long as the directory's modification time stays the same,
+ * so that an unchanged directory costs a single stat() call. The snapshot
+ * is referenced, and must be released with tb_dir_release when no longer
+ * needed. The same snapshot is returned for an unchanged directory, hence
+ * callers may compare snapshot pointers to detect changes.
+ * Returns zero on success, errno otherwise.
+ */
+int tb_dir_open(const char *path, struct tb_dir **ret);
+
+/* Releases a snapshot reference obtained with tb_dir_open */
+void tb_dir_release(struct tb_dir*);
+
+#endif /* tbdir_h */
@@ -0,0 +1,824 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Menu icon loader. Image files are read and decoded on worker threads into
+ * premultiplied ARGB pixels, scaled to the height requested. Scaled images
+ * are saved in a cache directory under a hash of the source file contents,
+ * so that subsequent runs only need to read and hash the file.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <png.h>
+#include "tbicon.h"
+
+/* Largest image file read, and largest image decoded (in either dimension) */
+#define MAX_ICON_FILE (4 * 1024 * 1024)
+#define MAX_ICON_DIM 2048
+
+/* Scaled images are at most this many times as wide as they are high */
+#define MAX_ASPECT 4
+
+#define MAX_WORKERS 8
+
+#define ICON_CACHE_MAGIC "XMTBI\0\0\0"
+#define ICON_CACHE_VERSION 1
+#define ICON_CACHE_SUFFIX ".tbi"
+
+struct icon_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t reserved;
+};
+
+/* An icon in one of the loader's queues */
+struct icon_job {
+	struct tb_icon icon;
+	struct icon_job *next;
+};
+
+struct icon_queue {
+	struct icon_job *head;
+	struct icon_job *tail;
+};
+
+struct tb_icon_loader {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t threads[MAX_WORKERS];
+	unsigned int nthreads;
+	int quit;
+	struct icon_queue pending;
+	struct icon_queue done;
+	/* written to by workers as icons are done */
+	int notify_fd[2];
+	char *cache_dir;
+	struct tb_icon_stats stats;
+};
+
+/* An XPM color table entry; code holds up to four pixel characters */
+struct xpm_color {
+	uint32_t code;
+	uint32_t pixel;
+};
+
+static void* worker_proc(void*);
+static void load_icon(struct tb_icon_loader*, struct tb_icon*);
+static int read_file(const char *path, unsigned char **buf, size_t *len);
+static uint64_t icon_key(const unsigned char *buf, size_t len,
+	unsigned int size);
+static char* cached_icon_path(const char *dir, uint64_t key);
+static int read_cached_icon(const char *dir, struct tb_icon*);
+static void write_cached_icon(const char *dir, const struct tb_icon*);
+static int decode_png(const unsigned char *buf, size_t len,
+	uint32_t **pixels, unsigned int *width, unsigned int *height);
+static int decode_xpm(const unsigned char *buf, size_t len,
+	uint32_t **pixels, unsigned int *width, unsigned int *height);
+static int read_xpm(const char **lines, size_t nlines,
+	uint32_t **pixels, unsigned int *width, unsigned int *height);
+static int parse_xpm_color(const char *spec, size_t len, uint32_t *pixel);
+static uint32_t xpm_code(const char *chars, unsigned int cpp);
+static int compare_xpm_colors(const void*, const void*);
+static int scale_image(const uint32_t *src, unsigned int sw,
+	unsigned int sh, unsigned int size, struct tb_icon *icon);
+static void push_job(struct icon_queue*, struct icon_job*);
+static struct icon_job* pop_job(struct icon_queue*);
+static void free_queue(struct icon_queue*);
+
+/* Colors XPM files commonly refer to by name; the rest are taken as gray */
+static const struct {
+	const char *name;
+	uint32_t rgb;
+} xpm_color_names[] = {
+	{ "black", 0x000000 }, { "white", 0xffffff },
+	{ "red", 0xff0000 }, { "green", 0x00ff00 }, { "blue", 0x0000ff },
+	{ "yellow", 0xffff00 }, { "cyan", 0x00ffff }, { "magenta", 0xff00ff },
+	{ "gray", 0xbebebe }, { "grey", 0xbebebe },
+	{ "darkgray", 0xa9a9a9 }, { "darkgrey", 0xa9a9a9 },
+	{ "lightgray", 0xd3d3d3 }, { "lightgrey", 0xd3d3d3 },
+	{ "dimgray", 0x696969 }, { "dimgrey", 0x696969 },
+	{ "orange", 0xffa500 }, { "brown", 0xa52a2a }, { "navy", 0x000080 },
+	{ "darkgreen", 0x006400 }, { "darkred", 0x8b0000 },
+	{ "darkblue", 0x00008b }, { "gold", 0xffd700 }, { "pink", 0xffc0cb },
+	{ "purple", 0xa020f0 }, { "violet", 0xee82ee }
+};
+
+struct tb_icon_loader* tb_icon_loader_create(unsigned int nthreads,
+	const char *cache_dir)
+{
+	struct tb_icon_loader *ld;
+	
+	if(!(ld = calloc(1, sizeof(struct tb_icon_loader)))) return NULL;
+	
+	if(cache_dir && !(ld->cache_dir = strdup(cache_dir))) {
+		free(ld);
+		return NULL;
+	}
+	if(pipe(ld->notify_fd) == -1) {
+		free(ld->cache_dir);
+		free(ld);
+		return NULL;
+	}
+	fcntl(ld->notify_fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(ld->notify_fd[1], F_SETFL, O_NONBLOCK);
+	fcntl(ld->notify_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(ld->notify_fd[1], F_SETFD, FD_CLOEXEC);
+	
+	pthread_mutex_init(&ld->lock, NULL);
+	pthread_cond_init(&ld->cond, NULL);
+	
+	if(!nthreads) nthreads = 1;
+	if(nthreads > MAX_WORKERS) nthreads = MAX_WORKERS;
+	
+	for(ld->nthreads = 0; ld->nthreads < nthreads; ld->nthreads++) {
+		if(pthread_create(&ld->threads[ld->nthreads], NULL,
+			worker_proc, ld)) break;
+	}
+	if(!ld->nthreads) {
+		tb_icon_loader_destroy(ld);
+		return NULL;
+	}
+	return ld;
+}
+
+void tb_icon_loader_destroy(struct tb_icon_loader *ld)
+{
+	unsigned int i;
+	
+	pthread_mutex_lock(&ld->lock);
+	ld->quit = 1;
+	pthread_cond_broadcast(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+	
+	for(i = 0; i < ld->nthreads; i++) pthread_join(ld->threads[i], NULL);
+	
+	free_queue(&ld->pending);
+	free_queue(&ld->done);
+	pthread_cond_destroy(&ld->cond);
+	pthread_mutex_destroy(&ld->lock);
+	close(ld->notify_fd[0]);
+	close(ld->notify_fd[1]);
+	free(ld->cache_dir);
+	free(ld);
+}
+
+int tb_icon_loader_fd(struct tb_icon_loader *ld)
+{
+	return ld->notify_fd[0];
+}
+
+int tb_icon_request(struct tb_icon_loader *ld,
+	const char *path, unsigned int size)
+{
+	struct icon_job *job;
+	
+	if(!size) return EINVAL;
+	if(!(job = calloc(1, sizeof(struct icon_job)))) return ENOMEM;
+	if(!(job->icon.path = strdup(path))) {
+		free(job);
+		return ENOMEM;
+	}
+	job->icon.size = size;
+	
+	pthread_mutex_lock(&ld->lock);
+	push_job(&ld->pending, job);
+	ld->stats.requests++;
+	pthread_cond_signal(&ld->cond);
+	pthread_mutex_unlock(&ld->lock);
+	return 0;
+}
+
+struct tb_icon* tb_icon_next(struct tb_icon_loader *ld)
+{
+	struct icon_job *job;
+	char buf[64];
+	
+	/* icons are queued before being signalled, so any done after
+	 * the pipe is drained here will be signalled again */
+	while(read(ld->notify_fd[0], buf, sizeof(buf)) > 0);
+	
+	pthread_mutex_lock(&ld->lock);
+	job = pop_job(&ld->done);
+	pthread_mutex_unlock(&ld->lock);
+	
+	return job ? &job->icon : NULL;
+}
+
+void tb_icon_free(struct tb_icon *icon)
+{
+	free(icon->path);
+	free(icon->pixels);
+	free(icon);
+}
+
+void tb_icon_get_stats(struct tb_icon_loader *ld, struct tb_icon_stats *st)
+{
+	pthread_mutex_lock(&ld->lock);
+	*st = ld->stats;
+	pthread_mutex_unlock(&ld->lock);
+}
+
+static void* worker_proc(void *arg)
+{
+	struct tb_icon_loader *ld = (struct tb_icon_loader*)arg;
+	struct icon_job *job;
+	
+	for(;;) {
+		pthread_mutex_lock(&ld->lock);
+		while(!ld->quit && !ld->pending.head)
+			pthread_cond_wait(&ld->cond, &ld->lock);
+		if(ld->quit) {
+			pthread_mutex_unlock(&ld->lock);
+			break;
+		}
+		job = pop_job(&ld->pending);
+		pthread_mutex_unlock(&ld->lock);
+		
+		load_icon(ld, &job->icon);
+		
+		pthread_mutex_lock(&ld->lock);
+		push_job(&ld->done, job);
+		if(job->icon.err) ld->stats.failed++;
+		pthread_mutex_unlock(&ld->lock);
+		
+		/* if the pipe is full, the reader is due to drain it anyway */
+		if(write(ld->notify_fd[1], "", 1) == -1 && errno != EAGAIN)
+			perror("write");
+	}
+	return NULL;
+}
+
+/*
+ * Loads an icon from the cache directory if it was scaled before,
+ * decodes and scales its file otherwise.
+ */
+static void load_icon(struct tb_icon_loader *ld, struct tb_icon *icon)
+{
+	unsigned char *buf = NULL;
+	size_t len = 0;
+	uint32_t *pixels = NULL;
+	unsigned int width = 0, height = 0;
+	struct timespec start, end;
+	
+	if((icon->err = read_file(icon->path, &buf, &len))) return;
+	icon->key = icon_key(buf, len, icon->size);
+	
+	if(ld->cache_dir && !read_cached_icon(ld->cache_dir, icon)) {
+		free(buf);
+		pthread_mutex_lock(&ld->lock);
+		ld->stats.disk_hits++;
+		pthread_mutex_unlock(&ld->lock);
+		return;
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	if(len >= 8 && !png_sig_cmp(buf, 0, 8))
+		icon->err = decode_png(buf, len, &pixels, &width, &height);
+	else
+		icon->err = decode_xpm(buf, len, &pixels, &width, &height);
+	free(buf);
+	
+	if(!icon->err) {
+		icon->err = scale_image(pixels, width, height, icon->size, icon);
+		free(pixels);
+	}
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	
+	pthread_mutex_lock(&ld->lock);
+	if(!icon->err) ld->stats.decoded++;
+	ld->stats.decode_msecs += (end.tv_sec - start.tv_sec) * 1000.0 +
+		(end.tv_nsec - start.tv_nsec) / 1000000.0;
+	pthread_mutex_unlock(&ld->lock);
+	
+	if(!icon->err && ld->cache_dir) write_cached_icon(ld->cache_dir, icon);
+}
+
+/* Reads a whole file into a malloc()ed buffer. Returns errno on failure. */
+static int read_file(const char *path, unsigned char **buf, size_t *len)
+{
+	struct stat st;
+	ssize_t rv;
+	size_t n = 0;
+	int fd;
+	
+	if((fd = open(path, O_RDONLY)) == -1) return errno;
+	if(fstat(fd, &st) == -1) {
+		close(fd);
+		return errno;
+	}
+	if(!S_ISREG(st.st_mode) || st.st_size > MAX_ICON_FILE) {
+		close(fd);
+		return EINVAL;
+	}
+	if(!(*buf = malloc(st.st_size + 1))) {
+		close(fd);
+		return ENOMEM;
+	}
+	while(n < (size_t)st.st_size &&
+		(rv = read(fd, *buf + n, st.st_size - n)) > 0) n += rv;
+	close(fd);
+	
+	(*buf)[n] = '\0';
+	*len = n;
+	return 0;
+}
+
+/* FNV-1a hash of file contents and the size the image is scaled to */
+static uint64_t icon_key(const unsigned char *buf, size_t len,
+	unsigned int size)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+	
+	for(i = 0; i < len; i++) {
+		h ^= buf[i];
+		h *= 0x100000001b3ULL;
+	}
+	for(i = 0; i < sizeof(size); i++) {
+		h ^= (size >> (i * 8)) & 0xff;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+static char* cached_icon_path(const char *dir, uint64_t key)
+{
+	size_t len = strlen(dir) + 32;
+	char *path;
+	
+	if(!(path = malloc(len))) return NULL;
+	snprintf(path, len, "%s/%016llx" ICON_CACHE_SUFFIX,
+		dir, (unsigned long long)key);
+	return path;
+}
+
+/* Reads scaled pixels of the icon from the cache. Returns zero on success. */
+static int read_cached_icon(const char *dir, struct tb_icon *icon)
+{
+	struct icon_cache_header hdr;
+	struct stat st;
+	size_t size;
+	char *path;
+	int fd;
+	
+	if(!(path = cached_icon_path(dir, icon->key))) return ENOMEM;
+	fd = open(path, O_RDONLY);
+	free(path);
+	if(fd == -1) return errno;
+	
+	if(fstat(fd, &st) == -1 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+		memcmp(hdr.magic, ICON_CACHE_MAGIC, sizeof(hdr.magic)) ||
+		hdr.version != ICON_CACHE_VERSION || hdr.height != icon->size ||
+		!hdr.width || hdr.width > icon->size * MAX_ASPECT) {
+		close(fd);
+		return EINVAL;
+	}
+	size = (size_t)hdr.width * hdr.height * sizeof(uint32_t);
+	if(st.st_size != sizeof(hdr) + size ||
+		!(icon->pixels = malloc(size))) {
+		close(fd);
+		return EINVAL;
+	}
+	if(read(fd, icon->pixels, size) != size) {
+		close(fd);
+		free(icon->pixels);
+		icon->pixels = NULL;
+		return EIO;
+	}
+	close(fd);
+	icon->width = hdr.width;
+	icon->height = hdr.height;
+	return 0;
+}
+
+/*
+ * Saves scaled pixels of the icon in the cache. Written to a temporary file
+ * first and renamed, so that other sessions never read a partial one.
+ */
+static void write_cached_icon(const char *dir, const struct tb_icon *icon)
+{
+	struct icon_cache_header hdr;
+	size_t size = (size_t)icon->width * icon->height * sizeof(uint32_t);
+	char *path, *tmp_path;
+	size_t len = strlen(dir) + 24;
+	int fd, err = 0;
+	
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, ICON_CACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = ICON_CACHE_VERSION;
+	hdr.width = icon->width;
+	hdr.height = icon->height;
+	
+	path = cached_icon_path(dir, icon->key);
+	tmp_path = malloc(len);
+	if(path && tmp_path) {
+		snprintf(tmp_path, len, "%s/.tbiXXXXXX", dir);
+		if((fd = mkstemp(tmp_path)) != -1) {
+			if(write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+				write(fd, icon->pixels, size) != size) err = 1;
+			if(close(fd) == -1) err = 1;
+			if(err || rename(tmp_path, path) == -1) unlink(tmp_path);
+		}
+	}
+	free(path);
+	free(tmp_path);
+}
+
+/* Decodes a PNG image into premultiplied ARGB pixels */
+static int decode_png(const unsigned char *buf, size_t len,
+	uint32_t **pixels, unsigned int *width, unsigned int *height)
+{
+	static const union { uint32_t u; unsigned char c[4]; } endian = { 1 };
+	png_image image;
+	uint32_t *p;
+	size_t i, count;
+	
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if(!png_image_begin_read_from_memory(&image, buf, len)) return EINVAL;
+	
+	if(!image.width || !image.height ||
+		image.width > MAX_ICON_DIM || image.height > MAX_ICON_DIM) {
+		png_image_free(&image);
+		return EINVAL;
+	}
+	/* byte order that yields native 0xAARRGGBB words */
+	image.format = endian.c[0] ? PNG_FORMAT_BGRA : PNG_FORMAT_ARGB;
+	
+	count = (size_t)image.width * image.height;
+	if(!(p = malloc(count * sizeof(uint32_t)))) {
+		png_image_free(&image);
+		return ENOMEM;
+	}
+	if(!png_image_finish_read(&image, NULL, p, 0, NULL)) {
+		free(p);
+		return EINVAL;
+	}
+	
+	for(i = 0; i < count; i++) {
+		uint32_t a = p[i] >> 24;
+		
+		if(a == 0xff) continue;
+		p[i] = (a << 24) |
+			((((p[i] >> 16) & 0xff) * a / 0xff) << 16) |
+			((((p[i] >> 8) & 0xff) * a / 0xff) << 8) |
+			((p[i] & 0xff) * a / 0xff);
+	}
+	*pixels = p;
+	*width = image.width;
+	*height = image.height;
+	return 0;
+}
+
+/*
+ * Decodes an XPM (version 3) image into premultiplied ARGB pixels. Only
+ * the C source form is read, i.e. pixel data in C string literals.
+ */
+static int decode_xpm(const unsigned char *buf, size_t len,
+	uint32_t **pixels, unsigned int *width, unsigned int *height)
+{
+	const char *p = (const char*)buf;
+	const char *end = p + len;
+	const char **lines = NULL;
+	size_t nlines = 0, size = 0;
+	int err;
+	
+	/* the buffer is null terminated by read_file */
+	if(!strstr((const char*)buf, "XPM")) return EINVAL;
+	
+	/* string literals are left unterminated, their ends
+	 * are found again where needed */
+	while((p = memchr(p, '\"', end - p))) {
+		const char *q = memchr(p + 1, '\"', end - (p + 1));
+		
+		if(!q) break;
+		if(nlines == size) {
+			const char **new_ptr;
+			
+			size = size ? size * 2 : 64;
+			if(!(new_ptr = realloc(lines, size * sizeof(char*)))) {
+				free(lines);
+				return ENOMEM;
+			}
+			lines = new_ptr;
+		}
+		lines[nlines++] = p + 1;
+		p = q + 1;
+	}
+	
+	err = read_xpm(lines, nlines, pixels, width, height);
+	free(lines);
+	return err;
+}
+
+/* Reads XPM values, colors and pixels from its string literals */
+static int read_xpm(const char **lines, size_t nlines,
+	uint32_t **pixels, unsigned int *width, unsigned int *height)
+{
+	unsigned int w, h, ncolors, cpp;
+	struct xpm_color *colors;
+	uint32_t direct[256];
+	uint32_t *out;
+	unsigned int i, x, y;
+	int err = 0;
+	
+	if(!nlines ||
+		sscanf(lines[0], "%u %u %u %u", &w, &h, &ncolors, &cpp) != 4 ||
+		!w || !h || w > MAX_ICON_DIM || h > MAX_ICON_DIM ||
+		!ncolors || !cpp || cpp > 4 || nlines < 1 + ncolors + h)
+		return EINVAL;
+	
+	if(!(colors = malloc(ncolors * sizeof(struct xpm_color)))) return ENOMEM;
+	if(!(out = malloc((size_t)w * h * sizeof(uint32_t)))) {
+		free(colors);
+		return ENOMEM;
+	}
+	
+	for(i = 0; i < ncolors && !err; i++) {
+		const char *s = lines[1 + i];
+		const char *s_end = strchr(s, '\"');
+		const char *spec = NULL;
+		size_t spec_len = 0;
+		
+		if(s_end - s < cpp) {
+			err = EINVAL;
+			break;
+		}
+		colors[i].code = xpm_code(s, cpp);
+		colors[i].pixel = 0xff808080;
+		
+		/* "<chars> c <color> [m <color>]..."; color may consist
+		 * of several words, and the first of c, g, g4, m is used */
+		s += cpp;
+		while(s < s_end) {
+			const char *key, *val;
+			size_t key_len;
+			
+			while(s < s_end && isspace((unsigned char)*s)) s++;
+			key = s;
+			while(s < s_end && !isspace((unsigned char)*s)) s++;
+			key_len = s - key;
+			while(s < s_end && isspace((unsigned char)*s)) s++;
+			val = s;
+			
+			/* value runs up to the next key */
+			while(s < s_end) {
+				const char *t = s;
+				
+				while(t < s_end && !isspace((unsigned char)*t)) t++;
+				if((t - s == 1 && strchr("cgms", *s)) ||
+					(t - s == 2 && !memcmp(s, "g4", 2))) break;
+				s = t;
+				while(s < s_end && isspace((unsigned char)*s)) s++;
+			}
+			if(key_len == 1 && *key == 'c') {
+				spec = val;
+				spec_len = s - val;
+				break;
+			}
+			if(!spec && ((key_len == 1 && strchr("gm", *key)) ||
+				(key_len == 2 && !memcmp(key, "g4", 2)))) {
+				spec = val;
+				spec_len = s - val;
+			}
+		}
+		while(spec_len && isspace((unsigned char)spec[spec_len - 1]))
+			spec_len--;
+		if(spec_len) parse_xpm_color(spec, spec_len, &colors[i].pixel);
+	}
+	
+	if(cpp == 1) {
+		for(i = 0; i < 256; i++) direct[i] = 0;
+		for(i = 0; i < ncolors; i++)
+			direct[colors[i].code] = colors[i].pixel;
+	} else {
+		qsort(colors, ncolors, sizeof(struct xpm_color),
+			compare_xpm_colors);
+	}
+	
+	for(y = 0; y < h && !err; y++) {
+		const char *s = lines[1 + ncolors + y];
+		const char *s_end = strchr(s, '\"');
+		uint32_t *row = out + (size_t)y * w;
+		
+		if(s_end - s < (ptrdiff_t)w * cpp) {
+			err = EINVAL;
+			break;
+		}
+		for(x = 0; x < w; x++, s += cpp) {
+			if(cpp == 1) {
+				row[x] = direct[(unsigned char)*s];
+			} else {
+				struct xpm_color *c, key;
+				
+				key.code = xpm_code(s, cpp);
+				c = bsearch(&key, colors, ncolors,
+					sizeof(struct xpm_color), compare_xpm_colors);
+				row[x] = c ? c->pixel : 0;
+			}
+		}
+	}
+	free(colors);
+	
+	if(err) {
+		free(out);
+		return err;
+	}
+	*pixels = out;
+	*width = w;
+	*height = h;
+	return 0;
+}
+
+static uint32_t xpm_code(const char *chars, unsigned int cpp)
+{
+	uint32_t code = 0;
+	unsigned int i;
+	
+	for(i = 0; i < cpp; i++) code = (code << 8) | (unsigned char)chars[i];
+	return code;
+}
+
+static int compare_xpm_colors(const void *a, const void *b)
+{
+	uint32_t ca = ((const struct xpm_color*)a)->code;
+	uint32_t cb = ((const struct xpm_color*)b)->code;
+	
+	return (ca > cb) - (ca < cb);
+}
+
+/*
+ * Parses an XPM color specification; #rgb, #rrggbb, #rrrrggggbbbb, None,
+ * or a name. Returns zero on success, leaving pixel untouched otherwise.
+ */
+static int parse_xpm_color(const char *spec, size_t len, uint32_t *pixel)
+{
+	char name[32];
+	size_t i, n = 0;
+	
+	if(len == 4 && !strncasecmp(spec, "none", 4)) {
+		*pixel = 0;
+		return 0;
+	}
+	if(*spec == '#') {
+		unsigned int rgb[3] = { 0, 0, 0 };
+		size_t digits = (len - 1) / 3;
+		
+		if((len - 1) % 3 || !digits || digits > 4) return EINVAL;
+		for(i = 0; i < len - 1; i++) {
+			int c = tolower((unsigned char)spec[1 + i]);
+			unsigned int v;
+			
+			if(c >= '0' && c <= '9') v = c - '0';
+			else if(c >= 'a' && c <= 'f') v = c - 'a' + 10;
+			else return EINVAL;
+			
+			/* only the two most significant digits matter */
+			if(i % digits < 2) rgb[i / digits] = (rgb[i / digits] << 4) | v;
+		}
+		if(digits == 1) for(i = 0; i < 3; i++) rgb[i] *= 0x11;
+		*pixel = 0xff000000 | (rgb[0] << 16) | (rgb[1] << 8) | rgb[2];
+		return 0;
+	}
+	
+	/* names are matched regardless of case and blanks */
+	for(i = 0; i < len && n < sizeof(name) - 1; i++) {
+		if(!isspace((unsigned char)spec[i]))
+			name[n++] = tolower((unsigned char)spec[i]);
+	}
+	name[n] = '\0';
+	
+	if((!strncmp(name, "gray", 4) || !strncmp(name, "grey", 4)) &&
+		isdigit((unsigned char)name[4])) {
+		unsigned int level = atoi(name + 4);
+		
+		if(level > 100) return EINVAL;
+		level = (level * 255 + 50) / 100;
+		*pixel = 0xff000000 | (level << 16) | (level << 8) | level;
+		return 0;
+	}
+	for(i = 0; i < sizeof(xpm_color_names) / sizeof(xpm_color_names[0]); i++) {
+		if(!strcmp(name, xpm_color_names[i].name)) {
+			*pixel = 0xff000000 | xpm_color_names[i].rgb;
+			return 0;
+		}
+	}
+	return EINVAL;
+}
+
+/*
+ * Scales the image to 'size' pixels in height, preserving the aspect ratio
+ * (up to MAX_ASPECT), into icon's pixels. Pixels are averaged over the area
+ * each one covers when shrinking, and replicated when enlarging.
+ */
+static int scale_image(const uint32_t *src, unsigned int sw,
+	unsigned int sh, unsigned int size, struct tb_icon *icon)
+{
+	unsigned int dw, dh = size;
+	unsigned int dx, dy, sx, sy;
+	uint32_t *out;
+	
+	dw = (unsigned int)(((unsigned long)sw * dh + sh / 2) / sh);
+	if(!dw) dw = 1;
+	if(dw > dh * MAX_ASPECT) dw = dh * MAX_ASPECT;
+	
+	if(!(out = malloc((size_t)dw * dh * sizeof(uint32_t)))) return ENOMEM;
+	
+	for(dy = 0; dy < dh; dy++) {
+		unsigned int sy0 = (unsigned long)dy * sh / dh;
+		unsigned int sy1 = (unsigned long)(dy + 1) * sh / dh;
+		
+		if(sy1 <= sy0) sy1 = sy0 + 1;
+		
+		for(dx = 0; dx < dw; dx++) {
+			unsigned int sx0 = (unsigned long)dx * sw / dw;
+			unsigned int sx1 = (unsigned long)(dx + 1) * sw / dw;
+			unsigned long sum[4] = { 0, 0, 0, 0 };
+			unsigned long n;
+			
+			if(sx1 <= sx0) sx1 = sx0 + 1;
+			n = (unsigned long)(sx1 - sx0) * (sy1 - sy0);
+			
+			for(sy = sy0; sy < sy1; sy++) {
+				const uint32_t *row = src + (size_t)sy * sw;
+				
+				for(sx = sx0; sx < sx1; sx++) {
+					sum[0] += row[sx] >> 24;
+					sum[1] += (row[sx] >> 16) & 0xff;
+					sum[2] += (row[sx] >> 8) & 0xff;
+					sum[3] += row[sx] & 0xff;
+				}
+			}
+			out[(size_t)dy * dw + dx] =
+				((uint32_t)((sum[0] + n / 2) / n) << 24) |
+				((uint32_t)((sum[1] + n / 2) / n) << 16) |
+				((uint32_t)((sum[2] + n / 2) / n) << 8) |
+				(uint32_t)((sum[3] + n / 2) / n);
+		}
+	}
+	icon->pixels = out;
+	icon->width = dw;
+	icon->height = dh;
+	return 0;
+}
+
+static void push_job(struct icon_queue *q, struct icon_job *job)
+{
+	job->next = NULL;
+	if(q->tail) q->tail->next = job;
+	else q->head = job;
+	q->tail = job;
+}
+
+static struct icon_job* pop_job(struct icon_queue *q)
+{
+	struct icon_job *job = q->head;
+	
+	if(job) {
+		q->head = job->next;
+		if(!q->head) q->tail = NULL;
+	}
+	return job;
+}
+
+static void free_queue(struct icon_queue *q)
+{
+	struct icon_job *job;
+	
+	while((job = pop_job(q))) tb_icon_free(&job->icon);
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbicon_h
+#define tbicon_h
+
+#include <stdint.h>
+
+/* A decoded menu icon, scaled to the requested height */
+struct tb_icon {
+	char *path;
+	unsigned int size;
+	/* hash of the file's contents and the size, shared by identical
+	 * icons regardless of their path */
+	uint64_t key;
+	unsigned int width;
+	unsigned int height;
+	/* premultiplied 0xAARRGGBB pixels, row by row */
+	uint32_t *pixels;
+	/* errno value, if the icon couldn't be loaded */
+	int err;
+};
+
+/* Load counters, see tb_icon_get_stats */
+struct tb_icon_stats {
+	unsigned long requests;
+	unsigned long disk_hits;
+	unsigned long decoded;
+	unsigned long failed;
+	double decode_msecs;
+};
+
+/* Opaque loader context, owning the worker threads */
+struct tb_icon_loader;
+
+/*
+ * Creates a loader that decodes XPM and PNG images on 'nthreads' worker
+ * threads. Scaled images are saved in cache_dir (if not NULL), keyed by
+ * contents of the source file, so that they don't need to be decoded on
+ * subsequent runs. Returns NULL on failure.
+ */
+struct tb_icon_loader* tb_icon_loader_create(unsigned int nthreads,
+	const char *cache_dir);
+
+/* Stops the worker threads and destroys the loader, with pending icons */
+void tb_icon_loader_destroy(struct tb_icon_loader*);
+
+/*
+ * Returns a file descriptor which becomes readable when loaded icons
+ * can be retrieved with tb_icon_next.
+ */
+int tb_icon_loader_fd(struct tb_icon_loader*);
+
+/*
+ * Queues an image file to be loaded and scaled to 'size' pixels in
+ * height. Returns zero on success, errno otherwise.
+ */
+int tb_icon_request(struct tb_icon_loader*, const char *path, unsigned int size);
+
+/*
+ * Returns the next icon loaded (or failed to), or NULL if there are none
+ * at the moment. The icon must be freed with tb_icon_free.
+ */
+struct tb_icon* tb_icon_next(struct tb_icon_loader*);
+
+void tb_icon_free(struct tb_icon*);
+
+/* Retrieves load counters of the loader */
+void tb_icon_get_stats(struct tb_icon_loader*, struct tb_icon_stats*);
+
+#endif /* tbicon_h */
@@ -29,9 +29,9 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
-#include <ctype.h>
 #include <signal.h>
 #include <stdint.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <Xm/Xm.h>
@@ -45,35 +45,275 @@
 #include <Xm/SelectioB.h>
 #include <Xm/TextF.h>
 #include <Xm/MessageB.h>
+#include <Xm/List.h>
 #include <Xm/MwmUtil.h>
+#include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <errno.h>
 #include "tbparse.h"
+#include "tbcache.h"
+#include "tbdir.h"
+#include "tbcheck.h"
+#include "tbpath.h"
+#include "tbapps.h"
+#include "tbdefault.h"
+#include "tbwatch.h"
+#include "tbsearch.h"
+#include "tbicon.h"
+#include "tbusage.h"
 #include "common.h"
+#include "xmstr.h"
 #include "smglobal.h"
 #include "wswitch.h"
 
+/* Generator state of a TBE_PIPE cascade */
+struct pipe_menu {
+	Widget wpulldown;
+	char *command;
+	int ttl;
+	/* when current contents were generated; zero if never */
+	time_t stamp;
+	struct tb_parser *parser;
+	/* output of the generator in progress */
+	int fd;
+	XtInputId input;
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+/* State of a TBE_DIRECTORY cascade, or a "More..." page of one */
+struct dir_menu {
+	Widget wpulldown;
+	char *path;
+	/* index of the first directory entry shown */
+	size_t first;
+	/* snapshot current contents were created from */
+	struct tb_dir *dir;
+};
+
+/* State of a TBE_APPLICATIONS cascade; the menu is built on a worker
+ * thread, which signals completion by writing to the notify pipe */
+struct apps_menu {
+	Widget wpulldown;
+	struct tb_parser *parser;
+	pthread_t thread;
+	Boolean pending;
+	int err;
+	int notify_fd[2];
+	XtInputId input;
+	const struct tb_menu *menu;
+};
+
+/* State of a TBE_COMMAND item; expanded and split command string are
+ * kept as long as the item (the environment isn't expected to change
+ * after startup), and the executable's path until PATH changes, so that
+ * launching is cheap */
+struct menu_command {
+	struct env_memo cmd;
+	char *str;
+	char **argv;
+	/* resolved argv[0], owned by tbpath.c */
+	const char *exec_path;
+	int path_err;
+	unsigned long path_gen;
+	/* index and title of the menu entry it was created from */
+	int entry;
+	const char *title;
+};
+
+/* Unmanaged gadgets of one kind in a gadget pool */
+struct gadget_list {
+	WidgetList items;
+	Cardinal count;
+	Cardinal size;
+	/* lowest count since the pool was last trimmed; this many
+	 * gadgets weren't needed in the meantime */
+	Cardinal low_count;
+	/* number of gadgets the pending trim is going to destroy */
+	Cardinal trim;
+};
+
+/* Push button and separator gadgets removed from a pulldown, kept
+ * unmanaged for reuse by items created in it later on, instead of being
+ * destroyed, so that rebuilding menus doesn't churn the heap */
+struct gadget_pool {
+	Widget wpulldown;
+	struct gadget_list buttons;
+	struct gadget_list separators;
+	struct gadget_pool *next;
+};
+
+/* A pulldown built from the rc file, kept in least recently posted order
+ * so that the coldest ones can be destroyed when menuMemoryLimit is
+ * exceeded; an empty pulldown takes its place, to be rebuilt when posted */
+struct resident_menu {
+	Widget wcascade;
+	Widget wpulldown;
+	size_t cost;
+	struct resident_menu *prev;
+	struct resident_menu *next;
+};
+
+/* Callbacks a menu item was attached with by add_item_callback, so that
+ * these alone are removed (and item state freed) when it's pooled */
+#define MAX_ITEM_CALLBACKS 4
+struct item_callbacks {
+	Cardinal count;
+	Boolean overflow;
+	struct {
+		String name;
+		XtCallbackProc proc;
+		XtPointer closure;
+	} cb[MAX_ITEM_CALLBACKS];
+};
+
+/* Estimated memory taken by a menu item: gadget instance and its cached
+ * resources, label string, and command state */
+#define MENU_ITEM_COST 1024
+
+/* Image file of menu items given in the ICON directive, identified by its
+ * (expanded) path; loaded once and shared by all items showing it */
+struct menu_icon {
+	XrmQuark path;
+	Boolean pending;
+	/* None if it couldn't be loaded */
+	Pixmap pixmap;
+	/* items created while the image was being loaded */
+	WidgetList waiting;
+	Cardinal nwaiting;
+	Cardinal size;
+};
+
+/* Server-side pixmap of a scaled image, shared by identical images */
+struct icon_pixmap {
+	uint64_t key;
+	Pixmap pixmap;
+	struct icon_pixmap *next;
+};
+
+/* Number of threads menu icons are decoded on */
+#define ICON_THREADS 2
+
+/* Milliseconds to wait for rc file changes to settle before reloading,
+ * and the interval changes are checked at if they can't be waited for */
+#define RC_RELOAD_DELAY 250
+#define RC_POLL_INTERVAL 5000
+
+/* Milliseconds between checks for pooled gadgets that weren't needed, and
+ * the number of those destroyed at a time while idle */
+#define POOL_TRIM_INTERVAL 30000
+#define POOL_TRIM_CHUNK 32
+
+/* Number of best matches the command palette lists */
+#define PALETTE_MAX_ITEMS 50
+
+/* Upper limit of the frequentItems resource */
+#define MAX_FREQUENT 32
+
+/* Pipe menu generator output limits */
+#define PIPE_READ_SIZE 4096
+#define MAX_PIPE_OUTPUT (256 * PIPE_READ_SIZE)
+
 /* Forward declarations */
 static char* find_rc_file(void);
+static char* get_rc_file(int, char**);
+static void start_parse_thread(int, char**);
+static void* parse_thread_proc(void*);
 static Boolean construct_menu(void);
-static void create_utility_widgets(Widget);
+static Boolean create_menu_items(Widget, const struct tb_menu*, int);
+static Boolean create_menu_item(Widget, const struct tb_menu*, int, Widget*);
+static int menu_item_entry(Widget);
+static Boolean sync_menu_items(Widget,
+	const struct tb_menu*, const struct tb_menu*, int);
+static Boolean update_menu_item(Widget, const struct tb_entry*,
+	const struct tb_menu*, const struct tb_menu*, int);
+static void clear_menu_items(Widget);
+static void remove_menu_items(WidgetList, Cardinal);
+static Widget create_menu_button(Widget, ArgList, Cardinal);
+static Widget create_menu_separator(Widget, ArgList, Cardinal);
+static struct gadget_pool* get_gadget_pool(Widget, Boolean);
+static Boolean pool_gadget(struct gadget_list*, Widget);
+static Widget take_pooled_gadget(struct gadget_list*);
+static void gadget_pool_destroy_cb(Widget,XtPointer,XtPointer);
+static void add_item_callback(Widget, String, XtCallbackProc, XtPointer);
+static void remove_item_callback(Widget, String, XtCallbackProc, XtPointer);
+static Boolean release_item_callbacks(Widget);
+static void item_callbacks_destroy_cb(Widget,XtPointer,XtPointer);
+static void pool_trim_timer_cb(XtPointer,XtIntervalId*);
+static Boolean pool_trim_proc(XtPointer);
+static void touch_resident_menu(Widget, Widget);
+static void unlink_resident_menu(struct resident_menu*);
+static void resident_menu_destroy_cb(Widget,XtPointer,XtPointer);
+static Boolean evict_menus_proc(XtPointer);
+static void set_item_icon(Widget, const char*);
+static Boolean init_icons(Widget);
+static void icon_input_cb(XtPointer,int*,XtInputId*);
+static Pixmap get_icon_pixmap(const struct tb_icon*);
+static void apply_icon(Widget, Pixmap);
+static void icon_wait_destroy_cb(Widget,XtPointer,XtPointer);
+static Widget create_pipe_menu(Widget, const struct tb_entry*);
+static void set_menu_status(Widget, const char*);
+static void end_pipe_menu_input(struct pipe_menu*);
+static void pipe_menu_cascading_cb(Widget,XtPointer,XtPointer);
+static void pipe_menu_input_cb(XtPointer,int*,XtInputId*);
+static void pipe_menu_destroy_cb(Widget,XtPointer,XtPointer);
+static Widget create_dir_menu(Widget, const char*, KeySym, const char*, size_t);
+static void fill_dir_menu(struct dir_menu*);
+static void dir_menu_cascading_cb(Widget,XtPointer,XtPointer);
+static void dir_menu_destroy_cb(Widget,XtPointer,XtPointer);
+static void dir_file_cb(Widget,XtPointer,XtPointer);
+static Widget create_apps_menu(Widget, const struct tb_entry*);
+static void* apps_thread_proc(void*);
+static void apps_menu_input_cb(XtPointer,int*,XtInputId*);
+static void apps_menu_destroy_cb(Widget,XtPointer,XtPointer);
+static char* join_path(const char*, const char*);
+static Boolean startup_proc(XtPointer);
+static void create_session_menu(Widget);
+static void open_usage_log(void);
+static void record_launch(const char*, const char*);
+static void frequent_cascading_cb(Widget,XtPointer,XtPointer);
+static void frequent_item_cb(Widget,XtPointer,XtPointer);
+static void frequent_item_destroy_cb(Widget,XtPointer,XtPointer);
+static void create_gadgets(Widget);
 static void set_icon(Widget);
 static Boolean setup_hotkeys(void);
+static Boolean grab_hotkey(const char*, KeyCode*, unsigned int*);
 static int xgrabkey_err_handler(Display*,XErrorEvent*);
 static void handle_root_event(XEvent*);
 void raise_and_focus(Widget w);
 static void time_update_cb(XtPointer,XtIntervalId*);
 static int exec_command(const char*);
+static int exec_argv(const char*, char**);
+static int open_file(const char*);
+static int spawn_command(const char*, int*);
 static void report_exec_error(const char*,const char*,int);
 static void report_rcfile_error(const char*,const char*);
 static Boolean message_dialog(Boolean,const char*);
 static void exec_cb(Widget,XtPointer,XtPointer);
 static void exec_dialog_cb(Widget,XtPointer,XtPointer);
+static void palette_cb(Widget,XtPointer,XtPointer);
+static void show_palette(void);
+static void create_palette(void);
+static void update_palette(void);
+static void run_palette_item(void);
+static void palette_filter_cb(Widget,XtPointer,XtPointer);
+static void palette_activate_cb(Widget,XtPointer,XtPointer);
+static void palette_move_action(Widget,XEvent*,String*,Cardinal*);
+static void palette_close_action(Widget,XEvent*,String*,Cardinal*);
 static void menu_command_cb(Widget,XtPointer,XtPointer);
+static int prepare_command(struct menu_command*);
+static void update_command_items(Widget);
+static void menu_cascading_cb(Widget,XtPointer,XtPointer);
+static void menu_command_destroy_cb(Widget,XtPointer,XtPointer);
 static void message_dialog_cb(Widget,XtPointer,XtPointer);
 static void sigchld_handler(int);
 static void sigusr_handler(int);
 static void xt_sigusr1_handler(XtPointer,XtSignalId*);
+static void reload_menu(void);
+static void watch_rc_files(void);
+static void rc_watch_input_cb(XtPointer,int*,XtInputId*);
+static void rc_watch_timer_cb(XtPointer,XtIntervalId*);
 static void suspend_cb(Widget,XtPointer,XtPointer);
 static void logout_cb(Widget,XtPointer,XtPointer);
 static void lock_cb(Widget,XtPointer,XtPointer);
@@ -90,10 +330,17 @@ struct tb_resources {
 	char *date_time_fmt;
 	char *rc_file;
 	char *hotkey;
+	char *palette_hotkey;
 	Boolean horizontal;
 	Boolean separators;
 	Boolean switcher;
 	Boolean occupy_all;
+	int pipe_menu_ttl;
+	char *file_opener;
+	int dir_menu_items;
+	Boolean auto_reload;
+	int menu_memory_limit;
+	int frequent_items;
 } app_res;
 
 #define RES_FIELD(f) XtOffsetOf(struct tb_resources,f)
@@ -113,6 +360,9 @@ static XtResource xrdb_resources[]={
 	{ "hotkey","Hotkey",XmRString,sizeof(String),
 		RES_FIELD(hotkey),XmRImmediate,(XtPointer)NULL
 	},
+	{ "paletteHotkey","Hotkey",XmRString,sizeof(String),
+		RES_FIELD(palette_hotkey),XmRImmediate,(XtPointer)NULL
+	},
 	{ "horizontal","Horizontal",XmRBoolean,sizeof(Boolean),
 		RES_FIELD(horizontal),XmRImmediate,(XtPointer)False
 	},
@@ -124,6 +374,24 @@ static XtResource xrdb_resources[]={
 	},
 	{ "occupyAllWorkspaces","OccupyAllWorkspaces",XmRBoolean,sizeof(Boolean),
 		RES_FIELD(occupy_all),XmRImmediate,(XtPointer)True
+	},
+	{ "pipeMenuCacheTime","PipeMenuCacheTime",XmRInt,sizeof(int),
+		RES_FIELD(pipe_menu_ttl),XmRImmediate,(XtPointer)300
+	},
+	{ "fileOpener","FileOpener",XmRString,sizeof(String),
+		RES_FIELD(file_opener),XmRImmediate,(XtPointer)"xdg-open"
+	},
+	{ "dirMenuItems","DirMenuItems",XmRInt,sizeof(int),
+		RES_FIELD(dir_menu_items),XmRImmediate,(XtPointer)40
+	},
+	{ "autoReload","AutoReload",XmRBoolean,sizeof(Boolean),
+		RES_FIELD(auto_reload),XmRImmediate,(XtPointer)True
+	},
+	{ "menuMemoryLimit","MenuMemoryLimit",XmRInt,sizeof(int),
+		RES_FIELD(menu_memory_limit),XmRImmediate,(XtPointer)2048
+	},
+	{ "frequentItems","FrequentItems",XmRInt,sizeof(int),
+		RES_FIELD(frequent_items),XmRImmediate,(XtPointer)10
 	}
 
 };
@@ -133,6 +401,7 @@ static XrmOptionDescRec xrdb_options[]={
 	{"-title","title",XrmoptionSepArg,(caddr_t)NULL},
 	{"-rcfile","rcFile",XrmoptionSepArg,(caddr_t)NULL},
 	{"-hotkey","hotkey",XrmoptionSepArg,(caddr_t)NULL},
+	{"-palettehotkey","paletteHotkey",XrmoptionSepArg,(caddr_t)NULL},
 	{"-horizontal", "horizontal", XrmoptionNoArg, (caddr_t)"True"},
 	{"+horizontal", "horizontal", XrmoptionNoArg, (caddr_t)"False"}
 };
@@ -185,13 +454,75 @@ static Widget wmenu = None;
 static Widget wswitch = None;
 static Widget wgadsep = None;
 static Widget wgadrc = None;
+/* stage of deferred utility widget construction, see startup_proc */
+static int startup_stage = 0;
+#ifdef DEBUG_MENU
+static struct timespec startup_time;
+#endif
 static String rc_file_path = NULL;
 static XtSignalId xt_sigusr1;
+static struct tb_parser *parser = NULL;
+/* parser the rc file is reloaded with, while items still refer to
+ * entries held by the other one; the two are swapped after reloading */
+static struct tb_parser *reload_parser = NULL;
+/* menu the current items were created from */
+static const struct tb_menu *menu_shown = NULL;
+/* rc file change notification */
+static struct tb_watch *rc_watch = NULL;
+static XtInputId rc_watch_input;
+static XtIntervalId rc_watch_timer = 0;
+/* gadget pools of all pulldowns, and their trimming schedule */
+static struct gadget_pool *gadget_pools = NULL;
+static XContext gadget_pool_context = 0;
+static XtIntervalId pool_trim_timer = 0;
+static XtWorkProcId pool_trim_work = 0;
+static XContext item_callbacks_context = 0;
+/* built pulldowns, most recently posted first, and their estimated size */
+static struct resident_menu *resident_head = NULL;
+static struct resident_menu *resident_tail = NULL;
+static size_t resident_cost = 0;
+static XContext resident_menu_context = 0;
+static XtWorkProcId evict_work = 0;
+/* menu icons, kept across reloads; icon_size is zero if unavailable */
+static struct tb_icon_loader *icon_loader = NULL;
+static Boolean icons_init = False;
+static XContext menu_icon_context = 0;
+static struct icon_pixmap *icon_pixmaps = NULL;
+static unsigned int icon_size = 0;
+static XColor icon_background;
+static unsigned long icon_hits = 0;
 static KeyCode hotkey_code = 0;
 unsigned int hotkey_mods = 0;
+static KeyCode palette_key_code = 0;
+static unsigned int palette_key_mods = 0;
+/* command palette; its index is rebuilt when first shown after
+ * the menu was (re)loaded */
+static Widget wpalette = None;
+static Widget wpalette_text = None;
+static Widget wpalette_list = None;
+static struct tb_search *palette_search = NULL;
+static Boolean palette_stale = True;
+static unsigned int palette_items[PALETTE_MAX_ITEMS];
+static unsigned int palette_nitems = 0;
+/* launch counts, and keys of commands the 'Frequent' menu shows, in order;
+ * the menu is rebuilt when posted only if the ranking changed */
+static struct tb_usage *usage = NULL;
+static uint64_t frequent_shown[MAX_FREQUENT];
+static unsigned int frequent_count = 0;
+static Boolean frequent_built = False;
 unsigned long xmsm_cfg = 0;
 static Boolean sm_reqstat;
 
+/* The rc file is parsed on a worker thread while the X connection is being
+ * set up, and joined with when construct_menu() first needs the result */
+static struct {
+	pthread_t thread;
+	Boolean pending;
+	char *path;
+	int err;
+	const struct tb_menu *menu;
+} early_parse;
+
 
 int main(int argc, char **argv)
 {
@@ -200,11 +531,34 @@ int main(int argc, char **argv)
 	Widget wframe;
 	int root_event_mask = PropertyChangeMask;
 	int retries;
+	int i;
 	
+	#ifdef DEBUG_MENU
+	clock_gettime(CLOCK_MONOTONIC, &startup_time);
+	#endif
 	rsignal(SIGUSR1, sigusr_handler);
 	rsignal(SIGUSR2, sigusr_handler);
 	rsignal(SIGCHLD, sigchld_handler);
 
+	/* validate the rc file and exit without connecting to the X server */
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-check")) {
+			char *rc_file = get_rc_file(argc, argv);
+			
+			if(!rc_file) {
+				fprintf(stderr, "%s not found, nor specified.\n", RC_NAME);
+				return EXIT_FAILURE;
+			}
+			return tb_check_config(rc_file) ? EXIT_FAILURE : EXIT_SUCCESS;
+		}
+	}
+
+	if(!(parser = tb_parser_create())) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	start_parse_thread(argc, argv);
+
 	XtSetLanguageProc(NULL,NULL,NULL);
 	XtToolkitInitialize();
 	
@@ -218,8 +572,6 @@ int main(int argc, char **argv)
 	root_window = RootWindowOfScreen(XtScreen(wshell));
 
 	if(argc > 1) {
-		int i;
-		
 		for(i = 1; i < argc; i++) {
 			if(!strcmp("-version", argv[i])) {
 				print_version(APP_NAME);
@@ -253,10 +605,6 @@ int main(int argc, char **argv)
 	}
 	xa_cdesk = XInternAtom(dpy, _NET_CURRENT_DESKTOP, False);
 
-
-	if(!get_xmsm_config(&xmsm_cfg)) 
-		message_dialog(False, xmsm_cmd_err);
-
 	if(!app_res.title){
 		char *title;
 		char *login;
@@ -286,22 +634,18 @@ int main(int argc, char **argv)
 		XmNorientation, (app_res.horizontal ? XmHORIZONTAL:XmVERTICAL),
 		NULL);
 
-	rc_file_path = (app_res.rc_file) ? app_res.rc_file : find_rc_file();
+	if(app_res.rc_file)
+		rc_file_path = app_res.rc_file;
+	else
+		rc_file_path = early_parse.path;
 	
-	if(rc_file_path){
-		if(access(rc_file_path, R_OK) == -1){
-			message_dialog(False, "Cannot access RC file. Exiting!");
-			perror(rc_file_path);
-			return EXIT_FAILURE;
-		}
-		if(!construct_menu()) return EXIT_FAILURE;
-	}else{
-		message_dialog(False, "RC file not found, nor specified. Exiting!");
-		fprintf(stderr,"%s not found, nor specified.\n",RC_NAME);
+	if(rc_file_path && access(rc_file_path, R_OK) == -1){
+		message_dialog(False, "Cannot access RC file. Exiting!");
+		perror(rc_file_path);
 		return EXIT_FAILURE;
 	}
-
-	create_utility_widgets(wmain);
+	/* the built-in menu is used if there's no rc file */
+	if(!construct_menu()) return EXIT_FAILURE;
 	
 	XtRealizeWidget(wshell);
 	if(app_res.occupy_all) set_ws_presence(wshell);
@@ -311,13 +655,25 @@ int main(int argc, char **argv)
 		root_event_mask |= KeyPressMask;
 
 	XtMapWidget(wshell);
-
-	if(XtIsManaged(wswitch))
-		XmProcessTraversal(wswitch, XmTRAVERSE_CURRENT);
+	
+	#ifdef DEBUG_MENU
+	{
+		struct timespec now;
+		
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		printf("Startup: mapped in %.1f ms\n",
+			(now.tv_sec - startup_time.tv_sec) * 1000.0 +
+			(now.tv_nsec - startup_time.tv_nsec) / 1000000.0);
+	}
+	#endif
+	
+	/* the rest is built once the menu is up and X is idle */
+	XtAppAddWorkProc(app_context, startup_proc, NULL);
 
 	XSelectInput(XtDisplay(wshell), root_window, root_event_mask);
 	
 	xt_sigusr1 = XtAppAddSignal(app_context, xt_sigusr1_handler, NULL);
+	if(app_res.auto_reload) watch_rc_files();
 	
 	for(;;) {
 		XEvent evt;
@@ -331,6 +687,27 @@ int main(int argc, char **argv)
 	return 0;
 }
 
+/*
+ * Figures out the rc file from the command line or the default locations,
+ * and starts parsing it on a worker thread. If the rcFile resource turns
+ * out to specify another file, the result is simply discarded.
+ */
+static void start_parse_thread(int argc, char **argv)
+{
+	early_parse.path = get_rc_file(argc, argv);
+	if(!early_parse.path) return;
+	
+	if(pthread_create(&early_parse.thread, NULL,
+		parse_thread_proc, NULL) == 0) early_parse.pending = True;
+}
+
+static void* parse_thread_proc(void *arg)
+{
+	early_parse.err = tb_load_config(parser,
+		early_parse.path, &early_parse.menu);
+	return NULL;
+}
+
 static void set_icon(Widget wshell)
 {
 	Pixmap image;
@@ -383,9 +760,25 @@ static void set_ws_presence(Widget wshell)
 }
 
 /*
- * Parse the specified hotkey combination, grab the key and attach a callback.
+ * Grabs the hotkeys specified, if any. Returns True if any was grabbed.
  */
 static Boolean setup_hotkeys(void)
+{
+	Boolean grabbed = False;
+	
+	if(grab_hotkey(app_res.hotkey, &hotkey_code, &hotkey_mods))
+		grabbed = True;
+	if(grab_hotkey(app_res.palette_hotkey,
+		&palette_key_code, &palette_key_mods)) grabbed = True;
+	
+	return grabbed;
+}
+
+/*
+ * Parse the specified hotkey combination and grab the key.
+ */
+static Boolean grab_hotkey(const char *spec,
+	KeyCode *key_code, unsigned int *key_mods)
 {
 	Window root_window;
 	char *buf;
@@ -393,22 +786,22 @@ static Boolean setup_hotkeys(void)
 	KeySym key_sym = NoSymbol;
 	static int (*def_x_err_handler)(Display*, XErrorEvent*) = NULL;
 	
-	if(!app_res.hotkey || !strcasecmp(app_res.hotkey, "none")) return False;
+	if(!spec || !strcasecmp(spec, "none")) return False;
 
-	hotkey_code = 0;
-	hotkey_mods = 0;
+	*key_code = 0;
+	*key_mods = 0;
 
-	buf=strdup(app_res.hotkey);	
+	buf=strdup(spec);	
 	token=strtok(buf," \t+");
 	if(token){
 		while(token){
 			if(!strcasecmp(token, "alt")){
-				hotkey_mods |= Mod1Mask;
+				*key_mods |= Mod1Mask;
 			}else if(!strcasecmp(token, "ctrl") ||
 				!strcasecmp(token, "control")){
-				hotkey_mods |= ControlMask;
+				*key_mods |= ControlMask;
 			}else if(!strcasecmp(token, "shift")){
-				hotkey_mods |= ShiftMask;
+				*key_mods |= ShiftMask;
 			}else{
 				key_sym = XStringToKeysym(token);
 				break;
@@ -424,20 +817,20 @@ static Boolean setup_hotkeys(void)
 		fputs("Invalid hotkey specification\n", stderr);
 		return False;
 	}
-	hotkey_code = XKeysymToKeycode(XtDisplay(wshell), key_sym);
+	*key_code = XKeysymToKeycode(XtDisplay(wshell), key_sym);
 	
 	root_window = RootWindowOfScreen(XtScreen(wshell));
 	
 	XSync(XtDisplay(wshell), False);
 	def_x_err_handler = XSetErrorHandler(xgrabkey_err_handler);
 	
-	XGrabKey(XtDisplay(wshell), hotkey_code, hotkey_mods,
+	XGrabKey(XtDisplay(wshell), *key_code, *key_mods,
 		root_window, False, GrabModeAsync, GrabModeAsync);
-	XGrabKey(XtDisplay(wshell), hotkey_code, hotkey_mods | Mod2Mask,
+	XGrabKey(XtDisplay(wshell), *key_code, *key_mods | Mod2Mask,
 		root_window, False, GrabModeAsync, GrabModeAsync);
-	XGrabKey(XtDisplay(wshell), hotkey_code, hotkey_mods | LockMask,
+	XGrabKey(XtDisplay(wshell), *key_code, *key_mods | LockMask,
 		root_window, False, GrabModeAsync, GrabModeAsync);
-	XGrabKey(XtDisplay(wshell), hotkey_code, hotkey_mods | LockMask | Mod2Mask,
+	XGrabKey(XtDisplay(wshell), *key_code, *key_mods | LockMask | Mod2Mask,
 		root_window, False, GrabModeAsync, GrabModeAsync);	
 	
 	XSync(XtDisplay(wshell), False);
@@ -469,13 +862,21 @@ static void handle_root_event(XEvent *evt)
 	if(evt->type == KeyRelease) {
 		XKeyEvent *e = (XKeyEvent*)evt;
 	
-		if(e->keycode == hotkey_code &&
-			((e->state & hotkey_mods) || !hotkey_mods))
+		if(palette_key_code && e->keycode == palette_key_code &&
+			(e->state & (ShiftMask | ControlMask | Mod1Mask)) ==
+			palette_key_mods) {
+			show_palette();
+		} else if(e->keycode == hotkey_code &&
+			((e->state & hotkey_mods) || !hotkey_mods)) {
 				raise_and_focus(wshell);
+		}
 
 	} else if(evt->type == PropertyNotify) {
 		XPropertyEvent *e = (XPropertyEvent*)evt;
 
+		/* the switcher queries these as it's created */
+		if(!wswitch) return;
+		
 		if((e->atom == xa_cdesk || e->atom == xa_ndesks) && app_res.switcher) {
 			unsigned short nws, iws;
 			if(get_ws_info(&nws, &iws)) {
@@ -578,40 +979,70 @@ void raise_and_focus(Widget w)
 }
 
 /*
- * Build menu structure from the rc file
+ * Build menu structure from the rc file. If it's already there, i.e. the
+ * file is being reloaded, only items that changed are updated.
  */
 static Boolean construct_menu(void)
 {
 	Arg args[10];
 	int n = 0;
-	Widget *wlevel;
-	unsigned int nlevels=1;
-	struct tb_entry *entries, *cur;
+	const struct tb_menu *menu;
+	struct tb_parser *p = parser;
 	int err;
 
-	if((err=tb_parse_config(rc_file_path, &entries))){
+	/* on reload; one may have been created since the built-in menu
+	 * was shown */
+	if(!rc_file_path && wmenu) rc_file_path = find_rc_file();
+
+	if(wmenu && !reload_parser && !(reload_parser = tb_parser_create())) {
+		perror("malloc");
+		return False;
+	}
+	if(wmenu) p = reload_parser;
+
+	if(!rc_file_path) {
+		err = 0;
+		menu = &tb_default_menu;
+	} else if(early_parse.pending) {
+		pthread_join(early_parse.thread, NULL);
+		early_parse.pending = False;
+		
+		if(strcmp(early_parse.path, rc_file_path)) {
+			err = tb_load_config(parser, rc_file_path, &menu);
+		} else {
+			err = early_parse.err;
+			menu = early_parse.menu;
+		}
+	} else {
+		err = tb_load_config(p, rc_file_path, &menu);
+	}
+
+	if(err){
 		report_rcfile_error(rc_file_path,
-			tb_parser_error_string() ?
-			tb_parser_error_string() : strerror(err));
+			tb_parser_error(p) ?
+			tb_parser_error(p) : strerror(err));
 		return False;
 	}
 
-	if(!entries){
+	if(!menu->count){
 		report_rcfile_error(rc_file_path,
 			"File doesn't seem to contain any entries.");
 		return False;
 	}
 	
-	cur = entries;
-	
-	while(cur){
-		nlevels = (cur->level > nlevels) ? cur->level : nlevels;
-		cur = cur->next;
-	}
+	/* commands are resolved against the current PATH as items are made */
+	tb_path_update();
+	palette_stale = True;
 	
 	if(wmenu){
-		XtUnmanageChild(wmenu);
-		XtDestroyWidget(wmenu);
+		Boolean ok = sync_menu_items(wmenu, menu_shown, menu, 0);
+		
+		/* entries of the previous menu are no longer referred to */
+		menu_shown = menu;
+		reload_parser = parser;
+		parser = p;
+		tb_parser_release(reload_parser);
+		return ok;
 	}
 	
 	n = 0;
@@ -629,190 +1060,2011 @@ static Boolean construct_menu(void)
 	wmenu = XmCreateRowColumn(wmain, "menu", args, n);
 
 	#ifdef DEBUG_MENU
-	printf("Max %d cascade levels\n",nlevels);
+	printf("%u entries, max %d cascade levels\n",
+		menu->count, menu->max_level + 1);
 	#endif
 
-	wlevel = calloc(nlevels + 1, sizeof(Widget));
-	if(!wlevel){
+	menu_shown = menu;
+	if(!create_menu_items(wmenu, menu, 0)) return False;
+	
+	XtManageChild(wmenu);
+	
+	return True;
+}
+
+/*
+ * Creates menu gadgets in wparent for the entry at index 'first' and its
+ * siblings following it, along with pulldowns for their sub-trees.
+ * Gadgets are managed all at once, so that the RowColumn lays itself out
+ * once per menu rather than once per item.
+ */
+static Boolean create_menu_items(Widget wparent,
+	const struct tb_menu *menu, int first)
+{
+	WidgetList items;
+	Cardinal nitems = 0;
+	Boolean ok = True;
+	int i;
+	
+	for(i = first; i != -1; i = menu->entries[i].sibling) nitems++;
+	if(!nitems) return True;
+	
+	if(!(items = malloc(nitems * sizeof(Widget)))) {
 		perror("malloc");
 		return False;
 	}
 	
-	cur = entries;
-	wlevel[0] = wmenu;
-	
-	while(cur){
-		Widget w;
-		XmString title;
+	nitems = 0;
+	for(i = first; i != -1; i = menu->entries[i].sibling){
+		if(!create_menu_item(wparent, menu, i, &items[nitems])) {
+			ok = False;
+			break;
+		}
+		if(items[nitems]) nitems++;
+	}
+	if(nitems) XtManageChildren(items, nitems);
+	free(items);
+	return ok;
+}
 
-		if(cur->type == TBE_CASCADE && cur->next){
-			Widget new_pulldown, new_cascade;
-			
-			#ifdef DEBUG_MENU
-			printf("Adding Cascade: %s; Level: %d\n",cur->title,cur->level);
-			#endif
-			new_pulldown=XmCreatePulldownMenu(
-				wlevel[cur->level],"commandPulldown",NULL,0);
-			
-			title=XmStringCreateLocalized(cur->title);
-			
-			n = 0;
-			XtSetArg(args[n], XmNlabelString, title); n++;
-			XtSetArg(args[n], XmNmnemonic, (KeySym)cur->mnemonic); n++;
-			XtSetArg(args[n], XmNsubMenuId, new_pulldown); n++;
-			new_cascade = XmCreateCascadeButtonGadget(
-				wlevel[cur->level],"cascadeButton",args,n);
-			
-			XmStringFree(title);
+/*
+ * Creates an unmanaged gadget for the entry at 'index' in *item, or sets
+ * it to None if the entry has none. The gadget's XmNuserData identifies
+ * the entry; for commands it holds menu_command state, which does.
+ * Returns False if out of memory.
+ */
+static Boolean create_menu_item(Widget wparent,
+	const struct tb_menu *menu, int index, Widget *item)
+{
+	const struct tb_entry *cur = &menu->entries[index];
+	XtPointer entry_data = (XtPointer)(intptr_t)(index + 1);
+	Arg args[10];
+	int n = 0;
+	int errval;
+	Widget w = None;
+	XmString title;
+	
+	if(cur->type == TBE_CASCADE && cur->nchildren){
+		Widget new_pulldown;
+		XtCallbackRec cascading_callback[]={
+			{ (XtCallbackProc)menu_cascading_cb, NULL},
+			{ (XtCallbackProc)NULL, (XtPointer)NULL}
+		};
 		
-			wlevel[cur->next->level] = new_pulldown;
-						
-			XtManageChild(new_cascade);
+		#ifdef DEBUG_MENU
+		printf("Adding Cascade: %s; Level: %d\n",cur->title,cur->level);
+		#endif
+		/* items are created when the pulldown is first posted;
+		 * children immediately follow their parent */
+		n = 0;
+		XtSetArg(args[n], XmNuserData, (XtPointer)(intptr_t)(index + 1)); n++;
+		new_pulldown=XmCreatePulldownMenu(
+			wparent,"commandPulldown",args,n);
 		
-		}else if(cur->type == TBE_COMMAND){
-			XtCallbackRec push_callback[]={
-				{ (XtCallbackProc)menu_command_cb, (XtPointer)cur->command},
-				{ (XtCallbackProc)NULL, (XtPointer)NULL}
-			};
-			#ifdef DEBUG_MENU
-			printf("Adding Command: %s; Level: %d\n",cur->title,cur->level);
-			#endif
-			
-			title=XmStringCreateLocalized(cur->title);
-
-			n = 0;
-			XtSetArg(args[n], XmNlabelString, title); n++;
-			if(cur->mnemonic){
-				XtSetArg(args[n], XmNmnemonic, (KeySym)cur->mnemonic);
-				n++;
-			}
-			XtSetArg(args[n], XmNactivateCallback, push_callback); n++;
-			w = XmCreatePushButtonGadget(
-				wlevel[cur->level], "menuButton",args,n);
+		title=xmstr_get(cur->title);
+		
+		cascading_callback[0].closure = (XtPointer)menu;
 
-			XmStringFree(title);
-			XtManageChild(w);
+		n = 0;
+		XtSetArg(args[n], XmNlabelString, title); n++;
+		XtSetArg(args[n], XmNmnemonic, (KeySym)cur->mnemonic); n++;
+		XtSetArg(args[n], XmNsubMenuId, new_pulldown); n++;
+		XtSetArg(args[n], XmNcascadingCallback, cascading_callback); n++;
+		XtSetArg(args[n], XmNuserData, entry_data); n++;
+		w = XmCreateCascadeButtonGadget(
+			wparent,"cascadeButton",args,n);
+		
+		xmstr_release(title);
+	
+	}else if(cur->type == TBE_PIPE){
+		#ifdef DEBUG_MENU
+		printf("Adding Pipe: %s; Level: %d\n",cur->title,cur->level);
+		#endif
+		w = create_pipe_menu(wparent, cur);
+
+	}else if(cur->type == TBE_DIRECTORY){
+		char *path;
+		#ifdef DEBUG_MENU
+		printf("Adding Directory: %s; Level: %d\n",
+			cur->title,cur->level);
+		#endif
+		if((errval = expand_env_vars(cur->command, &path))) {
+			fprintf(stderr, "%s: %s\n", cur->command, strerror(errval));
+		} else {
+			w = create_dir_menu(wparent, cur->title,
+				(KeySym)cur->mnemonic, path, 0);
+			free(path);
+		}
 
-		}else if(cur->type == TBE_SEPARATOR){
-			w = XmCreateSeparatorGadget(
-				wlevel[cur->level], "separator", NULL, 0);
+	}else if(cur->type == TBE_APPLICATIONS){
+		#ifdef DEBUG_MENU
+		printf("Adding Applications: %s; Level: %d\n",
+			cur->title,cur->level);
+		#endif
+		w = create_apps_menu(wparent, cur);
+
+	}else if(cur->type == TBE_COMMAND){
+		struct menu_command *mc;
+		#ifdef DEBUG_MENU
+		printf("Adding Command: %s; Level: %d\n",cur->title,cur->level);
+		#endif
+		
+		if(!(mc = calloc(1, sizeof(struct menu_command)))) {
+			perror("calloc");
+			return False;
+		}
+		mc->cmd.in = cur->command;
+		mc->entry = index;
+		mc->title = cur->title;
+		
+		title=xmstr_get(cur->title);
 
-			XtManageChild(w);
+		n = 0;
+		XtSetArg(args[n], XmNlabelString, title); n++;
+		if(cur->mnemonic){
+			XtSetArg(args[n], XmNmnemonic, (KeySym)cur->mnemonic);
+			n++;
 		}
-		cur = cur->next;
+		XtSetArg(args[n], XmNuserData, (XtPointer)mc); n++;
+		w = create_menu_button(wparent, args, n);
+		add_item_callback(w, XmNactivateCallback,
+			menu_command_cb, (XtPointer)mc);
+		add_item_callback(w, XmNdestroyCallback,
+			menu_command_destroy_cb, (XtPointer)mc);
+
+		xmstr_release(title);
+		
+		/* commands that can't be found are shown as unavailable */
+		errval = prepare_command(mc);
+		if(errval == ENOENT || errval == EACCES)
+			XtSetSensitive(w, False);
+
+	}else if(cur->type == TBE_SEPARATOR){
+		XtSetArg(args[n], XmNuserData, entry_data); n++;
+		w = create_menu_separator(wparent, args, n);
 	}
-
-	free(wlevel);
 	
-	XtManageChild(wmenu);
+	/* these are created by helpers used for other cascades as well */
+	if(w && (cur->type == TBE_PIPE || cur->type == TBE_DIRECTORY ||
+		cur->type == TBE_APPLICATIONS))
+		XtVaSetValues(w, XmNuserData, entry_data, NULL);
+	
+	if(w && cur->icon) set_item_icon(w, cur->icon);
 	
+	*item = w;
 	return True;
 }
 
-static void report_rcfile_error(const char *rc_file, const char *err_desc)
+/*
+ * Returns index of the entry a gadget made by create_menu_item
+ * was created from, or -1 if it wasn't made by it.
+ */
+static int menu_item_entry(Widget w)
 {
-	char *buffer;
-	char err_msg[]="Error while parsing RC file:";
-	size_t msg_len;
+	XtPointer data = NULL;
+	
+	XtVaGetValues(w, XmNuserData, &data, NULL);
+	if(!data) return -1;
+	
+	if(XtIsSubclass(w, xmPushButtonGadgetClass))
+		return ((struct menu_command*)data)->entry;
+	return (int)(intptr_t)data - 1;
+}
 
-	msg_len=strlen(err_msg)+strlen(err_desc)+strlen(rc_file)+10;
-	buffer=malloc(msg_len);
-	if(!buffer){
+/*
+ * Brings items of a pulldown, created from entries of the 'old' menu, up
+ * to date with the sibling chain at 'first' in the 'new' one. Items are
+ * matched by type and title (their path being that of the pulldown);
+ * matched ones are updated in place, and only those added or removed are
+ * created or removed. Removed items are pooled before new ones are made,
+ * so that these can reuse the gadgets. New items are created unmanaged,
+ * and managed all at once when in place. Pulldowns that were never posted
+ * only have their entry references updated, so the cost is proportional
+ * to the number of items shown before, and changes made.
+ */
+static Boolean sync_menu_items(Widget wparent,
+	const struct tb_menu *old, const struct tb_menu *new, int first)
+{
+	WidgetList children;
+	Cardinal nchildren;
+	Widget *items, *result, *created;
+	int *old_index;
+	Boolean *matched;
+	Cardinal i, k, nitems, ncreated = 0;
+	Cardinal last = 0, count = 0, pos = 0;
+	Boolean ok = True;
+	int j;
+	
+	XtVaGetValues(wparent, XmNchildren, &children,
+		XmNnumChildren, &nchildren, NULL);
+	
+	for(j = first; j != -1; j = new->entries[j].sibling) count++;
+	
+	/* the child list changes as items are created and destroyed */
+	nitems = nchildren;
+	items = malloc(sizeof(Widget) * (nitems + 1));
+	old_index = malloc(sizeof(int) * (nitems + 1));
+	matched = calloc(nitems + 1, sizeof(Boolean));
+	result = calloc(count + 1, sizeof(Widget));
+	created = malloc(sizeof(Widget) * (count + 1));
+	if(!items || !old_index || !matched || !result || !created) {
 		perror("malloc");
-		return;
+		free(items);
+		free(old_index);
+		free(matched);
+		free(result);
+		free(created);
+		return False;
 	}
-
-	sprintf(buffer,"%s %s\n%s.",err_msg,rc_file,err_desc);
-	message_dialog(False,buffer);
-	free(buffer);
+	
+	/* unmanaged ones are pooled gadgets */
+	for(i = 0, nitems = 0; i < nchildren; i++) {
+		if(!XtIsManaged(children[i])) continue;
+		items[nitems] = children[i];
+		old_index[nitems++] = menu_item_entry(children[i]);
+	}
+	
+	for(j = first, i = 0; j != -1; j = new->entries[j].sibling, i++) {
+		const struct tb_entry *ent = &new->entries[j];
+		
+		if(ent->type == TBE_CASCADE && !ent->nchildren) continue;
+		
+		/* items usually stay in order, so look past the last match first */
+		for(k = 0; k < nitems; k++) {
+			Cardinal ik = (last + k) % nitems;
+			const struct tb_entry *old_ent;
+			
+			if(matched[ik] || old_index[ik] < 0) continue;
+			old_ent = &old->entries[old_index[ik]];
+			if(old_ent->type != ent->type) continue;
+			if(ent->type != TBE_SEPARATOR &&
+				strcmp(old_ent->title, ent->title)) continue;
+			
+			if(update_menu_item(items[ik], old_ent, old, new, j)) {
+				matched[ik] = True;
+				result[i] = items[ik];
+				last = ik + 1;
+			}
+			break;
+		}
+	}
+	
+	for(i = 0, k = 0; i < nitems; i++) {
+		if(!matched[i]) items[k++] = items[i];
+	}
+	remove_menu_items(items, k);
+	
+	for(j = first, i = 0; j != -1; j = new->entries[j].sibling, i++) {
+		const struct tb_entry *ent = &new->entries[j];
+		
+		if(result[i] || (ent->type == TBE_CASCADE && !ent->nchildren))
+			continue;
+		
+		if(!create_menu_item(wparent, new, j, &result[i])) {
+			ok = False;
+			break;
+		}
+		if(result[i]) created[ncreated++] = result[i];
+	}
+	
+	/* place items in order of their entries; pooled and destroyed ones
+	 * (until the end of the event dispatch) remain in the child list */
+	for(i = 0; i < count; i++) {
+		short cur_pos = -1;
+		
+		if(!result[i]) continue;
+		XtVaGetValues(result[i], XmNpositionIndex, &cur_pos, NULL);
+		if(cur_pos != pos)
+			XtVaSetValues(result[i], XmNpositionIndex, (int)pos, NULL);
+		pos++;
+	}
+	if(ncreated) XtManageChildren(created, ncreated);
+	
+	free(items);
+	free(old_index);
+	free(matched);
+	free(result);
+	free(created);
+	return ok;
 }
 
-static void create_utility_widgets(Widget wparent)
+/*
+ * Updates an item matched by title to the new entry at 'index'. Returns
+ * False if it has to be replaced instead, i.e. a generated cascade whose
+ * command changed, or an item whose icon changed.
+ */
+static Boolean update_menu_item(Widget w, const struct tb_entry *old_ent,
+	const struct tb_menu *old, const struct tb_menu *new, int index)
 {
-	XtCallbackRec cbr[2] = { { NULL, NULL } };
-	Widget wmenu;
-	Widget wpulldown;
-	Widget wcascade;
-	Widget w;
-	XmString title;
-	unsigned short nws = 0;
-	unsigned short iws = 0;
-	Arg args[10];
-	int n;
+	const struct tb_entry *ent = &new->entries[index];
+	XtPointer entry_data = (XtPointer)(intptr_t)(index + 1);
 	
-	XtSetArg(args[0], XmNorientation,
-		(app_res.horizontal ? XmVERTICAL:XmHORIZONTAL));
-	w = XmCreateSeparatorGadget(wparent, "separator", args, 1);
-	if(app_res.separators) XtManageChild(w);
+	if((old_ent->icon || ent->icon) && (!old_ent->icon || !ent->icon ||
+		strcmp(old_ent->icon, ent->icon))) return False;
 	
-	/* 'Session' menu */
-	n = 0;
-	XtSetArg(args[n], XmNshadowThickness, 0); n++;
-	XtSetArg(args[n], XmNspacing, 1); n++;
-	XtSetArg(args[n], XmNmarginWidth, 0); n++;
-	XtSetArg(args[n], XmNorientation,
-		(app_res.horizontal ? XmHORIZONTAL:XmVERTICAL)); n++;
-	XtSetArg(args[n], XmNrowColumnType, XmMENU_BAR); n++;
-	wmenu = XmCreateRowColumn(wparent, "menu", args, n);
+	if(ent->type == TBE_PIPE) {
+		if(strcmp(old_ent->command, ent->command) ||
+			old_ent->ttl != ent->ttl) return False;
+	} else if(ent->type == TBE_DIRECTORY) {
+		if(strcmp(old_ent->command, ent->command)) return False;
+	}
 	
-	wpulldown = XmCreatePulldownMenu(wmenu,"sessionPulldown",NULL,0);
+	if(old_ent->mnemonic != ent->mnemonic)
+		XtVaSetValues(w, XmNmnemonic, (KeySym)ent->mnemonic, NULL);
+	
+	if(ent->type == TBE_COMMAND) {
+		struct menu_command *mc = NULL;
+		int errval;
+		
+		XtVaGetValues(w, XmNuserData, &mc, NULL);
+		mc->entry = index;
+		mc->title = ent->title;
+		
+		if(strcmp(mc->cmd.in, ent->command)) {
+			free_env_memo(&mc->cmd);
+			free(mc->str);
+			free(mc->argv);
+			memset(mc, 0, sizeof(struct menu_command));
+			mc->entry = index;
+			mc->title = ent->title;
+			mc->cmd.in = ent->command;
 			
-	title = XmStringCreateLocalized("Session");
-	n=0;
-	XtSetArg(args[n], XmNlabelString, title); n++;
-	XtSetArg(args[n], XmNmnemonic, (KeySym)'S'); n++;
-	XtSetArg(args[n], XmNsubMenuId, wpulldown); n++;
-	wcascade = XmCreateCascadeButtonGadget(wmenu, "session", args, n);
-	XmStringFree(title);
-	XtManageChild(wcascade);
+			errval = prepare_command(mc);
+			XtSetSensitive(w, (errval != ENOENT && errval != EACCES));
+		} else {
+			/* same string; keep the memoized expansion */
+			mc->cmd.in = ent->command;
+		}
+	} else if(ent->type == TBE_CASCADE) {
+		Widget wpulldown = None;
+		XtPointer first = NULL;
+		Cardinal nchildren = 0;
 		
-	n = 0;
-	cbr[0].callback = exec_cb;
-	title=XmStringCreateLocalized("Execute...");
-	XtSetArg(args[n], XmNlabelString, title); n++;
-	XtSetArg(args[n], XmNmnemonic, (KeySym)'E'); n++;
-	XtSetArg(args[n], XmNactivateCallback, cbr); n++;
-	w = XmCreatePushButtonGadget(wpulldown, "execute", args, n);
-	XmStringFree(title);
-	XtManageChild(w);
+		XtVaGetValues(w, XmNsubMenuId, &wpulldown, NULL);
+		XtVaGetValues(wpulldown, XmNuserData, &first,
+			XmNnumChildren, &nchildren, NULL);
+		
+		XtRemoveAllCallbacks(w, XmNcascadingCallback);
+		XtAddCallback(w, XmNcascadingCallback,
+			menu_cascading_cb, (XtPointer)new);
+		XtVaSetValues(w, XmNuserData, entry_data, NULL);
+		XtVaSetValues(wpulldown, XmNuserData, entry_data, NULL);
+		
+		if(nchildren) sync_menu_items(wpulldown, old, new, index + 1);
+	} else {
+		XtVaSetValues(w, XmNuserData, entry_data, NULL);
+	}
+	return True;
+}
 
-	w = XmCreateSeparatorGadget(wpulldown,"separator",NULL,0);
-	XtManageChild(w);
+/*
+ * Removes all items from a pulldown, see remove_menu_items()
+ */
+static void clear_menu_items(Widget wpulldown)
+{
+	WidgetList children;
+	WidgetList items;
+	Cardinal i, nchildren, nitems = 0;
+
+	XtVaGetValues(wpulldown, XmNchildren, &children,
+		XmNnumChildren, &nchildren, NULL);
+	if(!nchildren) return;
+	
+	/* the child list changes as items are destroyed */
+	if(!(items = malloc(sizeof(Widget) * nchildren))) {
+		perror("malloc");
+		return;
+	}
+	/* unmanaged ones are pooled gadgets */
+	for(i = 0; i < nchildren; i++) {
+		if(XtIsManaged(children[i])) items[nitems++] = children[i];
+	}
+	remove_menu_items(items, nitems);
+	free(items);
+}
+
+/*
+ * Removes items (children of the same pulldown) from the menu. Buttons
+ * and separators are unmanaged, stripped of the callbacks and state they
+ * were given by add_item_callback, and kept in the pulldown's gadget pool
+ * for create_menu_button/separator to reuse.
+ * Anything else is destroyed, along with its sub-menu if it's a cascade.
+ * Pooled gadgets that aren't reused are destroyed later on, when idle.
+ */
+static void remove_menu_items(WidgetList items, Cardinal count)
+{
+	struct gadget_pool *pool;
+	Cardinal i;
+	
+	if(!count) return;
+	XtUnmanageChildren(items, count);
+	
+	for(i = 0; i < count; i++) {
+		Widget w = items[i];
+		Widget wsubmenu = None;
+		struct gadget_list *list = NULL;
+		
+		if(XtIsSubclass(w, xmCascadeButtonGadgetClass)) {
+			XtVaGetValues(w, XmNsubMenuId, &wsubmenu, NULL);
+			if(wsubmenu) XtDestroyWidget(wsubmenu);
+		} else if(XtIsSubclass(w, xmPushButtonGadgetClass) &&
+			!strcmp(XtName(w), "menuButton")) {
+			if((pool = get_gadget_pool(XtParent(w), True)))
+				list = &pool->buttons;
+		} else if(XtIsSubclass(w, xmSeparatorGadgetClass)) {
+			if((pool = get_gadget_pool(XtParent(w), True)))
+				list = &pool->separators;
+		}
+		
+		if(!list || !release_item_callbacks(w) || !pool_gadget(list, w)) {
+			XtDestroyWidget(w);
+			continue;
+		}
+		
+		if(list == &pool->buttons) {
+			XtVaSetValues(w, XmNuserData, NULL, XmNmnemonic, NoSymbol,
+				XmNsensitive, True, XmNlabelType, XmSTRING, NULL);
+		} else {
+			XtVaSetValues(w, XmNuserData, NULL, NULL);
+		}
+	}
+	
+	if(gadget_pools && !pool_trim_timer && !pool_trim_work) {
+		pool_trim_timer = XtAppAddTimeOut(app_context,
+			POOL_TRIM_INTERVAL, pool_trim_timer_cb, NULL);
+	}
+}
+
+/*
+ * Adds a callback to a menu item, and records it for release_item_callbacks.
+ * Destroy callbacks added this way must only free state of the item.
+ */
+static void add_item_callback(Widget w, String name,
+	XtCallbackProc proc, XtPointer closure)
+{
+	struct item_callbacks *ic = NULL;
+	
+	XtAddCallback(w, name, proc, closure);
+	
+	if(!item_callbacks_context) item_callbacks_context = XUniqueContext();
+	
+	if(XFindContext(XtDisplay(w), (XID)w,
+		item_callbacks_context, (XPointer*)&ic)) {
+		if(!(ic = calloc(1, sizeof(struct item_callbacks)))) {
+			perror("calloc");
+			return;
+		}
+		if(XSaveContext(XtDisplay(w), (XID)w,
+			item_callbacks_context, (XPointer)ic)) {
+			free(ic);
+			return;
+		}
+		XtAddCallback(w, XmNdestroyCallback,
+			item_callbacks_destroy_cb, (XtPointer)ic);
+	}
+	
+	if(ic->count == MAX_ITEM_CALLBACKS) {
+		ic->overflow = True;
+		return;
+	}
+	ic->cb[ic->count].name = name;
+	ic->cb[ic->count].proc = proc;
+	ic->cb[ic->count].closure = closure;
+	ic->count++;
+}
+
+/*
+ * Removes a callback added with add_item_callback
+ */
+static void remove_item_callback(Widget w, String name,
+	XtCallbackProc proc, XtPointer closure)
+{
+	struct item_callbacks *ic = NULL;
+	Cardinal i;
+	
+	XtRemoveCallback(w, name, proc, closure);
+	
+	if(!item_callbacks_context || XFindContext(XtDisplay(w), (XID)w,
+		item_callbacks_context, (XPointer*)&ic)) return;
+	
+	for(i = 0; i < ic->count; i++) {
+		if(ic->cb[i].proc == proc && ic->cb[i].closure == closure &&
+			!strcmp(ic->cb[i].name, name)) {
+			memmove(&ic->cb[i], &ic->cb[i + 1],
+				(ic->count - i - 1) * sizeof(ic->cb[0]));
+			ic->count--;
+			break;
+		}
+	}
+}
+
+/*
+ * Removes callbacks the item was attached with by add_item_callback, and
+ * calls the destroy ones among them to free its state, so that the gadget
+ * can be pooled. Returns False if the item may have callbacks that weren't
+ * recorded, in which case it must be destroyed instead.
+ */
+static Boolean release_item_callbacks(Widget w)
+{
+	struct item_callbacks *ic = NULL;
+	Cardinal i;
+	
+	if(!item_callbacks_context || XFindContext(XtDisplay(w), (XID)w,
+		item_callbacks_context, (XPointer*)&ic)) {
+		return (XtHasCallbacks(w, XmNactivateCallback) !=
+			XtCallbackHasSome);
+	}
+	if(ic->overflow) return False;
+	
+	for(i = 0; i < ic->count; i++) {
+		XtRemoveCallback(w, ic->cb[i].name,
+			ic->cb[i].proc, ic->cb[i].closure);
+	}
+	
+	for(i = 0; i < ic->count; i++) {
+		if(!strcmp(ic->cb[i].name, XmNdestroyCallback))
+			ic->cb[i].proc(w, ic->cb[i].closure, NULL);
+	}
+	/* the record itself stays with the gadget for its next use */
+	ic->count = 0;
+	return True;
+}
+
+static void item_callbacks_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	XDeleteContext(XtDisplay(w), (XID)w, item_callbacks_context);
+	free(client_data);
+}
+
+/*
+ * Creates an unmanaged menu push button gadget in wpulldown,
+ * or takes one from the pulldown's gadget pool.
+ */
+static Widget create_menu_button(Widget wpulldown, ArgList args, Cardinal n)
+{
+	struct gadget_pool *pool = get_gadget_pool(wpulldown, False);
+	Widget w;
+	
+	if(pool && (w = take_pooled_gadget(&pool->buttons))) {
+		XtSetValues(w, args, n);
+		return w;
+	}
+	return XmCreatePushButtonGadget(wpulldown, "menuButton", args, n);
+}
+
+/*
+ * Creates an unmanaged separator gadget in wpulldown,
+ * or takes one from the pulldown's gadget pool.
+ */
+static Widget create_menu_separator(Widget wpulldown, ArgList args, Cardinal n)
+{
+	struct gadget_pool *pool = get_gadget_pool(wpulldown, False);
+	Widget w;
+	
+	if(pool && (w = take_pooled_gadget(&pool->separators))) {
+		XtSetValues(w, args, n);
+		return w;
+	}
+	return XmCreateSeparatorGadget(wpulldown, "separator", args, n);
+}
+
+/*
+ * Returns the gadget pool of a pulldown. If it has none, one is created
+ * if 'create' is True, otherwise NULL is returned.
+ */
+static struct gadget_pool* get_gadget_pool(Widget wpulldown, Boolean create)
+{
+	struct gadget_pool *pool = NULL;
+	
+	if(!gadget_pool_context) gadget_pool_context = XUniqueContext();
+	
+	if(!XFindContext(XtDisplay(wpulldown), (XID)wpulldown,
+		gadget_pool_context, (XPointer*)&pool)) return pool;
+	if(!create) return NULL;
+	
+	if(!(pool = calloc(1, sizeof(struct gadget_pool)))) {
+		perror("calloc");
+		return NULL;
+	}
+	if(XSaveContext(XtDisplay(wpulldown), (XID)wpulldown,
+		gadget_pool_context, (XPointer)pool)) {
+		free(pool);
+		return NULL;
+	}
+	pool->wpulldown = wpulldown;
+	pool->next = gadget_pools;
+	gadget_pools = pool;
+	XtAddCallback(wpulldown, XmNdestroyCallback,
+		gadget_pool_destroy_cb, (XtPointer)pool);
+	return pool;
+}
+
+/* Adds a gadget to the list. Returns False if out of memory. */
+static Boolean pool_gadget(struct gadget_list *list, Widget w)
+{
+	if(list->count == list->size) {
+		Cardinal size = list->size ? list->size * 2 : 16;
+		WidgetList items;
+		
+		items = realloc(list->items, sizeof(Widget) * size);
+		if(!items) return False;
+		list->items = items;
+		list->size = size;
+	}
+	list->items[list->count++] = w;
+	return True;
+}
+
+/*
+ * Takes a gadget off the list, moving it to the end of its parent's
+ * children. Returns None if the list is empty.
+ */
+static Widget take_pooled_gadget(struct gadget_list *list)
+{
+	Widget w;
+	
+	if(!list->count) return None;
+	w = list->items[--list->count];
+	if(list->count < list->low_count) list->low_count = list->count;
+	if(list->trim > list->count) list->trim = list->count;
+	
+	XtVaSetValues(w, XmNpositionIndex, XmLAST_POSITION, NULL);
+	return w;
+}
+
+static void gadget_pool_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct gadget_pool *pool = (struct gadget_pool*)client_data;
+	struct gadget_pool **link = &gadget_pools;
+	
+	while(*link != pool) link = &(*link)->next;
+	*link = pool->next;
+	
+	XDeleteContext(XtDisplay(w), (XID)w, gadget_pool_context);
+	free(pool->buttons.items);
+	free(pool->separators.items);
+	free(pool);
+}
+
+/*
+ * Schedules destruction of pooled gadgets that weren't needed since the
+ * last check, and starts another check if any others remain pooled.
+ */
+static void pool_trim_timer_cb(XtPointer client_data, XtIntervalId *id)
+{
+	struct gadget_pool *pool;
+	Boolean trim = False;
+	
+	pool_trim_timer = 0;
+	
+	for(pool = gadget_pools; pool; pool = pool->next) {
+		pool->buttons.trim = pool->buttons.low_count;
+		pool->separators.trim = pool->separators.low_count;
+		if(pool->buttons.trim || pool->separators.trim) trim = True;
+		pool->buttons.low_count = pool->buttons.count;
+		pool->separators.low_count = pool->separators.count;
+	}
+	
+	if(trim) {
+		pool_trim_work = XtAppAddWorkProc(app_context,
+			pool_trim_proc, NULL);
+	} else {
+		for(pool = gadget_pools; pool; pool = pool->next) {
+			if(pool->buttons.count || pool->separators.count) {
+				pool_trim_timer = XtAppAddTimeOut(app_context,
+					POOL_TRIM_INTERVAL, pool_trim_timer_cb, NULL);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * Work procedure destroying up to POOL_TRIM_CHUNK gadgets scheduled for
+ * trimming at a time, so that X events are handled in between.
+ */
+static Boolean pool_trim_proc(XtPointer client_data)
+{
+	struct gadget_pool *pool;
+	Cardinal n = 0;
+	Boolean pooled = False;
+	
+	for(pool = gadget_pools; pool && n < POOL_TRIM_CHUNK; pool = pool->next) {
+		struct gadget_list *lists[2];
+		int i;
+		
+		lists[0] = &pool->buttons;
+		lists[1] = &pool->separators;
+		
+		for(i = 0; i < 2; i++) {
+			struct gadget_list *list = lists[i];
+			
+			while(list->trim && n < POOL_TRIM_CHUNK) {
+				XtDestroyWidget(list->items[--list->count]);
+				list->trim--;
+				n++;
+			}
+			if(list->low_count > list->count)
+				list->low_count = list->count;
+		}
+	}
+	if(n == POOL_TRIM_CHUNK) return False;
+	
+	pool_trim_work = 0;
+	for(pool = gadget_pools; pool; pool = pool->next) {
+		if(pool->buttons.count || pool->separators.count) pooled = True;
+	}
+	if(pooled) {
+		pool_trim_timer = XtAppAddTimeOut(app_context,
+			POOL_TRIM_INTERVAL, pool_trim_timer_cb, NULL);
+	}
+	return True;
+}
+
+/*
+ * Moves the pulldown of a cascade to the head of the resident menu list,
+ * adding it if not there yet, and schedules eviction of the least
+ * recently posted ones if their total size exceeds menuMemoryLimit.
+ */
+static void touch_resident_menu(Widget wcascade, Widget wpulldown)
+{
+	struct resident_menu *rm = NULL;
+	Cardinal nchildren = 0;
+	
+	if(app_res.menu_memory_limit <= 0) return;
+	if(!resident_menu_context) resident_menu_context = XUniqueContext();
+	
+	if(XFindContext(XtDisplay(wpulldown), (XID)wpulldown,
+		resident_menu_context, (XPointer*)&rm)) {
+		if(!(rm = calloc(1, sizeof(struct resident_menu)))) {
+			perror("calloc");
+			return;
+		}
+		if(XSaveContext(XtDisplay(wpulldown), (XID)wpulldown,
+			resident_menu_context, (XPointer)rm)) {
+			free(rm);
+			return;
+		}
+		rm->wcascade = wcascade;
+		rm->wpulldown = wpulldown;
+		XtAddCallback(wpulldown, XmNdestroyCallback,
+			resident_menu_destroy_cb, (XtPointer)rm);
+	} else {
+		unlink_resident_menu(rm);
+	}
+	
+	/* pooled gadgets are counted as well, they take as much memory */
+	XtVaGetValues(wpulldown, XmNnumChildren, &nchildren, NULL);
+	rm->cost = nchildren * MENU_ITEM_COST;
+	resident_cost += rm->cost;
+	
+	rm->next = resident_head;
+	if(resident_head) resident_head->prev = rm;
+	resident_head = rm;
+	if(!resident_tail) resident_tail = rm;
+	
+	if(!evict_work && resident_cost >
+		(size_t)app_res.menu_memory_limit * 1024) {
+		evict_work = XtAppAddWorkProc(app_context, evict_menus_proc, NULL);
+	}
+}
+
+/* Removes a pulldown from the resident menu list */
+static void unlink_resident_menu(struct resident_menu *rm)
+{
+	if(rm->prev) rm->prev->next = rm->next;
+	else resident_head = rm->next;
+	if(rm->next) rm->next->prev = rm->prev;
+	else resident_tail = rm->prev;
+	rm->prev = rm->next = NULL;
+	resident_cost -= rm->cost;
+}
+
+static void resident_menu_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct resident_menu *rm = (struct resident_menu*)client_data;
+	
+	unlink_resident_menu(rm);
+	XDeleteContext(XtDisplay(w), (XID)w, resident_menu_context);
+	free(rm);
+}
+
+/*
+ * Work procedure destroying the least recently posted pulldown, one per
+ * call, until resident menus fit in menuMemoryLimit. A new, empty pulldown
+ * replaces it in the cascade, and is populated when posted, as usual.
+ * Pulldowns currently posted are left alone.
+ */
+static Boolean evict_menus_proc(XtPointer client_data)
+{
+	size_t limit = (size_t)app_res.menu_memory_limit * 1024;
+	struct resident_menu *rm;
+	XtPointer first = NULL;
+	Widget wold, wnew;
+	Arg arg;
+	
+	for(rm = resident_tail; rm && resident_cost > limit; rm = rm->prev) {
+		if(!XtIsManaged(rm->wpulldown)) break;
+	}
+	if(!rm || resident_cost <= limit) {
+		evict_work = 0;
+		return True;
+	}
+	
+	#ifdef DEBUG_MENU
+	printf("Evicting pulldown of %u items (%lu bytes resident)\n",
+		(unsigned int)(rm->cost / MENU_ITEM_COST),
+		(unsigned long)resident_cost);
+	#endif
+	
+	wold = rm->wpulldown;
+	XtVaGetValues(wold, XmNuserData, &first, NULL);
+	
+	/* taken off the list before its (possibly deferred) destruction */
+	XtRemoveCallback(wold, XmNdestroyCallback,
+		resident_menu_destroy_cb, (XtPointer)rm);
+	XDeleteContext(XtDisplay(wold), (XID)wold, resident_menu_context);
+	unlink_resident_menu(rm);
+	
+	XtSetArg(arg, XmNuserData, first);
+	wnew = XmCreatePulldownMenu(XtParent(rm->wcascade),
+		"commandPulldown", &arg, 1);
+	XtVaSetValues(rm->wcascade, XmNsubMenuId, wnew, NULL);
+	free(rm);
+	
+	XtDestroyWidget(wold);
+	return False;
+}
+
+/*
+ * Shows the image file named in an ICON directive along the item's label.
+ * Images are loaded on worker threads, and shown once loaded.
+ */
+static void set_item_icon(Widget w, const char *spec)
+{
+	struct menu_icon *mi = NULL;
+	XrmQuark path_quark;
+	char *path;
+	int errval;
+	
+	if(!icons_init) init_icons(w);
+	if(!icon_size) return;
+	
+	if((errval = expand_env_vars(spec, &path))) {
+		fprintf(stderr, "%s: %s\n", spec, strerror(errval));
+		return;
+	}
+	path_quark = XrmStringToQuark(path);
+	
+	if(XFindContext(XtDisplay(w), (XID)path_quark,
+		menu_icon_context, (XPointer*)&mi)) {
+		if(!(mi = calloc(1, sizeof(struct menu_icon)))) {
+			perror("calloc");
+			free(path);
+			return;
+		}
+		mi->path = path_quark;
+		mi->pending = True;
+		
+		if((errval = tb_icon_request(icon_loader, path, icon_size)) ||
+			XSaveContext(XtDisplay(w), (XID)path_quark,
+			menu_icon_context, (XPointer)mi)) {
+			fprintf(stderr, "%s: %s\n", path,
+				strerror(errval ? errval : ENOMEM));
+			free(mi);
+			free(path);
+			return;
+		}
+	} else if(!mi->pending) {
+		if(mi->pixmap) apply_icon(w, mi->pixmap);
+		icon_hits++;
+		free(path);
+		return;
+	}
+	free(path);
+	
+	if(mi->nwaiting == mi->size) {
+		Cardinal size = mi->size ? mi->size * 2 : 8;
+		WidgetList waiting;
+		
+		if(!(waiting = realloc(mi->waiting, sizeof(Widget) * size))) {
+			perror("realloc");
+			return;
+		}
+		mi->waiting = waiting;
+		mi->size = size;
+	}
+	mi->waiting[mi->nwaiting++] = w;
+	add_item_callback(w, XmNdestroyCallback,
+		icon_wait_destroy_cb, (XtPointer)mi);
+}
+
+/*
+ * Starts the icon loader, with icons scaled to the height of text in
+ * menu items like w. Returns False if icons can't be shown.
+ */
+static Boolean init_icons(Widget w)
+{
+	Screen *screen = XtScreen(wshell);
+	Visual *visual = DefaultVisualOfScreen(screen);
+	XmRenderTable rt = NULL;
+	XmString sample;
+	char *cache_dir;
+	size_t len;
+	
+	/* only tried once */
+	icons_init = True;
+	menu_icon_context = XUniqueContext();
+	
+	if(visual->class != TrueColor) {
+		fputs("Menu icons require a TrueColor visual\n", stderr);
+		return False;
+	}
+	
+	XtVaGetValues(w, XmNrenderTable, &rt, NULL);
+	XtVaGetValues(XtParent(w), XmNbackground, &icon_background.pixel, NULL);
+	XQueryColor(XtDisplay(w), DefaultColormapOfScreen(screen),
+		&icon_background);
+	if(rt) {
+		sample = xmstr_get("Xy");
+		icon_size = XmStringHeight(rt, sample);
+		xmstr_release(sample);
+	}
+	if(!icon_size) icon_size = 16;
+	
+	
+	/* scaled images are cached along compiled menus */
+	if((cache_dir = tb_user_cache_dir())) {
+		char *icon_dir;
+		
+		len = strlen(cache_dir) + 8;
+		if((icon_dir = realloc(cache_dir, len))) {
+			cache_dir = icon_dir;
+			strcat(cache_dir, "/icons");
+			tb_make_cache_dir(cache_dir);
+		}
+	}
+	icon_loader = tb_icon_loader_create(ICON_THREADS, cache_dir);
+	free(cache_dir);
+	
+	if(!icon_loader) {
+		fputs("Failed to start the menu icon loader\n", stderr);
+		icon_size = 0;
+		return False;
+	}
+	XtAppAddInput(app_context, tb_icon_loader_fd(icon_loader),
+		(XtPointer)XtInputReadMask, icon_input_cb, NULL);
+	return True;
+}
+
+/*
+ * Shows icons loaded in items waiting for them
+ */
+static void icon_input_cb(XtPointer client_data, int *fd, XtInputId *id)
+{
+	Display *dpy = XtDisplay(wshell);
+	struct tb_icon *icon;
+	
+	while((icon = tb_icon_next(icon_loader))) {
+		struct menu_icon *mi = NULL;
+		Cardinal i;
+		
+		if(XFindContext(dpy, (XID)XrmStringToQuark(icon->path),
+			menu_icon_context, (XPointer*)&mi)) {
+			tb_icon_free(icon);
+			continue;
+		}
+		mi->pending = False;
+		
+		if(icon->err)
+			fprintf(stderr, "%s: %s\n", icon->path, strerror(icon->err));
+		else
+			mi->pixmap = get_icon_pixmap(icon);
+		tb_icon_free(icon);
+		
+		for(i = 0; i < mi->nwaiting; i++) {
+			remove_item_callback(mi->waiting[i], XmNdestroyCallback,
+				icon_wait_destroy_cb, (XtPointer)mi);
+			if(mi->pixmap) apply_icon(mi->waiting[i], mi->pixmap);
+		}
+		free(mi->waiting);
+		mi->waiting = NULL;
+		mi->nwaiting = mi->size = 0;
+	}
+	
+	#ifdef DEBUG_MENU
+	{
+		struct tb_icon_stats st;
+		
+		tb_icon_get_stats(icon_loader, &st);
+		printf("Icons: %lu requested, %lu shared, %lu from disk cache, "
+			"%lu decoded in %.1f ms, %lu failed\n", st.requests, icon_hits,
+			st.disk_hits, st.decoded, st.decode_msecs, st.failed);
+	}
+	#endif
+}
+
+/*
+ * Returns the pixmap of an image, creating one if no identical image
+ * has one yet. Pixels are blended with the menu background, since label
+ * pixmaps have no mask. Returns None on failure.
+ */
+static Pixmap get_icon_pixmap(const struct tb_icon *icon)
+{
+	Display *dpy = XtDisplay(wshell);
+	Screen *screen = XtScreen(wshell);
+	Visual *visual = DefaultVisualOfScreen(screen);
+	unsigned long masks[3];
+	unsigned int shifts[3], bits[3];
+	unsigned int bg[3];
+	struct icon_pixmap *ip;
+	XImage *image;
+	unsigned int x, y, i;
+	
+	for(ip = icon_pixmaps; ip; ip = ip->next) {
+		if(ip->key == icon->key) {
+			icon_hits++;
+			return ip->pixmap;
+		}
+	}
+	if(!(ip = calloc(1, sizeof(struct icon_pixmap)))) return None;
+	
+	masks[0] = visual->red_mask;
+	masks[1] = visual->green_mask;
+	masks[2] = visual->blue_mask;
+	bg[0] = icon_background.red >> 8;
+	bg[1] = icon_background.green >> 8;
+	bg[2] = icon_background.blue >> 8;
+	for(i = 0; i < 3; i++) {
+		unsigned long m = masks[i];
+		
+		for(shifts[i] = 0; m && !(m & 1); m >>= 1) shifts[i]++;
+		for(bits[i] = 0; m & 1; m >>= 1) bits[i]++;
+	}
+	
+	image = XCreateImage(dpy, visual, DefaultDepthOfScreen(screen),
+		ZPixmap, 0, NULL, icon->width, icon->height, 32, 0);
+	if(!image || !(image->data = malloc(image->bytes_per_line *
+		icon->height))) {
+		if(image) XDestroyImage(image);
+		free(ip);
+		return None;
+	}
+	
+	for(y = 0; y < icon->height; y++) {
+		for(x = 0; x < icon->width; x++) {
+			uint32_t argb = icon->pixels[y * icon->width + x];
+			unsigned int a = argb >> 24;
+			unsigned long pixel = 0;
+			
+			for(i = 0; i < 3; i++) {
+				unsigned int c = (argb >> (16 - i * 8)) & 0xff;
+				
+				/* premultiplied over the background */
+				c += bg[i] * (0xff - a) / 0xff;
+				if(bits[i] < 8) c >>= 8 - bits[i];
+				pixel |= (unsigned long)c << shifts[i];
+			}
+			XPutPixel(image, x, y, pixel);
+		}
+	}
+	
+	ip->pixmap = XCreatePixmap(dpy, RootWindowOfScreen(screen),
+		icon->width, icon->height, DefaultDepthOfScreen(screen));
+	XPutImage(dpy, ip->pixmap, DefaultGCOfScreen(screen), image,
+		0, 0, 0, 0, icon->width, icon->height);
+	XDestroyImage(image);
+	
+	ip->key = icon->key;
+	ip->next = icon_pixmaps;
+	icon_pixmaps = ip;
+	return ip->pixmap;
+}
+
+static void apply_icon(Widget w, Pixmap pixmap)
+{
+	XtVaSetValues(w, XmNlabelPixmap, pixmap,
+		XmNlabelType, XmPIXMAP_AND_STRING, NULL);
+}
+
+/* Removes a destroyed (or pooled) item from those waiting for an icon */
+static void icon_wait_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct menu_icon *mi = (struct menu_icon*)client_data;
+	Cardinal i;
+	
+	for(i = 0; i < mi->nwaiting; i++) {
+		if(mi->waiting[i] == w) {
+			mi->waiting[i] = mi->waiting[--mi->nwaiting];
+			break;
+		}
+	}
+}
+
+/*
+ * Creates an unmanaged cascade for a TBE_PIPE entry. Its contents are
+ * generated from the output of the command when the cascade is first
+ * posted. Returns None if out of memory.
+ */
+static Widget create_pipe_menu(Widget wparent, const struct tb_entry *ent)
+{
+	struct pipe_menu *pm;
+	Widget wcascade;
+	XmString title;
+	Arg args[5];
+	int n = 0;
+	XtCallbackRec cascading_cb[] = {
+		{ (XtCallbackProc)pipe_menu_cascading_cb, NULL},
+		{ (XtCallbackProc)NULL, (XtPointer)NULL}
+	};
+	XtCallbackRec destroy_cb[] = {
+		{ (XtCallbackProc)pipe_menu_destroy_cb, NULL},
+		{ (XtCallbackProc)NULL, (XtPointer)NULL}
+	};
+	
+	pm = calloc(1, sizeof(struct pipe_menu));
+	if(!pm || !(pm->command = strdup(ent->command))) {
+		perror("malloc");
+		free(pm);
+		return None;
+	}
+	pm->ttl = (ent->ttl == TB_DEFAULT_TTL) ? app_res.pipe_menu_ttl : ent->ttl;
+	pm->fd = -1;
+	cascading_cb[0].closure = (XtPointer)pm;
+	destroy_cb[0].closure = (XtPointer)pm;
+	
+	XtSetArg(args[n], XmNdestroyCallback, destroy_cb); n++;
+	pm->wpulldown = XmCreatePulldownMenu(wparent,
+		"commandPulldown", args, n);
+	
+	title = xmstr_get(ent->title);
+	n = 0;
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, (KeySym)ent->mnemonic); n++;
+	XtSetArg(args[n], XmNsubMenuId, pm->wpulldown); n++;
+	XtSetArg(args[n], XmNcascadingCallback, cascading_cb); n++;
+	wcascade = XmCreateCascadeButtonGadget(wparent, "cascadeButton", args, n);
+	xmstr_release(title);
+	
+	set_menu_status(pm->wpulldown, "Loading...");
+	return wcascade;
+}
+
+/*
+ * Replaces contents of a pulldown with an insensitive status item
+ */
+static void set_menu_status(Widget wpulldown, const char *text)
+{
+	XmString title;
+	Arg args[2];
+	int n = 0;
+	
+	clear_menu_items(wpulldown);
+
+	title = xmstr_get(text);
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNsensitive, False); n++;
+	XtManageChild(XmCreatePushButtonGadget(wpulldown,
+		"menuStatus", args, n));
+	xmstr_release(title);
+}
+
+/*
+ * Runs the generator when the pipe menu is about to be posted, unless
+ * output of a previous run is still fresh, or one is in progress already.
+ */
+static void pipe_menu_cascading_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct pipe_menu *pm = (struct pipe_menu*)client_data;
+	char *exp_cmd;
+	int errval;
+	
+	if(pm->fd != -1) return;
+	if(pm->stamp && (time(NULL) - pm->stamp) < pm->ttl) {
+		update_command_items(pm->wpulldown);
+		return;
+	}
+	
+	if((errval = expand_env_vars(pm->command, &exp_cmd))) {
+		report_exec_error("Failed to parse command string",
+			pm->command, errval);
+		return;
+	}
+
+	errval = spawn_command(exp_cmd, &pm->fd);
+	free(exp_cmd);
+	
+	if(errval) {
+		pm->fd = -1;
+		set_menu_status(pm->wpulldown, strerror(errval));
+		return;
+	}
+
+	pm->len = 0;
+	fcntl(pm->fd, F_SETFL, O_NONBLOCK);
+	pm->input = XtAppAddInput(app_context, pm->fd,
+		(XtPointer)XtInputReadMask, pipe_menu_input_cb, (XtPointer)pm);
+}
+
+/*
+ * Accumulates generator output, and rebuilds the menu on EOF.
+ */
+static void pipe_menu_input_cb(XtPointer client_data, int *fd, XtInputId *id)
+{
+	struct pipe_menu *pm = (struct pipe_menu*)client_data;
+	const struct tb_menu *menu;
+	ssize_t rv;
+	int err;
+
+	for(;;) {
+		if(pm->len == pm->size) {
+			char *new_ptr;
+
+			if(pm->size == MAX_PIPE_OUTPUT) {
+				end_pipe_menu_input(pm);
+				fprintf(stderr, "%s: output too large\n", pm->command);
+				if(!pm->parser) set_menu_status(pm->wpulldown, "(Failed)");
+				return;
+			}
+			new_ptr = realloc(pm->buf, pm->size + PIPE_READ_SIZE);
+			if(!new_ptr) {
+				perror("realloc");
+				end_pipe_menu_input(pm);
+				return;
+			}
+			pm->buf = new_ptr;
+			pm->size += PIPE_READ_SIZE;
+		}
+		rv = read(pm->fd, pm->buf + pm->len, pm->size - pm->len);
+		if(rv > 0) {
+			pm->len += rv;
+		} else if(rv == -1 && errno == EINTR) {
+			continue;
+		} else if(rv == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			return;
+		} else {
+			break;
+		}
+	}
+	XtRemoveInput(pm->input);
+	close(pm->fd);
+	pm->fd = -1;
+
+	if(!pm->parser && !(pm->parser = tb_parser_create())) {
+		perror("malloc");
+		end_pipe_menu_input(pm);
+		return;
+	}
+	
+	err = tb_parser_parse_string(pm->parser, pm->command,
+		pm->buf, pm->len, 1, &menu);
+	end_pipe_menu_input(pm);
+
+	if(err) {
+		fprintf(stderr, "%s\n", tb_parser_error(pm->parser) ?
+			tb_parser_error(pm->parser) : strerror(err));
+		/* keep previous contents, if any; failed parses leave them intact */
+		if(!pm->stamp) set_menu_status(pm->wpulldown, "(Failed)");
+		return;
+	}
+	
+	/* previous entries, which items refer to, were freed by the parse */
+	if(menu->count) {
+		clear_menu_items(pm->wpulldown);
+		create_menu_items(pm->wpulldown, menu, 0);
+	} else {
+		set_menu_status(pm->wpulldown, "(Empty)");
+	}
+	pm->stamp = time(NULL);
+}
+
+/*
+ * Stops reading generator output, if still in progress, and frees the buffer
+ */
+static void end_pipe_menu_input(struct pipe_menu *pm)
+{
+	if(pm->fd != -1) {
+		XtRemoveInput(pm->input);
+		close(pm->fd);
+		pm->fd = -1;
+	}
+	free(pm->buf);
+	pm->buf = NULL;
+	pm->size = 0;
+}
+
+static void pipe_menu_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct pipe_menu *pm = (struct pipe_menu*)client_data;
+
+	end_pipe_menu_input(pm);
+	if(pm->parser) tb_parser_destroy(pm->parser);
+	free(pm->command);
+	free(pm);
+}
+
+/*
+ * Creates an unmanaged cascade listing contents of the directory at 'path',
+ * starting with the entry at index 'first'. Contents are created when it's
+ * posted. Returns None if out of memory.
+ */
+static Widget create_dir_menu(Widget wparent, const char *title_str,
+	KeySym mnemonic, const char *path, size_t first)
+{
+	struct dir_menu *dm;
+	Widget wcascade;
+	XmString title;
+	Arg args[5];
+	int n = 0;
+	XtCallbackRec cascading_cb[] = {
+		{ (XtCallbackProc)dir_menu_cascading_cb, NULL},
+		{ (XtCallbackProc)NULL, (XtPointer)NULL}
+	};
+	XtCallbackRec destroy_cb[] = {
+		{ (XtCallbackProc)dir_menu_destroy_cb, NULL},
+		{ (XtCallbackProc)NULL, (XtPointer)NULL}
+	};
+	
+	dm = calloc(1, sizeof(struct dir_menu));
+	if(!dm || !(dm->path = strdup(path))) {
+		perror("malloc");
+		free(dm);
+		return None;
+	}
+	dm->first = first;
+	cascading_cb[0].closure = (XtPointer)dm;
+	destroy_cb[0].closure = (XtPointer)dm;
+	
+	XtSetArg(args[n], XmNdestroyCallback, destroy_cb); n++;
+	dm->wpulldown = XmCreatePulldownMenu(wparent,
+		"commandPulldown", args, n);
+	
+	title = xmstr_get(title_str);
+	n = 0;
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, mnemonic); n++;
+	XtSetArg(args[n], XmNsubMenuId, dm->wpulldown); n++;
+	XtSetArg(args[n], XmNcascadingCallback, cascading_cb); n++;
+	wcascade = XmCreateCascadeButtonGadget(wparent, "cascadeButton", args, n);
+	xmstr_release(title);
+	
+	set_menu_status(dm->wpulldown, "Loading...");
+	return wcascade;
+}
+
+/*
+ * Recreates contents of the directory menu if the directory has changed
+ * since they were created. Unchanged ones cost a single stat() call.
+ */
+static void dir_menu_cascading_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct dir_menu *dm = (struct dir_menu*)client_data;
+	struct tb_dir *dir;
+	int errval;
+	
+	if((errval = tb_dir_open(dm->path, &dir))) {
+		if(dm->dir) {
+			tb_dir_release(dm->dir);
+			dm->dir = NULL;
+		}
+		set_menu_status(dm->wpulldown, strerror(errval));
+		return;
+	}
+
+	if(dir == dm->dir) {
+		tb_dir_release(dir);
+		return;
+	}
+	
+	clear_menu_items(dm->wpulldown);
+	if(dm->dir) tb_dir_release(dm->dir);
+	dm->dir = dir;
+	
+	fill_dir_menu(dm);
+}
+
+/*
+ * Creates items for at most dirMenuItems directory entries; the rest are
+ * deferred to a "More..." cascade, so that huge directories don't result
+ * in huge menus that take long to create.
+ */
+static void fill_dir_menu(struct dir_menu *dm)
+{
+	struct tb_dir *dir = dm->dir;
+	WidgetList items;
+	Cardinal nitems = 0;
+	Widget wsubdir;
+	size_t i, last;
+	Arg args[5];
+	int n;
+	
+	if(dm->first >= dir->count) {
+		set_menu_status(dm->wpulldown, "(Empty)");
+		return;
+	}
+	
+	last = dm->first + ((app_res.dir_menu_items > 0) ?
+		app_res.dir_menu_items : dir->count);
+	if(last > dir->count) last = dir->count;
+	
+	/* room for the "More..." separator and cascade */
+	if(!(items = malloc((last - dm->first + 2) * sizeof(Widget)))) {
+		perror("malloc");
+		return;
+	}
+	
+	for(i = dm->first; i < last; i++) {
+		const struct tb_dirent *ent = &dir->ents[i];
+
+		if(ent->is_dir) {
+			char *path;
+			
+			if(!(path = join_path(dm->path, ent->name))) {
+				perror("malloc");
+				break;
+			}
+			wsubdir = create_dir_menu(dm->wpulldown,
+				ent->name, 0, path, 0);
+			if(wsubdir) items[nitems++] = wsubdir;
+			free(path);
+		} else {
+			XmString title;
+			Widget w;
+			
+			title = xmstr_get(ent->name);
+			n = 0;
+			XtSetArg(args[n], XmNlabelString, title); n++;
+			XtSetArg(args[n], XmNuserData, (XtPointer)i); n++;
+			w = create_menu_button(dm->wpulldown, args, n);
+			add_item_callback(w, XmNactivateCallback,
+				dir_file_cb, (XtPointer)dm);
+			items[nitems++] = w;
+			xmstr_release(title);
+		}
+	}
+	
+	if(last < dir->count) {
+		items[nitems++] = create_menu_separator(dm->wpulldown, NULL, 0);
+		wsubdir = create_dir_menu(dm->wpulldown,
+			"More...", 0, dm->path, last);
+		if(wsubdir) items[nitems++] = wsubdir;
+	}
+	XtManageChildren(items, nitems);
+	free(items);
+}
+
+/*
+ * Opens the file a directory menu item was activated for
+ */
+static void dir_file_cb(Widget w, XtPointer client_data, XtPointer call_data)
+{
+	struct dir_menu *dm = (struct dir_menu*)client_data;
+	XtPointer index;
+	char *path;
+	const char *name;
+	int errval;
+	
+	XtVaGetValues(w, XmNuserData, &index, NULL);
+	name = dm->dir->ents[(size_t)index].name;
+	
+	if(!(path = join_path(dm->path, name))) {
+		perror("malloc");
+		return;
+	}
+	
+	if((errval = open_file(path)))
+		report_exec_error("Error executing command",
+			app_res.file_opener, errval);
+	
+	free(path);
+}
+
+/*
+ * Returns a malloc()ed dir/name path string, or NULL if out of memory
+ */
+static char* join_path(const char *dir, const char *name)
+{
+	char *path;
+	size_t len = strlen(dir);
+	
+	path = malloc(len + strlen(name) + 2);
+	if(!path) return NULL;
+
+	/* avoid a double slash when dir is the root directory */
+	if(len && dir[len - 1] == '/') len--;
+	sprintf(path, "%.*s/%s", (int)len, dir, name);
+	return path;
+}
+
+static void dir_menu_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct dir_menu *dm = (struct dir_menu*)client_data;
+	
+	if(dm->dir) tb_dir_release(dm->dir);
+	free(dm->path);
+	free(dm);
+}
+
+/*
+ * Creates an unmanaged cascade listing installed applications, or returns
+ * None if out of memory. Desktop files are
+ * read on a worker thread, started right away so that the menu is usually
+ * ready by the time it's first posted. Category sub-menus are only
+ * populated when posted.
+ */
+static Widget create_apps_menu(Widget wparent, const struct tb_entry *ent)
+{
+	struct apps_menu *am;
+	Widget wcascade;
+	XmString title;
+	Arg args[5];
+	int n = 0;
+	XtCallbackRec destroy_cb[] = {
+		{ (XtCallbackProc)apps_menu_destroy_cb, NULL},
+		{ (XtCallbackProc)NULL, (XtPointer)NULL}
+	};
+	
+	if(!(am = calloc(1, sizeof(struct apps_menu))) ||
+		!(am->parser = tb_parser_create())) {
+		perror("malloc");
+		free(am);
+		return None;
+	}
+	am->notify_fd[0] = am->notify_fd[1] = -1;
+	destroy_cb[0].closure = (XtPointer)am;
+	
+	XtSetArg(args[n], XmNdestroyCallback, destroy_cb); n++;
+	am->wpulldown = XmCreatePulldownMenu(wparent,
+		"commandPulldown", args, n);
+	
+	title = xmstr_get(ent->title);
+	n = 0;
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, (KeySym)ent->mnemonic); n++;
+	XtSetArg(args[n], XmNsubMenuId, am->wpulldown); n++;
+	wcascade = XmCreateCascadeButtonGadget(wparent, "cascadeButton", args, n);
+	xmstr_release(title);
+	
+	set_menu_status(am->wpulldown, "Loading...");
+	
+	if(pipe(am->notify_fd) == -1) {
+		perror("pipe");
+		set_menu_status(am->wpulldown, "(Failed)");
+		return wcascade;
+	}
+	fcntl(am->notify_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(am->notify_fd[1], F_SETFD, FD_CLOEXEC);
+	
+	if(pthread_create(&am->thread, NULL, apps_thread_proc, am)) {
+		set_menu_status(am->wpulldown, "(Failed)");
+		return wcascade;
+	}
+	am->pending = True;
+	am->input = XtAppAddInput(app_context, am->notify_fd[0],
+		(XtPointer)XtInputReadMask, apps_menu_input_cb, (XtPointer)am);
+	return wcascade;
+}
+
+static void* apps_thread_proc(void *arg)
+{
+	struct apps_menu *am = (struct apps_menu*)arg;
+	char c = 0;
+	
+	am->err = tb_apps_load(am->parser, &am->menu);
+	while(write(am->notify_fd[1], &c, 1) == -1 && errno == EINTR);
+	return NULL;
+}
+
+/*
+ * Creates category cascades once the applications menu has been built.
+ * Their pulldowns are populated when posted, as with any other cascade.
+ */
+static void apps_menu_input_cb(XtPointer client_data, int *fd, XtInputId *id)
+{
+	struct apps_menu *am = (struct apps_menu*)client_data;
+	WidgetList items;
+	Cardinal nitems = 0;
+	int i;
+	
+	XtRemoveInput(am->input);
+	pthread_join(am->thread, NULL);
+	am->pending = False;
+	
+	if(am->err) {
+		fprintf(stderr, "Applications menu: %s\n", strerror(am->err));
+		set_menu_status(am->wpulldown, "(Failed)");
+		return;
+	}
+	if(!am->menu->count) {
+		set_menu_status(am->wpulldown, "(Empty)");
+		return;
+	}
+	
+	for(i = 0; i != -1; i = am->menu->entries[i].sibling) nitems++;
+	if(!(items = malloc(nitems * sizeof(Widget)))) {
+		perror("malloc");
+		set_menu_status(am->wpulldown, "(Failed)");
+		return;
+	}
+	
+	clear_menu_items(am->wpulldown);
+	
+	nitems = 0;
+	for(i = 0; i != -1; i = am->menu->entries[i].sibling) {
+		const struct tb_entry *cur = &am->menu->entries[i];
+		Widget wpulldown;
+		XmString title;
+		Arg args[5];
+		int n = 0;
+		XtCallbackRec cascading_cb[] = {
+			{ (XtCallbackProc)menu_cascading_cb, NULL},
+			{ (XtCallbackProc)NULL, (XtPointer)NULL}
+		};
+		
+		cascading_cb[0].closure = (XtPointer)am->menu;
+		
+		XtSetArg(args[n], XmNuserData, (XtPointer)(intptr_t)(i + 1)); n++;
+		wpulldown = XmCreatePulldownMenu(am->wpulldown,
+			"commandPulldown", args, n);
+		
+		title = xmstr_get(cur->title);
+		n = 0;
+		XtSetArg(args[n], XmNlabelString, title); n++;
+		XtSetArg(args[n], XmNsubMenuId, wpulldown); n++;
+		XtSetArg(args[n], XmNcascadingCallback, cascading_cb); n++;
+		items[nitems++] = XmCreateCascadeButtonGadget(am->wpulldown,
+			"cascadeButton", args, n);
+		xmstr_release(title);
+	}
+	XtManageChildren(items, nitems);
+	free(items);
+}
+
+static void apps_menu_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct apps_menu *am = (struct apps_menu*)client_data;
+	
+	if(am->pending) {
+		XtRemoveInput(am->input);
+		pthread_join(am->thread, NULL);
+	}
+	if(am->notify_fd[0] != -1) close(am->notify_fd[0]);
+	if(am->notify_fd[1] != -1) close(am->notify_fd[1]);
+	tb_parser_destroy(am->parser);
+	free(am);
+}
+
+static void report_rcfile_error(const char *rc_file, const char *err_desc)
+{
+	char *buffer;
+	char err_msg[]="Error while parsing RC file:";
+	size_t msg_len;
+
+	msg_len=strlen(err_msg)+strlen(err_desc)+strlen(rc_file)+10;
+	buffer=malloc(msg_len);
+	if(!buffer){
+		perror("malloc");
+		return;
+	}
+
+	sprintf(buffer,"%s %s\n%s.",err_msg,rc_file,err_desc);
+	message_dialog(False,buffer);
+	free(buffer);
+}
+
+/*
+ * Work procedure building utility widgets, one stage per call, once the
+ * main menu has been mapped, so that the toolbox becomes usable as early
+ * as possible. Stages run in the order of their importance to the user.
+ */
+static Boolean startup_proc(XtPointer client_data)
+{
+	switch(startup_stage++) {
+		case 0:
+		if(!get_xmsm_config(&xmsm_cfg)) 
+			message_dialog(False, xmsm_cmd_err);
+		open_usage_log();
+		create_session_menu(wmain);
+		return False;
+		
+		case 1:
+		create_gadgets(wmain);
+		if(XtIsManaged(wswitch))
+			XmProcessTraversal(wswitch, XmTRAVERSE_CURRENT);
+		break;
+	}
+	
+	#ifdef DEBUG_MENU
+	{
+		struct timespec now;
+		
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		printf("Startup: ready in %.1f ms\n",
+			(now.tv_sec - startup_time.tv_sec) * 1000.0 +
+			(now.tv_nsec - startup_time.tv_nsec) / 1000000.0);
+	}
+	#endif
+	return True;
+}
+
+/*
+ * Creates the session menu, preceded by a separator, in wparent
+ */
+static void create_session_menu(Widget wparent)
+{
+	XtCallbackRec cbr[2] = { { NULL, NULL } };
+	Widget wmenu;
+	Widget wpulldown;
+	Widget wcascade;
+	Widget w;
+	Widget items[6];
+	Cardinal nitems = 0;
+	Widget top_items[2];
+	Cardinal ntop = 0;
+	XmString title;
+	Arg args[10];
+	int n;
+	
+	XtSetArg(args[0], XmNorientation,
+		(app_res.horizontal ? XmVERTICAL:XmHORIZONTAL));
+	w = XmCreateSeparatorGadget(wparent, "separator", args, 1);
+	if(app_res.separators) top_items[ntop++] = w;
+	
+	/* 'Session' menu */
+	n = 0;
+	XtSetArg(args[n], XmNshadowThickness, 0); n++;
+	XtSetArg(args[n], XmNspacing, 1); n++;
+	XtSetArg(args[n], XmNmarginWidth, 0); n++;
+	XtSetArg(args[n], XmNorientation,
+		(app_res.horizontal ? XmHORIZONTAL:XmVERTICAL)); n++;
+	XtSetArg(args[n], XmNrowColumnType, XmMENU_BAR); n++;
+	wmenu = XmCreateRowColumn(wparent, "menu", args, n);
+	
+	/* 'Frequent' menu, filled in when posted */
+	if(usage && app_res.frequent_items > 0) {
+		wpulldown = XmCreatePulldownMenu(wmenu,
+			"frequentPulldown", NULL, 0);
+		cbr[0].callback = frequent_cascading_cb;
+		cbr[0].closure = (XtPointer)wpulldown;
+		
+		title = xmstr_get("Frequent");
+		n = 0;
+		XtSetArg(args[n], XmNlabelString, title); n++;
+		XtSetArg(args[n], XmNmnemonic, (KeySym)'F'); n++;
+		XtSetArg(args[n], XmNsubMenuId, wpulldown); n++;
+		XtSetArg(args[n], XmNcascadingCallback, cbr); n++;
+		wcascade = XmCreateCascadeButtonGadget(wmenu, "frequent", args, n);
+		xmstr_release(title);
+		XtManageChild(wcascade);
+		cbr[0].closure = NULL;
+	}
+	
+	wpulldown = XmCreatePulldownMenu(wmenu,"sessionPulldown",NULL,0);
+			
+	title = xmstr_get("Session");
+	n=0;
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, (KeySym)'S'); n++;
+	XtSetArg(args[n], XmNsubMenuId, wpulldown); n++;
+	wcascade = XmCreateCascadeButtonGadget(wmenu, "session", args, n);
+	xmstr_release(title);
+	XtManageChild(wcascade);
+		
+	n = 0;
+	cbr[0].callback = exec_cb;
+	title=xmstr_get("Execute...");
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, (KeySym)'E'); n++;
+	XtSetArg(args[n], XmNactivateCallback, cbr); n++;
+	items[nitems++] = XmCreatePushButtonGadget(wpulldown,
+		"execute", args, n);
+	xmstr_release(title);
+
+	n = 0;
+	cbr[0].callback = palette_cb;
+	title = xmstr_get("Find...");
+	XtSetArg(args[n], XmNlabelString, title); n++;
+	XtSetArg(args[n], XmNmnemonic, (KeySym)'F'); n++;
+	XtSetArg(args[n], XmNactivateCallback, cbr); n++;
+	items[nitems++] = XmCreatePushButtonGadget(wpulldown,
+		"find", args, n);
+	xmstr_release(title);
+
+	items[nitems++] = XmCreateSeparatorGadget(wpulldown,
+		"separator", NULL, 0);
 
 	if(xmsm_cfg & XMSM_CFG_LOCK) {
 		n = 0;
 		cbr[0].callback = lock_cb;
-		title = XmStringCreateLocalized("Lock");
+		title = xmstr_get("Lock");
 		XtSetArg(args[n], XmNlabelString, title); n++;
 		XtSetArg(args[n], XmNmnemonic, (KeySym)'L'); n++;
 		XtSetArg(args[n], XmNactivateCallback, cbr); n++;
-		w = XmCreatePushButtonGadget(wpulldown, "lock", args, n);
-		XmStringFree(title);
-		XtManageChild(w);
+		items[nitems++] = XmCreatePushButtonGadget(wpulldown,
+			"lock", args, n);
+		xmstr_release(title);
 	}
 
 	n = 0;
 	cbr[0].callback = logout_cb;
-	title=XmStringCreateLocalized("Logout...");
+	title=xmstr_get("Logout...");
 	XtSetArg(args[n], XmNlabelString, title); n++;
 	XtSetArg(args[n], XmNmnemonic, (KeySym)'o'); n++;
 	XtSetArg(args[n], XmNactivateCallback, cbr); n++;
-	w = XmCreatePushButtonGadget(wpulldown, "logout", args, n);
-	XmStringFree(title);
-	XtManageChild(w);
+	items[nitems++] = XmCreatePushButtonGadget(wpulldown,
+		"logout", args, n);
+	xmstr_release(title);
 
 	if(xmsm_cfg & XMSM_CFG_SUSPEND) {
 		n = 0;
 		cbr[0].callback = suspend_cb;
-		title = XmStringCreateLocalized("Suspend");
+		title = xmstr_get("Suspend");
 		XtSetArg(args[n], XmNlabelString,title); n++;
 		XtSetArg(args[n], XmNmnemonic,(KeySym)'S'); n++;
 		XtSetArg(args[n], XmNactivateCallback, cbr); n++;
-		w = XmCreatePushButtonGadget(wpulldown, "suspend", args, n);
-		XmStringFree(title);
-		XtManageChild(w);
+		items[nitems++] = XmCreatePushButtonGadget(wpulldown,
+			"suspend", args, n);
+		xmstr_release(title);
 	}
-	XtManageChild(wmenu);
+	XtManageChildren(items, nitems);
+	top_items[ntop++] = wmenu;
+	XtManageChildren(top_items, ntop);
+}
+
+/*
+ * Maps the usage log the 'Frequent' menu is ranked from, unless disabled.
+ * Failure isn't fatal; launches just aren't recorded then.
+ */
+static void open_usage_log(void)
+{
+	char *cache_dir;
+	char *path;
+	
+	if(app_res.frequent_items <= 0) return;
+	if(app_res.frequent_items > MAX_FREQUENT)
+		app_res.frequent_items = MAX_FREQUENT;
+	
+	if(!(cache_dir = tb_user_cache_dir())) return;
+	tb_make_cache_dir(cache_dir);
+	path = join_path(cache_dir, "usage");
+	free(cache_dir);
+	if(!path) {
+		perror("malloc");
+		return;
+	}
+	
+	if(!(usage = tb_usage_open(path))) perror(path);
+	free(path);
+}
+
+/*
+ * Counts a launch of the command in the usage log
+ */
+static void record_launch(const char *title, const char *command)
+{
+	if(usage)
+		tb_usage_record(usage, title ? title : "", command, time(NULL));
+}
+
+/*
+ * Ranks logged commands when the 'Frequent' menu is about to be posted,
+ * and rebuilds it only if they differ from those shown.
+ */
+static void frequent_cascading_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	Widget wpulldown = (Widget)client_data;
+	unsigned int slots[MAX_FREQUENT];
+	Widget items[MAX_FREQUENT];
+	unsigned int i, count;
+	XmString label;
+	Arg args[2];
+	int n;
+	
+	count = tb_usage_top(usage, time(NULL),
+		slots, (unsigned int)app_res.frequent_items);
+	
+	if(frequent_built && count == frequent_count) {
+		for(i = 0; i < count; i++) {
+			if(tb_usage_key(usage, slots[i]) != frequent_shown[i])
+				break;
+		}
+		if(i == count) return;
+	}
+	frequent_built = True;
+	frequent_count = 0;
+	
+	if(!count) {
+		set_menu_status(wpulldown, "(Empty)");
+		return;
+	}
+	clear_menu_items(wpulldown);
+	
+	for(i = 0; i < count; i++) {
+		const char *title = tb_usage_title(usage, slots[i]);
+		char *command;
+		
+		if(!(command = strdup(tb_usage_command(usage, slots[i])))) {
+			perror("strdup");
+			break;
+		}
+		
+		label = xmstr_get(title[0] ? title : command);
+		n = 0;
+		XtSetArg(args[n], XmNlabelString, label); n++;
+		items[i] = create_menu_button(wpulldown, args, n);
+		xmstr_release(label);
+		
+		add_item_callback(items[i], XmNactivateCallback,
+			frequent_item_cb, (XtPointer)command);
+		add_item_callback(items[i], XmNdestroyCallback,
+			frequent_item_destroy_cb, (XtPointer)command);
+		frequent_shown[frequent_count++] = tb_usage_key(usage, slots[i]);
+	}
+	XtManageChildren(items, frequent_count);
+	
+	#ifdef DEBUG_MENU
+	printf("Frequent: rebuilt with %u items\n", frequent_count);
+	#endif
+}
+
+static void frequent_item_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	const char *command = (const char*)client_data;
+	XmString label = NULL;
+	char *title = NULL;
+	char *exp_cmd;
+	int errval;
+	
+	XtVaGetValues(w, XmNlabelString, &label, NULL);
+	if(label) {
+		title = (char*)XmStringUnparse(label, NULL, 0,
+			XmCHARSET_TEXT, NULL, 0, XmOUTPUT_ALL);
+		XmStringFree(label);
+	}
+	record_launch(title ? title : "", command);
+	if(title) XtFree(title);
+	
+	if((errval = expand_env_vars(command, &exp_cmd))) {
+		report_exec_error("Failed to parse command string", command, errval);
+		return;
+	}
+	if((errval = exec_command(exp_cmd)))
+		report_exec_error("Error executing command", exp_cmd, errval);
+	free(exp_cmd);
+}
+
+static void frequent_item_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	free(client_data);
+}
+
+/*
+ * Creates the workspace switcher and the date/time display, preceded by
+ * a separator, in wparent
+ */
+static void create_gadgets(Widget wparent)
+{
+	XtCallbackRec cbr[2] = { { NULL, NULL } };
+	Widget items[2];
+	Cardinal nitems = 0;
+	Widget top_items[2];
+	Cardinal ntop = 0;
+	unsigned short nws = 0;
+	unsigned short iws = 0;
+	Arg args[10];
+	int n;
 	
 	XtSetArg(args[0], XmNorientation,
 		(app_res.horizontal ? XmVERTICAL:XmHORIZONTAL));
@@ -838,10 +3090,7 @@ static void create_utility_widgets(Widget wparent)
 	cbr[0].callback = ws_change_cb;
 	XtSetArg(args[n], XmNvalueChangedCallback, &cbr); n++;
 	wswitch = CreateSwitcher(wgadrc, "workspaceSwitcher", args, n);
-	if(app_res.switcher && (nws > 1)) {
-		XtManageChild(wswitch);
-		if(app_res.separators) XtManageChild(wgadsep);
-	}
+	if(app_res.switcher && (nws > 1)) items[nitems++] = wswitch;
 
 	/* The time-date display */
 	n = 0;
@@ -856,12 +3105,30 @@ static void create_utility_widgets(Widget wparent)
 	wdtlabel = XmCreateLabelGadget(wdtframe, "dateTime", args, n);
 	if(app_res.show_date_time){
 		XtManageChild(wdtlabel);
-		XtManageChild(wdtframe);
-		if(app_res.separators) XtManageChild(wgadsep);
+		items[nitems++] = wdtframe;
 		time_update_cb(NULL,NULL);
 	}
-	if(XtIsManaged(wswitch) || app_res.show_date_time)
-		XtManageChild(wgadrc);
+	if(nitems) {
+		XtManageChildren(items, nitems);
+		if(app_res.separators) top_items[ntop++] = wgadsep;
+		top_items[ntop++] = wgadrc;
+	}
+	XtManageChildren(top_items, ntop);
+}
+
+/*
+ * Returns a malloc()ed path to the RC file specified with -rcfile on
+ * command line, or the one found by find_rc_file. NULL if none.
+ */
+static char* get_rc_file(int argc, char **argv)
+{
+	int i;
+	
+	for(i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-rcfile") && (i + 1) < argc)
+			return strdup(argv[i + 1]);
+	}
+	return find_rc_file();
 }
 
 /*
@@ -936,7 +3203,7 @@ static void time_update_cb(XtPointer client_data, XtIntervalId *id)
 	time(&secs);
 	the_time = localtime(&secs);
 	strftime(time_str, 255, app_res.date_time_fmt, the_time);
-	xm_str = XmStringCreateLocalized(time_str);
+	xm_str = xmstr_get(time_str);
 
 	XtSetArg(args[0], XmNlabelString, xm_str);
 	XtSetValues(wdtlabel, args, 1);
@@ -947,7 +3214,7 @@ static void time_update_cb(XtPointer client_data, XtIntervalId *id)
 		init = False;
 	}
 
-	XmStringFree(xm_str);
+	xmstr_release(xm_str);
 	
 	XtAppAddTimeOut(app_context,
 		60000-(the_time->tm_sec * 1000), time_update_cb, NULL);
@@ -957,10 +3224,94 @@ static void time_update_cb(XtPointer client_data, XtIntervalId *id)
  * SIGUSR1 RC file reload request handler
  */
 static void xt_sigusr1_handler(XtPointer client_data, XtSignalId *id)
+{
+	reload_menu();
+}
+
+/*
+ * Reloads the rc file, and watches files it now consists of
+ */
+static void reload_menu(void)
 {
 	/* on parse error, the previous configuration remains active
 	 * and the user is informed about */
-	construct_menu();
+	Boolean loaded = construct_menu();
+	#ifdef DEBUG_MENU
+	struct xmstr_stats st;
+	
+	xmstr_get_stats(&st);
+	printf("XmString cache: %lu hits, %lu misses, %lu bytes saved, "
+		"%u strings (%u unused)\n", st.hits, st.misses, st.bytes_saved,
+		st.count, st.unused);
+	#endif
+	
+	if(!app_res.auto_reload) return;
+	
+	if(loaded)
+		watch_rc_files();
+	else if(rc_watch)
+		tb_watch_rebase(rc_watch); /* don't retry until changed again */
+}
+
+/*
+ * Starts watching files the menu was read from for changes, or updates
+ * the list if already watching. Nothing is watched for the built-in menu.
+ */
+static void watch_rc_files(void)
+{
+	const struct tb_source *sources;
+	size_t count;
+	int errval;
+	
+	if(!rc_file_path) return;
+	
+	if(!rc_watch) {
+		if(!(rc_watch = tb_watch_create())) {
+			perror("malloc");
+			return;
+		}
+		if(tb_watch_fd(rc_watch) != -1) {
+			rc_watch_input = XtAppAddInput(app_context,
+				tb_watch_fd(rc_watch), (XtPointer)XtInputReadMask,
+				rc_watch_input_cb, NULL);
+		}
+	}
+	
+	sources = tb_parser_sources(parser, &count);
+	if((errval = tb_watch_set(rc_watch, sources, count)))
+		fprintf(stderr, "Watching %s: %s\n", rc_file_path, strerror(errval));
+	
+	/* without change notification, changes are checked for periodically */
+	if(tb_watch_fd(rc_watch) == -1 && !rc_watch_timer) {
+		rc_watch_timer = XtAppAddTimeOut(app_context,
+			RC_POLL_INTERVAL, rc_watch_timer_cb, NULL);
+	}
+}
+
+/*
+ * Called when something happens to rc files, or directories they're in.
+ * The reload is delayed until events stop coming for a while, so that
+ * a file being saved in several steps is only parsed once.
+ */
+static void rc_watch_input_cb(XtPointer client_data, int *fd, XtInputId *id)
+{
+	if(!tb_watch_read(rc_watch)) return;
+	
+	if(rc_watch_timer) XtRemoveTimeOut(rc_watch_timer);
+	rc_watch_timer = XtAppAddTimeOut(app_context,
+		RC_RELOAD_DELAY, rc_watch_timer_cb, NULL);
+}
+
+static void rc_watch_timer_cb(XtPointer client_data, XtIntervalId *id)
+{
+	rc_watch_timer = 0;
+	
+	if(tb_watch_changed(rc_watch)) reload_menu();
+	
+	if(tb_watch_fd(rc_watch) == -1 && !rc_watch_timer) {
+		rc_watch_timer = XtAppAddTimeOut(app_context,
+			RC_POLL_INTERVAL, rc_watch_timer_cb, NULL);
+	}
 }
 
 /*
@@ -991,16 +3342,16 @@ static void exec_cb(Widget w, XtPointer client_data, XtPointer call_data)
 		XtTranslations alt_tt = NULL;
 
 		n = 0;
-		xm_title = XmStringCreateLocalized(APP_TITLE);
-		xm_prompt = XmStringCreateLocalized("Specify a command");
+		xm_title = xmstr_get(APP_TITLE);
+		xm_prompt = xmstr_get("Specify a command");
 		XtSetArg(args[n], XmNdialogTitle, xm_title); n++;
 		XtSetArg(args[n], XmNokCallback, callback); n++;
 		XtSetArg(args[n], XmNcancelCallback, callback); n++;
 		XtSetArg(args[n], XmNselectionLabelString, xm_prompt); n++;
 
 		wdlg = XmCreatePromptDialog(wshell, "promptDialog", args, n);
-		XmStringFree(xm_title);
-		XmStringFree(xm_prompt);
+		xmstr_release(xm_title);
+		xmstr_release(xm_prompt);
 
 		wtext = XmSelectionBoxGetChild(wdlg, XmDIALOG_TEXT);
 		alt_tt = XtParseTranslationTable(alt_tt_src);
@@ -1043,13 +3394,15 @@ static void exec_dialog_cb(Widget w, XtPointer client_data, XtPointer call_data)
 		return;
 	}
 
+	record_launch(command, command);
+	
 	errval = expand_env_vars(command, &exp_cmd);
-	XtFree(command);
-
 	if(errval) {
 		report_exec_error("Failed to parse command string", command, errval);
+		XtFree(command);
 		return;
 	}
+	XtFree(command);
 
 	if((errval = exec_command(exp_cmd)))
 		report_exec_error("Error executing command", exp_cmd, errval);
@@ -1057,6 +3410,215 @@ static void exec_dialog_cb(Widget w, XtPointer client_data, XtPointer call_data)
 	free(exp_cmd);
 }
 
+static void palette_cb(Widget w, XtPointer client_data, XtPointer call_data)
+{
+	show_palette();
+}
+
+/*
+ * Shows the command palette, indexing commands of the menu
+ * if it has been (re)loaded since the palette was last shown.
+ */
+static void show_palette(void)
+{
+	int errval;
+	
+	if(!palette_search && !(palette_search = tb_search_create())) {
+		perror("malloc");
+		return;
+	}
+	if(palette_stale) {
+		if((errval = tb_search_index(palette_search, menu_shown)))
+			fprintf(stderr, "Command palette: %s\n", strerror(errval));
+		palette_stale = False;
+	}
+	
+	if(!wpalette) create_palette();
+	
+	XmTextFieldSetString(wpalette_text, "");
+	update_palette();
+	
+	XtManageChild(wpalette);
+	raise_and_focus(XtParent(wpalette));
+	XmProcessTraversal(wpalette_text, XmTRAVERSE_CURRENT);
+}
+
+static void create_palette(void)
+{
+	static XtActionsRec actions[] = {
+		{ "palette-move", palette_move_action },
+		{ "palette-close", palette_close_action }
+	};
+	static char text_tt_src[] =
+		"<Key>osfUp: palette-move(-1)\n"
+		"<Key>osfDown: palette-move(1)\n"
+		"<Key>osfPageUp: palette-move(-10)\n"
+		"<Key>osfPageDown: palette-move(10)\n"
+		"<Key>osfCancel: palette-close()\n";
+	static char list_tt_src[] =
+		"<Key>osfCancel: palette-close()\n";
+	XtCallbackRec filter_cb[] = {
+		{ (XtCallbackProc)palette_filter_cb, NULL },
+		{ (XtCallbackProc)NULL, (XtPointer)NULL }
+	};
+	XtCallbackRec activate_cb[] = {
+		{ (XtCallbackProc)palette_activate_cb, NULL },
+		{ (XtCallbackProc)NULL, (XtPointer)NULL }
+	};
+	XmString title;
+	Arg args[10];
+	int n = 0;
+	
+	XtAppAddActions(app_context, actions, XtNumber(actions));
+	
+	title = xmstr_get("Find Command");
+	XtSetArg(args[n], XmNdialogTitle, title); n++;
+	XtSetArg(args[n], XmNautoUnmanage, False); n++;
+	wpalette = XmCreateFormDialog(wshell, "paletteDialog", args, n);
+	xmstr_release(title);
+	
+	n = 0;
+	XtSetArg(args[n], XmNtopAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNleftAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNrightAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNcolumns, 48); n++;
+	XtSetArg(args[n], XmNvalueChangedCallback, filter_cb); n++;
+	XtSetArg(args[n], XmNactivateCallback, activate_cb); n++;
+	wpalette_text = XmCreateTextField(wpalette, "paletteText", args, n);
+	XtOverrideTranslations(wpalette_text,
+		XtParseTranslationTable(text_tt_src));
+	
+	n = 0;
+	XtSetArg(args[n], XmNtopAttachment, XmATTACH_WIDGET); n++;
+	XtSetArg(args[n], XmNtopWidget, wpalette_text); n++;
+	XtSetArg(args[n], XmNbottomAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNleftAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNrightAttachment, XmATTACH_FORM); n++;
+	XtSetArg(args[n], XmNvisibleItemCount, 12); n++;
+	XtSetArg(args[n], XmNselectionPolicy, XmBROWSE_SELECT); n++;
+	XtSetArg(args[n], XmNdefaultActionCallback, activate_cb); n++;
+	wpalette_list = XmCreateScrolledList(wpalette, "paletteList", args, n);
+	XtOverrideTranslations(wpalette_list,
+		XtParseTranslationTable(list_tt_src));
+	
+	XtManageChild(wpalette_text);
+	XtManageChild(wpalette_list);
+	XtVaSetValues(wpalette, XmNinitialFocus, wpalette_text, NULL);
+}
+
+/*
+ * Lists best matches of the text typed in the palette, selecting the first
+ */
+static void update_palette(void)
+{
+	XmString labels[PALETTE_MAX_ITEMS];
+	char *pattern;
+	unsigned int i;
+	
+	pattern = XmTextFieldGetString(wpalette_text);
+	palette_nitems = tb_search_query(palette_search, pattern,
+		palette_items, PALETTE_MAX_ITEMS, NULL);
+	XtFree(pattern);
+	
+	for(i = 0; i < palette_nitems; i++) {
+		labels[i] = xmstr_get(tb_search_path(palette_search,
+			palette_items[i]));
+	}
+	XmListDeleteAllItems(wpalette_list);
+	XmListAddItemsUnselected(wpalette_list, labels, palette_nitems, 0);
+	for(i = 0; i < palette_nitems; i++) xmstr_release(labels[i]);
+	
+	if(palette_nitems) XmListSelectPos(wpalette_list, 1, False);
+}
+
+/*
+ * Runs the command of the item selected in the palette and hides it
+ */
+static void run_palette_item(void)
+{
+	const char *command;
+	const char *path;
+	const char *title;
+	unsigned int item;
+	char *exp_cmd;
+	int *pos = NULL;
+	int count = 0;
+	int errval;
+	
+	if(!XmListGetSelectedPos(wpalette_list, &pos, &count)) return;
+	if(pos[0] < 1 || pos[0] > (int)palette_nitems) {
+		XtFree((char*)pos);
+		return;
+	}
+	item = palette_items[pos[0] - 1];
+	XtFree((char*)pos);
+	
+	XtUnmanageChild(wpalette);
+	
+	/* logged under the entry's own title, as if run from the menu */
+	command = tb_search_command(palette_search, item);
+	path = tb_search_path(palette_search, item);
+	while((title = strstr(path, TB_SEARCH_PATH_SEP)))
+		path = title + strlen(TB_SEARCH_PATH_SEP);
+	record_launch(path, command);
+	
+	if((errval = expand_env_vars(command, &exp_cmd))) {
+		report_exec_error("Failed to parse command string", command, errval);
+		return;
+	}
+	if((errval = exec_command(exp_cmd)))
+		report_exec_error("Error executing command", exp_cmd, errval);
+	free(exp_cmd);
+}
+
+static void palette_filter_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	update_palette();
+}
+
+static void palette_activate_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	run_palette_item();
+}
+
+/*
+ * Moves the palette list selection by the number of items given
+ */
+static void palette_move_action(Widget w, XEvent *evt,
+	String *params, Cardinal *nparams)
+{
+	int *pos = NULL;
+	int count = 0;
+	int cur = 1, top = 1, visible = 1;
+	
+	if(!palette_nitems || *nparams != 1) return;
+	
+	if(XmListGetSelectedPos(wpalette_list, &pos, &count)) {
+		cur = pos[0];
+		XtFree((char*)pos);
+	}
+	cur += atoi(params[0]);
+	if(cur < 1) cur = 1;
+	if(cur > (int)palette_nitems) cur = palette_nitems;
+	
+	XmListSelectPos(wpalette_list, cur, False);
+	
+	XtVaGetValues(wpalette_list, XmNtopItemPosition, &top,
+		XmNvisibleItemCount, &visible, NULL);
+	if(cur < top)
+		XmListSetPos(wpalette_list, cur);
+	else if(cur >= top + visible)
+		XmListSetBottomPos(wpalette_list, cur);
+}
+
+static void palette_close_action(Widget w, XEvent *evt,
+	String *params, Cardinal *nparams)
+{
+	XtUnmanageChild(wpalette);
+}
+
 /*
  * Displays a blocking message dialog. If 'confirm' is True, the dialog will
  * have OK+Cancel buttons, OK only otherwise. Returns True if OK was chosen.
@@ -1074,8 +3636,8 @@ static Boolean message_dialog(Boolean confirm, const char *message_str)
 		{(XtCallbackProc)NULL,(XtPointer)NULL}
 	};
 
-	xm_message_str=XmStringCreateLocalized((char*)message_str);
-	xm_title=XmStringCreateLocalized(APP_TITLE);
+	xm_message_str=xmstr_get(message_str);
+	xm_title=xmstr_get(APP_TITLE);
 
 	XtSetArg(args[n], XmNdialogTitle, xm_title); n++;
 	XtSetArg(args[n], XmNokCallback, callback); n++;
@@ -1093,8 +3655,8 @@ static Boolean message_dialog(Boolean confirm, const char *message_str)
 	
 	XtSetValues(wdlg, args, n);
 
-	XmStringFree(xm_title);
-	XmStringFree(xm_message_str);
+	xmstr_release(xm_title);
+	xmstr_release(xm_message_str);
 
 	if(!confirm) XtUnmanageChild(
 		XmMessageBoxGetChild(wdlg, XmDIALOG_CANCEL_BUTTON));
@@ -1132,78 +3694,112 @@ static void message_dialog_cb(Widget w, XtPointer client_data,
 
 static int exec_command(const char *cmd_spec)
 {
-	pid_t pid;
 	char *str;
-	char *p, *t;
-	char pc = 0;
-	int done = 0;
-	char **argv = NULL;
-	size_t argv_size = 0;
-	unsigned int argc = 0;
-	volatile int errval = 0;
+	char **argv;
+	int errval;
 	
-	str = strdup(cmd_spec);
+	if((errval = split_command(cmd_spec, &str, &argv))) return errval;
+	
+	errval = exec_argv(NULL, argv);
+	
+	free(str);
+	free(argv);
+	return errval;
+}
 
-	p = str;
-	t = NULL;
+/*
+ * Opens a file with the fileOpener command
+ */
+static int open_file(const char *path)
+{
+	char *str;
+	char **argv;
+	char **new_ptr;
+	unsigned int argc = 0;
+	int errval;
 	
-	/* split the command string into separate arguments */
-	while(!done){
-		if(!t){
-			while(*p && isblank((int)*p)) p++;
-			if(*p == '\0') break;
-			t = p;
-		}
+	if((errval = split_command(app_res.file_opener, &str, &argv)))
+		return errval;
+	
+	while(argv[argc]) argc++;
+	
+	new_ptr = realloc(argv, (argc + 2) * sizeof(char*));
+	if(!new_ptr) {
+		free(str);
+		free(argv);
+		return ENOMEM;
+	}
+	argv = new_ptr;
+	argv[argc] = (char*)path;
+	argv[argc + 1] = NULL;
+	
+	errval = exec_argv(NULL, argv);
+	
+	free(str);
+	free(argv);
+	return errval;
+}
+
+/*
+ * Runs the command in argv. If path to the executable is given, argv[0]
+ * isn't searched for in PATH, unless the file is no longer there.
+ */
+static int exec_argv(const char *path, char **argv)
+{
+	pid_t pid;
+	volatile int errval = 0;
+
+	pid = vfork();
+	if(pid == 0){
+		setsid();
 		
-		if(*p == '\"' || *p == '\''){
-			if(pc == '\\'){
-				/* literal " or ' */
-				memmove(p - 1, p, strlen(p) + 1);
-			}else{
-				/* quotation marks, remove them ignoring blanks within */
-				memmove(p, p + 1, strlen(p));
-				while(*p != '\"' && *p != '\''){
-					if(*p == '\0'){
-						if(argv) free(argv);
-						return EINVAL;
-					}
-					p++;
-				}
-				memmove(p, p + 1, strlen(p));
-			}
-		}
-		if(isblank((int)*p) || *p == '\0'){
-			if(*p == '\0') done = 1;
-			if(argv_size < argc+1){
-				char **new_ptr;
-				new_ptr = realloc(argv, (argv_size += 64) * sizeof(char*));
-				if(!new_ptr){
-					free(str);
-					if(argv) free(argv);
-					return ENOMEM;
-				}
-				argv=new_ptr;
+		if(path) {
+			execv(path, argv);
+			if(errno != ENOENT) {
+				errval = errno;
+				_exit(0);
 			}
-			*p = '\0';
-			argv[argc] = t;
-			
-			#ifdef DEBUG_EXEC
-			printf("argv[%d]: %s\n",argc,argv[argc]);
-			#endif
-			
-			t = NULL;
-			argc++;
 		}
-		pc = *p;
-		p++;
+		if(execvp(argv[0],argv) == (-1))
+			errval = errno;
+
+		_exit(0);
+	}else if(pid == -1){
+		errval = errno;
 	}
 	
-	if(!argc) return EINVAL;
-	argv[argc] = NULL;
+	return errval;
+}
+
+/*
+ * Runs a command with its standard output connected to a pipe,
+ * the read end of which is returned in *fd. Returns errno on failure.
+ */
+static int spawn_command(const char *cmd_spec, int *fd)
+{
+	pid_t pid;
+	char *str;
+	char **argv;
+	int pfd[2];
+	volatile int errval = 0;
+	
+	if((errval = split_command(cmd_spec, &str, &argv))) return errval;
+	
+	if(pipe(pfd) == -1) {
+		errval = errno;
+		free(str);
+		free(argv);
+		return errval;
+	}
 	
 	pid = vfork();
 	if(pid == 0){
 		setsid();
+		close(pfd[0]);
+		if(pfd[1] != STDOUT_FILENO) {
+			dup2(pfd[1], STDOUT_FILENO);
+			close(pfd[1]);
+		}
 		
 		if(execvp(argv[0],argv) == (-1))
 			errval = errno;
@@ -1213,6 +3809,12 @@ static int exec_command(const char *cmd_spec)
 		errval = errno;
 	}
 	
+	close(pfd[1]);
+	if(errval)
+		close(pfd[0]);
+	else
+		*fd = pfd[0];
+
 	free(str);
 	free(argv);
 	return errval;
@@ -1242,19 +3844,112 @@ static void menu_command_cb(Widget w,
 	XtPointer client_data, XtPointer call_data)
 {
 	int errval;
-	char *cmd = (char*) client_data;
-	char *exp_cmd;
+	struct menu_command *mc = (struct menu_command*) client_data;
 	
-	errval = expand_env_vars(cmd, &exp_cmd);
-	if(errval) {
-		report_exec_error("Failed to parse command string", cmd, errval);
+	record_launch(mc->title, mc->cmd.in);
+	
+	if((errval = expand_env_vars_memo(&mc->cmd))) {
+		report_exec_error("Failed to parse command string",
+			mc->cmd.in, errval);
 		return;
 	}
 
-	if((errval = exec_command(exp_cmd)))
-		report_exec_error("Error executing command", exp_cmd, errval);
+	/* PATH was checked for changes when the menu was posted */
+	if((errval = prepare_command(mc)) ||
+		(errval = exec_argv(mc->exec_path, mc->argv)))
+		report_exec_error("Error executing command", mc->cmd.out, errval);
+}
+
+/*
+ * Expands and splits the command string, and resolves the executable,
+ * unless already done; the latter again whenever PATH changes.
+ * Returns errno on failure; ENOENT or EACCES if the executable can't be run.
+ */
+static int prepare_command(struct menu_command *mc)
+{
+	int errval;
 	
-	free(exp_cmd);
+	if((errval = expand_env_vars_memo(&mc->cmd))) return errval;
+	
+	if(!mc->argv) {
+		mc->path_gen = 0;
+		if((errval = split_command(mc->cmd.out, &mc->str, &mc->argv)))
+			return errval;
+	}
+	
+	if(mc->path_gen != tb_path_generation()) {
+		mc->exec_path = NULL;
+		mc->path_err = tb_path_resolve(mc->argv[0], &mc->exec_path);
+		if(mc->path_err == ENOMEM) return ENOMEM;
+		mc->path_gen = tb_path_generation();
+	}
+	return mc->path_err;
+}
+
+/*
+ * Re-resolves commands in the pulldown if PATH changed since they were
+ * last resolved, and updates their availability accordingly.
+ */
+static void update_command_items(Widget wpulldown)
+{
+	WidgetList children;
+	Cardinal i, nchildren;
+	
+	tb_path_update();
+	XtVaGetValues(wpulldown, XmNchildren, &children,
+		XmNnumChildren, &nchildren, NULL);
+	
+	for(i = 0; i < nchildren; i++) {
+		struct menu_command *mc = NULL;
+		int errval;
+		
+		if(!XtIsSubclass(children[i], xmPushButtonGadgetClass)) continue;
+
+		XtVaGetValues(children[i], XmNuserData, &mc, NULL);
+		/* resolving may start the cache over, and change generation */
+		if(!mc || mc->path_gen == tb_path_generation()) continue;
+		
+		errval = prepare_command(mc);
+		XtSetSensitive(children[i], (errval != ENOENT && errval != EACCES));
+	}
+}
+
+/*
+ * Creates items of a cascade's pulldown from entries of the menu when it's
+ * first posted, starting with the entry whose index is in the pulldown's
+ * XmNuserData. Commands in it are re-resolved on subsequent posts.
+ */
+static void menu_cascading_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	const struct tb_menu *menu = (const struct tb_menu*)client_data;
+	Widget wpulldown = None;
+	XtPointer first = NULL;
+	Cardinal nchildren = 0;
+	
+	XtVaGetValues(w, XmNsubMenuId, &wpulldown, NULL);
+	if(!wpulldown) return;
+	XtVaGetValues(wpulldown, XmNuserData, &first,
+		XmNnumChildren, &nchildren, NULL);
+	
+	if(nchildren) {
+		update_command_items(wpulldown);
+	} else {
+		tb_path_update();
+		create_menu_items(wpulldown, menu, (int)(intptr_t)first);
+	}
+	touch_resident_menu(w, wpulldown);
+}
+
+static void menu_command_destroy_cb(Widget w,
+	XtPointer client_data, XtPointer call_data)
+{
+	struct menu_command *mc = (struct menu_command*) client_data;
+	
+	free_env_memo(&mc->cmd);
+	free(mc->str);
+	free(mc->argv);
+	free(mc);
 }
 
 /*
@@ -29,255 +29,1017 @@
 #include <errno.h>
 #include <ctype.h>
 #include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "tbparse.h"
 
-static char* get_line(void);
-static char* skip_blanks(char *p);
-static void parse_line(char *line, struct tb_entry *e);
-static void set_parse_error(int line, const char *text);
-static struct tb_entry* add_entry(const struct tb_entry *ent);
-static int parse_buffer(void);
-
 #define MAX_PARSE_ERROR	256
-static char parse_error[MAX_PARSE_ERROR];
 
-static char *buffer = NULL;
-static char *buf_ptr = NULL;
-struct tb_entry *entries = NULL;
+/* Nesting limit for INCLUDE directives, catches circular inclusion too */
+#define MAX_INCLUDE_DEPTH 16
+
+/* Drop-in fragment directory suffix, appended to the menu file name */
+#define DROPIN_SUFFIX ".d"
+
+/* Initial size of the entry array, doubled whenever it fills up */
+#define ARENA_INITIAL_SIZE 512
+
+/* Owns the string pool and the array of entries parsed into it, so that
+ * the whole lot can be released at once on subsequent reload */
+struct tb_arena {
+	char *pool;
+	struct tb_entry *entries;
+	size_t count;
+	size_t size;
+	/* compiled cache image the entries refer to, if adopted */
+	void *image;
+	size_t image_size;
+};
+
+/* A menu file (main, included, or drop-in) parsed at the given nesting
+ * level, cached by its stat signature so that it doesn't need to be
+ * re-parsed on reload unless it changed */
+struct fragment {
+	struct fragment *next;
+	char *path;
+	int base_level;
+	unsigned int gen;
+	struct tb_source sig;
+	/* when the file was read; changes made within the same second
+	 * wouldn't change the signature, so it isn't trusted until later */
+	time_t stamp;
+	struct tb_arena arena;
+};
 
-/* Get next line from global buffer */
-static char* get_line(void)
+/* Location of entry strings within the (read-only) buffer being parsed */
+struct entry_spans {
+	const char *title;
+	size_t title_len;
+	const char *command;
+	size_t command_len;
+	/* title contains escapes or a mnemonic marker */
+	int escaped;
+};
+
+/* Parser context */
+struct tb_parser {
+	/* entries assembled from fragments, or an adopted cache image */
+	struct tb_arena arena;
+	struct tb_menu menu;
+	struct fragment *fragments;
+	unsigned int gen;
+	/* files the current entries were read from */
+	struct tb_source *sources;
+	size_t nsources;
+	size_t sources_size;
+	/* current parsing state */
+	const char *cur_file;
+	int in_fragment;
+	int allow_include;
+	struct tb_arena *arena_in;
+	const char *buf_ptr;
+	const char *buf_end;
+	char parse_error[MAX_PARSE_ERROR];
+};
+
+static const char* get_line(struct tb_parser *p, size_t *len);
+static const char* skip_blanks(const char *p, const char *end);
+static int parse_line(const char *line, size_t len,
+	struct tb_entry *e, struct entry_spans *sp);
+static size_t scan_title(const char *line, size_t len,
+	struct tb_entry *e, int *escaped);
+static char* materialize(char *out,
+	struct tb_entry *e, const struct entry_spans *sp);
+static char* copy_title(char *out, const char *title, size_t len);
+static void set_parse_error(struct tb_parser *p, int line, const char *text);
+static struct tb_entry* add_entry(struct tb_arena *a,
+	const struct tb_entry *ent);
+static int parse_buffer(struct tb_parser *p, int base_level);
+static int link_tree(struct tb_arena *a, int base_level, int *max_level);
+static void set_menu(struct tb_parser *p, int max_level);
+static void free_arena(struct tb_arena *a);
+static void free_sources(struct tb_source *src, size_t count);
+static int add_source(struct tb_source **src, size_t *count, size_t *size,
+	const char *path, const struct tb_source *sig);
+static void set_signature(struct tb_source *sig, const struct stat *st);
+static int parse_file(struct tb_parser *p, int fd,
+	const struct stat *st, int base_level);
+static int get_fragment(struct tb_parser *p, const char *path,
+	int base_level, int depth, struct fragment **ret);
+static int assemble(struct tb_parser *p, struct tb_arena *out,
+	const char *path, int base_level, int depth);
+static int assemble_dropins(struct tb_parser *p,
+	struct tb_arena *out, const char *filename);
+
+/*
+ * Returns the next line in the parser's buffer, with leading and trailing
+ * blanks excluded, and its length in *len. Returns NULL at the end.
+ */
+static const char* get_line(struct tb_parser *ps, size_t *len)
 {
-	char *p, *cur = buf_ptr;
-	
-	if(*buf_ptr == '\0') return NULL;
-	
-	p = strchr(buf_ptr,'\n');
-	
+	const char *p, *cur = ps->buf_ptr;
+
+	if(cur == ps->buf_end) return NULL;
+
+	p = memchr(cur, '\n', ps->buf_end - cur);
+
 	if(p){
-		buf_ptr = p + 1;
-		*p = '\0';
+		ps->buf_ptr = p + 1;
 	} else {
-		p = buf_ptr;
-		
-		while(*p != '\0') p++;
-		
-		buf_ptr = p;
+		p = ps->buf_end;
+		ps->buf_ptr = p;
 	}
 
-	while(p != cur) {
-		p--;
-		
-		if(*p == ' ' || *p == '\t')
-			*p = '\0';
-		else
-			break;
-	}
-	return skip_blanks(cur);
+	while(p != cur && (p[-1] == ' ' || p[-1] == '\t')) p--;
+
+	cur = skip_blanks(cur, p);
+	*len = p - cur;
+	return cur;
 }
 
-static char* skip_blanks(char *p)
+static const char* skip_blanks(const char *p, const char *end)
 {
-	while(*p == '\t' || *p == ' ') p++;
+	while(p != end && (*p == '\t' || *p == ' ')) p++;
 	return p;
 }
 
-/* Parses a line into the given entry structure */
-static void parse_line(char *line, struct tb_entry *e)
+/*
+ * Returns length of the title part of a line, i.e. up to the first
+ * unescaped ':', and stores the mnemonic character in the entry.
+ * *escaped is set if the title needs to be unescaped when copied.
+ */
+static size_t scan_title(const char *line, size_t len,
+	struct tb_entry *e, int *escaped)
 {
-	char *p = line;
-	
-	memset(e, 0, sizeof(struct tb_entry));
-	
-	if(!strcmp(line,"SEPARATOR")){
-		e->type=TBE_SEPARATOR;
-		return;	
+	const char *p = line;
+	const char *end = line + len;
+	const char *colon;
+	size_t title_len;
+
+	colon = memchr(line, ':', len);
+	title_len = colon ? (size_t)(colon - line) : len;
+
+	/* common case, no escapes or mnemonic to worry about */
+	if(!memchr(line, '\\', title_len) && !memchr(line, '&', title_len)) {
+		*escaped = 0;
+		return title_len;
 	}
-	
-	e->title = line;
-	
-	while(*p != '\0'){
-		if(*p == '\\' && (p[1] == '\\' || p[1] == '&' || p[1] == ':')){
-			memmove(p, p + 1, strlen(p + 1) + 1);
+	*escaped = 1;
+
+	while(p != end) {
+		if(*p == '\\' && p + 1 != end &&
+			(p[1] == '\\' || p[1] == '&' || p[1] == ':')) {
+			p++;
 		} else if(*p == '&') {
-			e->mnemonic = p[1];
-			memmove(p, p + 1,strlen(p + 1) + 1);
+			e->mnemonic = (p + 1 != end) ? p[1] : 0;
+			p++;
+			if(p == end) break;
 		} else if(*p == ':') {
-			e->command = skip_blanks(p + 1);
-			*p = '\0';
 			break;
 		}
 		p++;
 	}
-	if(e->command)
-		e->type = TBE_COMMAND;
-	else
+	return p - line;
+}
+
+/*
+ * Parses a line into the given entry structure, and records locations
+ * of its strings in 'sp'. Returns -1 if malformed.
+ */
+static int parse_line(const char *line, size_t len,
+	struct tb_entry *e, struct entry_spans *sp)
+{
+	const char *end = line + len;
+	const char *p;
+
+	memset(e, 0, sizeof(struct tb_entry));
+	memset(sp, 0, sizeof(struct entry_spans));
+
+	if(len == 9 && !memcmp(line, "SEPARATOR", 9)){
+		e->type=TBE_SEPARATOR;
+		return 0;
+	}
+
+	if(len > 7 && !memcmp(line, "INCLUDE", 7) &&
+		(line[7] == ' ' || line[7] == '\t')){
+		e->type = TBE_INCLUDE;
+		sp->command = skip_blanks(line + 8, end);
+		sp->command_len = end - sp->command;
+		return 0;
+	}
+
+	sp->title = line;
+	sp->title_len = scan_title(line, len, e, &sp->escaped);
+
+	if(sp->title_len == len) {
 		e->type = TBE_CASCADE;
+		return 0;
+	}
+
+	p = skip_blanks(line + sp->title_len + 1, end);
+	e->type = TBE_COMMAND;
+	e->ttl = TB_DEFAULT_TTL;
+
+	/* @pipe[ttl] command */
+	if(end - p >= 5 && !memcmp(p, "@pipe", 5) &&
+		(p + 5 == end || p[5] == '[' || p[5] == ' ' || p[5] == '\t')) {
+		p += 5;
+		if(p != end && *p == '[') {
+			const char *digits = ++p;
+
+			e->ttl = 0;
+			while(p != end && *p >= '0' && *p <= '9' &&
+				e->ttl < 100000000) {
+				e->ttl = e->ttl * 10 + (*p - '0');
+				p++;
+			}
+			if(p == digits || p == end || *p != ']') return -1;
+			p++;
+		}
+		e->type = TBE_PIPE;
+		p = skip_blanks(p, end);
+	} else if(end - p >= 4 && !memcmp(p, "@dir", 4) &&
+		(p + 4 == end || p[4] == ' ' || p[4] == '\t')) {
+		e->type = TBE_DIRECTORY;
+		p = skip_blanks(p + 4, end);
+	} else if(end - p == 13 && !memcmp(p, "@applications", 13)) {
+		e->type = TBE_APPLICATIONS;
+		p = end;
+	}
+	sp->command = p;
+	sp->command_len = end - p;
+	return 0;
 }
 
-/* Parses the global buffer */
-static int parse_buffer(void)
+/*
+ * Parses the buffer being read by the parser into a fragment arena.
+ * Scopes opened in the fragment must not be closed beyond base_level.
+ * The buffer is only read; entry strings are copied into the arena's
+ * pool, which is never larger than the buffer itself.
+ */
+static int parse_buffer(struct tb_parser *ps, int base_level)
 {
-	char *line;
+	const char *line;
+	size_t len;
 	struct tb_entry tmp;
+	struct entry_spans sp;
 	struct tb_entry *prev = NULL;
-	int nlevel = 0;
+	struct tb_arena *a = ps->arena_in;
+	char *out;
+	char *icon = NULL;
+	int nlevel = base_level;
 	int iline = 0;
-	
-	while((line = get_line())){
+
+	/* each title, command and icon path are shorter than the line they
+	 * came from, by at least the length of their terminators (':' or
+	 * "ICON", and '\n') */
+	if(!(a->pool = malloc((ps->buf_end - ps->buf_ptr) + 1))) return ENOMEM;
+	out = a->pool;
+
+	while((line = get_line(ps, &len))){
 		iline++;
-		
-		if(*line == '\0' || *line == '#'){
+
+		if(len == 0 || *line == '#'){
+			continue;
+		}else if(len > 4 && !memcmp(line, "ICON", 4) &&
+			(line[4] == ' ' || line[4] == '\t')){
+			/* applies to the entry that follows */
+			const char *path = skip_blanks(line + 5, line + len);
+			
+			if(icon) {
+				set_parse_error(ps, iline, "ICON must precede a menu entry");
+				return -1;
+			}
+			icon = out;
+			memcpy(out, path, len - (path - line));
+			out += len - (path - line);
+			*out++ = '\0';
 			continue;
+		}else if(icon && (*line == '{' || *line == '}')){
+			set_parse_error(ps, iline, "ICON must precede a menu entry");
+			return -1;
 		}else if(*line == '{'){
-			if(!prev || prev->type != TBE_CASCADE){
-				set_parse_error(iline,
+			/* the scope must not have been opened already */
+			if(!prev || prev->type != TBE_CASCADE || prev->level != nlevel){
+				set_parse_error(ps, iline,
 					"Delimiter \'{\' must follow a cascade entry");
 				return -1;
 			}
 			nlevel++;
 			continue;
 		}else if(*line == '}'){
-			if(!nlevel || prev->type != TBE_COMMAND){
-				set_parse_error(iline,"Delimiter \'}\' out of scope");
+			if(nlevel == base_level || prev->type == TBE_CASCADE ||
+				prev->type == TBE_SEPARATOR){
+				set_parse_error(ps, iline,"Delimiter \'}\' out of scope");
 				return -1;
 			}
 			nlevel--;
 			continue;
 		}else if(prev && prev->type == TBE_CASCADE && prev->level == nlevel){
-			set_parse_error(iline,"Cascade entry must have a menu scope");
+			set_parse_error(ps, iline,"Cascade entry must have a menu scope");
 			return -1;
 		}
 
-		parse_line(line, &tmp);
+		if(parse_line(line, len, &tmp, &sp)) {
+			set_parse_error(ps, iline, "Malformed @pipe cache time");
+			return -1;
+		}
 		tmp.level = nlevel;
+		
+		if(icon) {
+			if(tmp.type == TBE_INCLUDE || tmp.type == TBE_SEPARATOR) {
+				set_parse_error(ps, iline, "ICON must precede a menu entry");
+				return -1;
+			}
+			tmp.icon = icon;
+			icon = NULL;
+		}
 
-		if(tmp.type == TBE_COMMAND) {
+		if(tmp.type == TBE_INCLUDE) {
+			if(!ps->allow_include) {
+				set_parse_error(ps, iline, "INCLUDE is not allowed here");
+				return -1;
+			}
+			if(!sp.command_len) {
+				set_parse_error(ps, iline,
+					"File name expected after INCLUDE");
+				return -1;
+			}
+		} else if(tmp.type == TBE_PIPE) {
+			if(!sp.command_len) {
+				set_parse_error(ps, iline,
+					"Command string expected after @pipe");
+				return -1;
+			}
+		} else if(tmp.type == TBE_DIRECTORY) {
+			if(!sp.command_len) {
+				set_parse_error(ps, iline,
+					"Directory path expected after @dir");
+				return -1;
+			}
+		} else if(tmp.type == TBE_COMMAND) {
 			if(tmp.level < 1){
-				set_parse_error(iline,
+				set_parse_error(ps, iline,
 					"Command entries must reside within a menu scope");
 				return -1;
 			}
-			if(!strlen(tmp.command)) {
-				set_parse_error(iline,
+			if(!sp.command_len) {
+				set_parse_error(ps, iline,
 					"Command string expected after ':' ");
 				return -1;
 			}
 		} else if(tmp.type == TBE_CASCADE) {
-			size_t len = strlen(tmp.title);
-			char *p = tmp.title + (len - 1);
 			/* allow { on the same line as menu title */
-			if(*p == '{') {
+			if(sp.title[sp.title_len - 1] == '{') {
 				nlevel++;
-				*p = '\0';
-				p--;
-				
-				while(p != tmp.title && (*p == ' ' || *p == '\t')) {
-					*p = '\0';
-					p--;
-				}
+				sp.title_len--;
+
+				while(sp.title_len && (sp.title[sp.title_len - 1] == ' ' ||
+					sp.title[sp.title_len - 1] == '\t')) sp.title_len--;
 			}
 		}
-		
-		if((prev = add_entry(&tmp)) == NULL) return ENOMEM;
+
+		out = materialize(out, &tmp, &sp);
+
+		if((prev = add_entry(a, &tmp)) == NULL) return ENOMEM;
+	}
+
+	if(icon) {
+		set_parse_error(ps, iline, "ICON must precede a menu entry");
+		return -1;
+	}
+	/* a dangling cascade would misplace entries following the fragment */
+	if(ps->in_fragment && prev &&
+		prev->type == TBE_CASCADE && prev->level == nlevel) {
+		set_parse_error(ps, iline, "Cascade entry must have a menu scope");
+		return -1;
 	}
 	return 0;
 }
 
-static void set_parse_error(int line, const char *text)
+/*
+ * Copies entry strings from the buffer to 'out', unescaping the title if
+ * necessary, and points the entry at them. Returns the new 'out' position.
+ */
+static char* materialize(char *out,
+	struct tb_entry *e, const struct entry_spans *sp)
 {
-	snprintf(parse_error,MAX_PARSE_ERROR,"Line %d: %s",line,text);
+	if(sp->title) {
+		e->title = out;
+		if(sp->escaped) {
+			out = copy_title(out, sp->title, sp->title_len);
+		} else {
+			memcpy(out, sp->title, sp->title_len);
+			out += sp->title_len;
+		}
+		*out++ = '\0';
+	}
+	if(sp->command) {
+		e->command = out;
+		memcpy(out, sp->command, sp->command_len);
+		out += sp->command_len;
+		*out++ = '\0';
+	}
+	return out;
+}
+
+/* Copies a title string, removing escapes and mnemonic markers */
+static char* copy_title(char *out, const char *title, size_t len)
+{
+	const char *end = title + len;
+
+	while(title != end) {
+		if(*title == '\\' && title + 1 != end && (title[1] == '\\' ||
+			title[1] == '&' || title[1] == ':')) {
+			title++;
+		} else if(*title == '&') {
+			title++;
+			if(title == end) break;
+		}
+		*out++ = *title++;
+	}
+	return out;
+}
+
+static void set_parse_error(struct tb_parser *p, int line, const char *text)
+{
+	if(p->in_fragment) {
+		snprintf(p->parse_error, MAX_PARSE_ERROR,
+			"%s, line %d: %s", p->cur_file, line, text);
+	} else {
+		snprintf(p->parse_error,MAX_PARSE_ERROR,"Line %d: %s",line,text);
+	}
 }
 
-/* Duplicates the given entry and adds it to the global list */
-static struct tb_entry* add_entry(const struct tb_entry *ent)
+/*
+ * Appends a copy of the given entry to the arena's entry array. The pointer
+ * returned is valid until the next call.
+ */
+static struct tb_entry* add_entry(struct tb_arena *a,
+	const struct tb_entry *ent)
 {
 	struct tb_entry *new;
 
-	new = malloc(sizeof(struct tb_entry));
-	if(!new) return NULL;
+	if(a->count == a->size) {
+		size_t new_size = a->size ? (a->size * 2) : ARENA_INITIAL_SIZE;
+		
+		new = realloc(a->entries, new_size * sizeof(struct tb_entry));
+		if(!new) return NULL;
+		a->entries = new;
+		a->size = new_size;
+	}
+	new = &a->entries[a->count++];
 	memcpy(new, ent, sizeof(struct tb_entry));
+	return new;
+}
+
+/* Releases the pool and all entries owned by the arena */
+static void free_arena(struct tb_arena *a)
+{
+	free(a->entries);
+	free(a->pool);
+	if(a->image) munmap(a->image, a->image_size);
+	memset(a, 0, sizeof(struct tb_arena));
+}
+
+/*
+ * Computes parent, sibling and child count links of entries in the arena
+ * from their levels. Returns EINVAL if levels don't describe a tree, i.e.
+ * an entry is nested more than one level deeper than the preceding one,
+ * or within anything but a cascade.
+ */
+static int link_tree(struct tb_arena *a, int base_level, int *max_level)
+{
+	struct tb_entry *ents = a->entries;
+	int *last;
+	int level = base_level;
+	size_t i;
 	
-	if(!entries){
-		entries = new;
-		new->next = NULL;
-	} else {
-		struct tb_entry *last = entries;
-		while(last->next) last = last->next;
+	*max_level = base_level;
+	
+	for(i = 0; i < a->count; i++) {
+		if(ents[i].level < base_level || ents[i].level > level + 1 ||
+			(ents[i].level == level + 1 &&
+			(!i || ents[i - 1].type != TBE_CASCADE))) return EINVAL;
+		level = ents[i].level;
+		if(level > *max_level) *max_level = level;
+	}
+	if(a->count > INT_MAX) return EINVAL;
+	
+	/* index of the most recent entry seen at each level */
+	last = malloc((*max_level - base_level + 1) * sizeof(int));
+	if(!last) return ENOMEM;
+	for(level = 0; level <= *max_level - base_level; level++)
+		last[level] = -1;
+
+	for(i = 0; i < a->count; i++) {
+		level = ents[i].level - base_level;
+		
+		ents[i].parent = level ? last[level - 1] : -1;
+		ents[i].sibling = -1;
+		ents[i].nchildren = 0;
+
+		if(ents[i].parent != -1) ents[ents[i].parent].nchildren++;
+		
+		/* preceding entry at the same level is a sibling, unless it
+		 * belongs to another parent's sub-tree */
+		if(last[level] != -1 && last[level] > ents[i].parent)
+			ents[last[level]].sibling = (int)i;
 		
-		last->next = new;
+		last[level] = (int)i;
 	}
-	return new;
+	free(last);
+	return 0;
+}
+
+/* Points the parser's menu at its arena's entries */
+static void set_menu(struct tb_parser *p, int max_level)
+{
+	p->menu.entries = p->arena.count ? p->arena.entries : NULL;
+	p->menu.count = p->arena.count;
+	p->menu.max_level = max_level;
+}
+
+static void free_sources(struct tb_source *src, size_t count)
+{
+	size_t i;
+	
+	for(i = 0; i < count; i++) free(src[i].path);
+	free(src);
+}
+
+static void set_signature(struct tb_source *sig, const struct stat *st)
+{
+	sig->dev = st->st_dev;
+	sig->ino = st->st_ino;
+	sig->size = st->st_size;
+	sig->mtime = st->st_mtime;
+}
+
+/* Records a file signature; sig may be NULL for files that don't exist */
+static int add_source(struct tb_source **src, size_t *count, size_t *size,
+	const char *path, const struct tb_source *sig)
+{
+	struct tb_source *s;
+
+	if(*count == *size) {
+		s = realloc(*src, (*size + 16) * sizeof(struct tb_source));
+		if(!s) return ENOMEM;
+		*src = s;
+		*size += 16;
+	}
+	s = &(*src)[*count];
+	if(sig)
+		*s = *sig;
+	else
+		memset(s, 0, sizeof(struct tb_source));
+	if(!(s->path = strdup(path))) return ENOMEM;
+	(*count)++;
+	return 0;
 }
 
 /*
- * Parses a toolbox menu file.
- * Returns zero on success or errno otherwise.
- * If EINVAL is returned, the file contains syntax errors, and
- * tb_parser_error_string() may be used to obtain detailed information.
+ * Reads the open file and parses it into the parser's current arena. The
+ * file is read rather than mapped, since it may be truncated meanwhile.
  */
-int tb_parse_config(const char *filename, struct tb_entry **ent_root)
+static int parse_file(struct tb_parser *p, int fd,
+	const struct stat *st, int base_level)
 {
-	FILE *file;
-	struct stat st;
+	char *buf;
+	size_t len = 0;
+	ssize_t rd;
 	int err;
-	char *old_buf = buffer;
-	struct tb_entry *old_ent = entries;
-	
-	entries = NULL;
-	parse_error[0]='\0';
 	
-	if(stat(filename, &st) < 0) return errno;
-	if(st.st_size == 0) return EIO;
+	if(!(buf = malloc(st->st_size ? st->st_size : 1))) return ENOMEM;
 	
-	if(!(buffer = malloc(st.st_size + 1))) {
-		buffer = old_buf;
-		return errno;
+	/* a file that grew is re-read on reload, since its size changed */
+	while(len < (size_t)st->st_size) {
+		if((rd = read(fd, buf + len, st->st_size - len)) == -1) {
+			if(errno == EINTR) continue;
+			err = errno;
+			free(buf);
+			return err;
+		}
+		if(!rd) break;
+		len += rd;
 	}
 
-	buf_ptr = buffer;
+	p->buf_ptr = buf;
+	p->buf_end = buf + len;
+	err = parse_buffer(p, base_level);
 	
-	file = fopen(filename, "r");
-	if(!file){
+	free(buf);
+	return err;
+}
+
+/*
+ * Returns a parsed fragment for the file at path, either from the fragment
+ * cache, or by parsing it. Returns zero on success, -1 on syntax errors,
+ * or errno otherwise.
+ */
+static int get_fragment(struct tb_parser *p, const char *path,
+	int base_level, int depth, struct fragment **ret)
+{
+	struct fragment *frag;
+	struct stat st;
+	time_t now = time(NULL);
+	int fd;
+	int err;
+
+	/* the signature must be that of the file actually read */
+	if((fd = open(path, O_RDONLY)) == -1) return errno;
+	if(fstat(fd, &st) == -1) {
 		err = errno;
-		free(buffer);
-		buffer = old_buf;
+		close(fd);
 		return err;
 	}
+	if(!depth && st.st_size == 0) {
+		close(fd);
+		return EIO;
+	}
 
-	if(fread(buffer, 1, st.st_size, file) < st.st_size){
-		err = errno;
-		free(buffer);
-		fclose(file);
-		buffer = old_buf;
+	for(frag = p->fragments; frag; frag = frag->next) {
+		if(frag->base_level == base_level &&
+			frag->sig.dev == st.st_dev && frag->sig.ino == st.st_ino &&
+			frag->sig.size == st.st_size &&
+			frag->sig.mtime == st.st_mtime &&
+			frag->sig.mtime < frag->stamp && !strcmp(frag->path, path)) {
+			frag->gen = p->gen;
+			close(fd);
+			*ret = frag;
+			return 0;
+		}
+	}
+
+	if(!(frag = calloc(1, sizeof(struct fragment)))) {
+		close(fd);
+		return ENOMEM;
+	}
+	
+	if(!(frag->path = strdup(path))) {
+		free(frag);
+		close(fd);
+		return ENOMEM;
+	}
+	frag->base_level = base_level;
+	frag->gen = p->gen;
+	frag->stamp = now;
+	set_signature(&frag->sig, &st);
+	
+	p->arena_in = &frag->arena;
+	p->cur_file = path;
+	p->in_fragment = (depth > 0);
+	p->allow_include = 1;
+	err = parse_file(p, fd, &st, base_level);
+	close(fd);
+
+	if(err) {
+		free_arena(&frag->arena);
+		free(frag->path);
+		free(frag);
 		return err;
 	}
-	fclose(file);
+
+	frag->next = p->fragments;
+	p->fragments = frag;
+	*ret = frag;
+	return 0;
+}
+
+/* Resolves an INCLUDE argument relative to the including file */
+static char* include_path(const char *parent, const char *name)
+{
+	const char *home = getenv("HOME");
+	const char *p;
+	size_t len;
+	char *path;
+
+	if(name[0] == '/') return strdup(name);
+	
+	if(name[0] == '~' && name[1] == '/' && home) {
+		len = strlen(home) + strlen(name);
+		if(!(path = malloc(len))) return NULL;
+		sprintf(path, "%s%s", home, name + 1);
+		return path;
+	}
+
+	p = strrchr(parent, '/');
+	len = (p ? (p - parent) + 1 : 0);
+	if(!(path = malloc(len + strlen(name) + 1))) return NULL;
+	memcpy(path, parent, len);
+	strcpy(path + len, name);
+	return path;
+}
+
+/*
+ * Appends entries of the menu file at path, and of any files it includes,
+ * to the output arena.
+ */
+static int assemble(struct tb_parser *p, struct tb_arena *out,
+	const char *path, int base_level, int depth)
+{
+	struct fragment *frag = NULL;
+	struct tb_entry *e;
+	char *inc_path;
+	size_t i;
+	int err;
+
+	if((err = get_fragment(p, path, base_level, depth, &frag))) return err;
+
+	if((err = add_source(&p->sources, &p->nsources,
+		&p->sources_size, path, &frag->sig))) return err;
+
+	for(i = 0; i < frag->arena.count; i++) {
+		e = &frag->arena.entries[i];
+
+		if(e->type != TBE_INCLUDE) {
+			if(!add_entry(out, e)) return ENOMEM;
+			continue;
+		}
+		if(depth == MAX_INCLUDE_DEPTH) {
+			snprintf(p->parse_error, MAX_PARSE_ERROR,
+				"%s: INCLUDE nested too deeply", path);
+			return -1;
+		}
+		if(!(inc_path = include_path(path, e->command))) return ENOMEM;
 		
-	buffer[st.st_size] = '\0';
+		err = assemble(p, out, inc_path, e->level, depth + 1);
+		if(err > 0) {
+			snprintf(p->parse_error, MAX_PARSE_ERROR,
+				"Cannot include %s: %s", inc_path, strerror(err));
+			err = -1;
+		}
+		free(inc_path);
+		if(err) return err;
+	}
+	return 0;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
 
-	if((err = parse_buffer())){
-		free(buffer);
-		buffer = old_buf;
+/*
+ * Appends top-level menus from the drop-in fragment directory (the menu
+ * file name suffixed with .d), in alphabetical order of file names.
+ */
+static int assemble_dropins(struct tb_parser *p,
+	struct tb_arena *out, const char *filename)
+{
+	DIR *dir;
+	struct dirent *ent;
+	struct stat st;
+	struct tb_source sig;
+	char *dir_path;
+	char *path;
+	char **names = NULL;
+	size_t nnames = 0;
+	size_t names_size = 0;
+	size_t i, len;
+	int err = 0;
+
+	len = strlen(filename) + strlen(DROPIN_SUFFIX) + 1;
+	if(!(dir_path = malloc(len))) return ENOMEM;
+	snprintf(dir_path, len, "%s" DROPIN_SUFFIX, filename);
+
+	/* the directory itself is recorded, so that added and removed
+	 * fragments invalidate cached images */
+	if(stat(dir_path, &st) == -1 || !(dir = opendir(dir_path))) {
+		err = add_source(&p->sources, &p->nsources,
+			&p->sources_size, dir_path, NULL);
+		free(dir_path);
 		return err;
 	}
+	set_signature(&sig, &st);
+	err = add_source(&p->sources, &p->nsources,
+		&p->sources_size, dir_path, &sig);
+	
+	while(!err && (ent = readdir(dir))) {
+		len = strlen(ent->d_name);
+		/* skip hidden files, editor backups and autosaves */
+		if(ent->d_name[0] == '.' || ent->d_name[0] == '#' ||
+			ent->d_name[len - 1] == '~') continue;
+		
+		if(nnames == names_size) {
+			char **new_ptr = realloc(names,
+				(names_size + 64) * sizeof(char*));
+			if(!new_ptr) {
+				err = ENOMEM;
+				break;
+			}
+			names = new_ptr;
+			names_size += 64;
+		}
+		if(!(names[nnames] = strdup(ent->d_name))) err = ENOMEM;
+		else nnames++;
+	}
+	closedir(dir);
+	
+	if(nnames) qsort(names, nnames, sizeof(char*), compare_names);
 
-	if(old_ent){
-		struct tb_entry *tmp, *cur = old_ent;
-		while(cur){
-			tmp = cur;
-			cur = cur->next;
-			free(tmp);
+	for(i = 0; !err && i < nnames; i++) {
+		len = strlen(dir_path) + strlen(names[i]) + 2;
+		if(!(path = malloc(len))) {
+			err = ENOMEM;
+			break;
 		}
+		snprintf(path, len, "%s/%s", dir_path, names[i]);
+		
+		if(stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+			err = assemble(p, out, path, 0, 1);
+			if(err > 0) {
+				snprintf(p->parse_error, MAX_PARSE_ERROR,
+					"%s: %s", path, strerror(err));
+				err = -1;
+			}
+		}
+		free(path);
+	}
+
+	for(i = 0; i < nnames; i++) free(names[i]);
+	free(names);
+	free(dir_path);
+	return err;
+}
+
+/* Frees fragments not used by the latest successful parse */
+static void sweep_fragments(struct tb_parser *p)
+{
+	struct fragment **link = &p->fragments;
+	struct fragment *frag;
+	
+	while((frag = *link)) {
+		if(frag->gen != p->gen) {
+			*link = frag->next;
+			free_arena(&frag->arena);
+			free(frag->path);
+			free(frag);
+		} else {
+			link = &frag->next;
+		}
+	}
+}
+
+struct tb_parser* tb_parser_create(void)
+{
+	return calloc(1, sizeof(struct tb_parser));
+}
+
+void tb_parser_destroy(struct tb_parser *p)
+{
+	p->gen++;
+	sweep_fragments(p);
+	free_arena(&p->arena);
+	free_sources(p->sources, p->nsources);
+	free(p);
+}
+
+/*
+ * Parses a toolbox menu file, along with files it includes and drop-in
+ * fragments. Only files that changed since the previous call are parsed,
+ * others are taken from the fragment cache.
+ * Returns zero on success or errno otherwise.
+ * If EINVAL is returned, the file contains syntax errors, and
+ * tb_parser_error() may be used to obtain detailed information.
+ */
+int tb_parser_parse(struct tb_parser *p,
+	const char *filename, const struct tb_menu **menu)
+{
+	struct tb_arena out;
+	struct tb_source *old_sources = p->sources;
+	size_t old_nsources = p->nsources;
+	size_t old_sources_size = p->sources_size;
+	int max_level = 0;
+	int err;
+	
+	memset(&out, 0, sizeof(struct tb_arena));
+	p->parse_error[0]='\0';
+	p->sources = NULL;
+	p->nsources = 0;
+	p->sources_size = 0;
+	p->gen++;
+
+	err = assemble(p, &out, filename, 0, 0);
+	if(!err) err = assemble_dropins(p, &out, filename);
+	if(!err) err = link_tree(&out, 0, &max_level);
+	
+	if(err) {
+		free_arena(&out);
+		free_sources(p->sources, p->nsources);
+		p->sources = old_sources;
+		p->nsources = old_nsources;
+		p->sources_size = old_sources_size;
+		return err;
 	}
+	
+	free_arena(&p->arena);
+	free_sources(old_sources, old_nsources);
+	p->arena = out;
+	set_menu(p, max_level);
+	sweep_fragments(p);
+
+	*menu = &p->menu;
+
+	return 0;
+}
+
+int tb_parser_parse_string(struct tb_parser *p, const char *name,
+	const char *text, size_t len, int base_level, const struct tb_menu **menu)
+{
+	struct tb_arena out;
+	int max_level;
+	int err;
+
+	memset(&out, 0, sizeof(struct tb_arena));
+	p->parse_error[0] = '\0';
+
+	p->buf_ptr = text;
+	p->buf_end = text + len;
+	p->arena_in = &out;
+	p->cur_file = name;
+	p->in_fragment = 1;
+	p->allow_include = 0;
+
+	err = parse_buffer(p, base_level);
+	if(!err) err = link_tree(&out, base_level, &max_level);
+	
+	if(err) {
+		free_arena(&out);
+		return err;
+	}
+	
+	free_arena(&p->arena);
+	free_sources(p->sources, p->nsources);
+	p->sources = NULL;
+	p->nsources = 0;
+	p->sources_size = 0;
+	p->arena = out;
+	set_menu(p, max_level);
+	
+	*menu = &p->menu;
+	return 0;
+}
 
-	*ent_root = entries;
+int tb_parser_adopt_image(struct tb_parser *p, void *image, size_t size,
+	struct tb_entry *entries, unsigned int count)
+{
+	struct tb_arena in;
+	int max_level;
+	int err;
 
+	memset(&in, 0, sizeof(struct tb_arena));
+	in.entries = entries;
+	in.count = count;
+	in.size = count;
+	if((err = link_tree(&in, 0, &max_level))) return err;
+	
+	free_arena(&p->arena);
+	free_sources(p->sources, p->nsources);
+	p->sources = NULL;
+	p->nsources = 0;
+	p->sources_size = 0;
+	p->arena = in;
+	p->arena.image = image;
+	p->arena.image_size = size;
+	set_menu(p, max_level);
 	return 0;
 }
 
-char* tb_parser_error_string(void)
+int tb_parser_add_source(struct tb_parser *p,
+	const char *path, const struct stat *st)
+{
+	struct tb_source sig;
+
+	if(st) set_signature(&sig, st);
+	return add_source(&p->sources, &p->nsources,
+		&p->sources_size, path, st ? &sig : NULL);
+}
+
+const struct tb_source* tb_parser_sources(struct tb_parser *p, size_t *count)
+{
+	*count = p->nsources;
+	return p->sources;
+}
+
+const struct tb_menu* tb_parser_menu(struct tb_parser *p)
+{
+	return &p->menu;
+}
+
+void tb_parser_release(struct tb_parser *p)
+{
+	free_arena(&p->arena);
+	set_menu(p, 0);
+}
+
+const char* tb_parser_error(struct tb_parser *p)
 {
-	return (parse_error[0] == '\0') ? NULL : parse_error;
+	return (p->parse_error[0] == '\0') ? NULL : p->parse_error;
 }
@@ -23,36 +23,128 @@
 #ifndef tbparse_h
 #define tbparse_h
 
+#include <sys/types.h>
+#include <sys/stat.h>
+
 enum tb_entry_type {
 	TBE_CASCADE,
 	TBE_COMMAND,
-	TBE_SEPARATOR
+	TBE_SEPARATOR,
+	TBE_PIPE, /* cascade generated from the output of command */
+	TBE_DIRECTORY, /* cascade listing contents of the directory in command */
+	TBE_APPLICATIONS, /* cascade listing installed (.desktop) applications */
+	TBE_INCLUDE /* internal, never present in parsed entry lists */
 };
 
+/* Default TBE_PIPE ttl value, meaning that the application decides */
+#define TB_DEFAULT_TTL (-1)
+
 struct tb_entry {
 	enum tb_entry_type type;
 	int level;
 	char *title;
 	char mnemonic;
 	char *command;
-	struct tb_entry *next;
+	int ttl; /* seconds to cache TBE_PIPE contents for */
+	char *icon; /* image file shown along the title, or NULL */
+	/* Tree links; indices into the menu's entry array, -1 if none.
+	 * Children of an entry immediately follow it in the array. */
+	int parent;
+	int sibling;
+	unsigned int nchildren;
 };
 
+/*
+ * Parsed menu tree. Entries are stored in document order, which is the
+ * pre-order of the tree; the first top-level entry (if any) is at index
+ * zero, and the rest are reached through sibling links.
+ */
+struct tb_menu {
+	struct tb_entry *entries;
+	unsigned int count;
+	int max_level; /* level of the deepest entry */
+};
+
+
+/*
+ * Signature of a file parsed entries were read from. Fields other than path
+ * are zero for files that didn't exist at the time (e.g. drop-in directory).
+ */
+struct tb_source {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+};
+
+/* Opaque parser context, holding all parsing state and the parsed entries */
+struct tb_parser;
+
+/* Creates a parser context. Returns NULL if out of memory. */
+struct tb_parser* tb_parser_create(void);
+
+/* Destroys the parser context, along with any entries it holds */
+void tb_parser_destroy(struct tb_parser*);
 
 /*
  * Parses a toolbox menu file. Returns zero on success.
- * If a non-zero value is returned and tb_parse_error_string()
+ * If a non-zero value is returned and tb_parser_error()
  * returns NULL, the value returned is a system errno value.
  *
- * ent_root receives a pointer to a dynamically allocated list of
- * menu entries. This list is freed on subsequent calls to tb_parse_config.
+ * Files named in INCLUDE directives, and files in the drop-in directory
+ * (filename.d) are parsed as well. Each file is parsed separately, and kept
+ * in the parser's fragment cache until it changes, so that only modified
+ * files need to be parsed on subsequent calls.
+ *
+ * menu receives a pointer to the menu tree owned by the parser.
+ * It is freed on subsequent successful calls to tb_parser_parse,
+ * and remains intact if parsing fails.
+ */
+int tb_parser_parse(struct tb_parser*,
+	const char *filename, const struct tb_menu **menu);
+
+/*
+ * Parses menu entries from a string of 'len' bytes, e.g. output of a
+ * generator command. Entries are placed as if the text was enclosed in
+ * base_level menu scopes. INCLUDE directives are not allowed. The name
+ * is used in error messages. Semantics are otherwise those of
+ * tb_parser_parse.
+ */
+int tb_parser_parse_string(struct tb_parser*, const char *name,
+	const char *text, size_t len, int base_level, const struct tb_menu **menu);
+
+/*
+ * Makes the parser own a compiled cache image mapped at 'image' and the
+ * malloc()ed array of 'count' entries referring to it, in place of its
+ * current entries. Tree links are computed from entry levels. Used by the
+ * cache loader, and the applications menu builder, which maps anonymous
+ * memory for its strings. Returns EINVAL, leaving the parser and the
+ * arguments untouched, if levels don't describe a valid tree.
  */
-int tb_parse_config(const char *filename, struct tb_entry **ent_root);
+int tb_parser_adopt_image(struct tb_parser*, void *image, size_t size,
+	struct tb_entry *entries, unsigned int count);
+
+/*
+ * Adds to the list of source files of the current entries. Used by the
+ * cache loader along with tb_parser_adopt_image. Returns zero on success.
+ */
+int tb_parser_add_source(struct tb_parser*,
+	const char *path, const struct stat *st);
+
+/* Returns files (and directories) the current entries were read from */
+const struct tb_source* tb_parser_sources(struct tb_parser*, size_t *count);
+
+/* Returns the menu tree currently held by the parser */
+const struct tb_menu* tb_parser_menu(struct tb_parser*);
+
+/* Releases the menu tree held by the parser */
+void tb_parser_release(struct tb_parser*);
 
 /*
  * Returns detailed information about the syntax error
  * previously encountered while parsing a config file.
  */
-char* tb_parser_error_string(void);
+const char* tb_parser_error(struct tb_parser*);
 
 #endif /* tbparse_h */
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Command name to executable path resolution, cached for as long as PATH
+ * and the directories listed in it remain unchanged, so that launching
+ * a menu command doesn't need to search PATH.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "tbpath.h"
+
+/* Number of hash table buckets, and names cached before starting over */
+#define PATH_CACHE_BUCKETS 64
+#define PATH_CACHE_MAX 1024
+
+/* Signature of a PATH directory */
+struct path_dir {
+	const char *name;
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+};
+
+/* Cached command name resolution */
+struct resolved {
+	char *name;
+	char *path; /* NULL if not found */
+	int err;
+	struct resolved *next;
+};
+
+static char *path_var = NULL; /* value of PATH dirs were read from */
+static char *dir_names = NULL;
+static struct path_dir *path_dirs = NULL;
+static size_t path_ndirs = 0;
+static time_t path_stamp = 0;
+static unsigned long path_gen = 1;
+
+static struct resolved *path_cache[PATH_CACHE_BUCKETS];
+static unsigned int path_cache_count = 0;
+
+static int read_path_var(const char*);
+static int stat_dir(struct path_dir*);
+static unsigned int name_hash(const char*);
+static void clear_cache(void);
+
+unsigned long tb_path_update(void)
+{
+	const char *cur_var = getenv("PATH");
+	time_t now = time(NULL);
+	int changed = 0;
+	size_t i;
+	
+	if(!cur_var) cur_var = DEFAULT_PATH;
+	
+	if(!path_var || strcmp(path_var, cur_var)) {
+		if(read_path_var(cur_var)) return path_gen;
+		changed = 1;
+	} else if(now != path_stamp) {
+		for(i = 0; i < path_ndirs; i++) {
+			if(stat_dir(&path_dirs[i])) changed = 1;
+		}
+	}
+	
+	if(changed) clear_cache();
+	path_stamp = now;
+	return path_gen;
+}
+
+unsigned long tb_path_generation(void)
+{
+	return path_gen;
+}
+
+int tb_path_resolve(const char *name, const char **path)
+{
+	struct resolved *r;
+	unsigned int bucket;
+	
+	if(!path_var) tb_path_update();
+	
+	bucket = name_hash(name) % PATH_CACHE_BUCKETS;
+	for(r = path_cache[bucket]; r; r = r->next) {
+		if(!strcmp(r->name, name)) break;
+	}
+	
+	if(!r) {
+		if(path_cache_count >= PATH_CACHE_MAX) clear_cache();
+
+		if(!(r = calloc(1, sizeof(struct resolved)))) return ENOMEM;
+		if(!(r->name = strdup(name))) {
+			free(r);
+			return ENOMEM;
+		}
+		r->err = find_in_path(name, &r->path);
+		if(r->err == ENOMEM) {
+			free(r->name);
+			free(r);
+			return ENOMEM;
+		}
+		r->next = path_cache[bucket];
+		path_cache[bucket] = r;
+		path_cache_count++;
+	}
+	
+	if(r->err) return r->err;
+	*path = r->path;
+	return 0;
+}
+
+/*
+ * Builds the directory list from the value of PATH, and records
+ * signatures of the directories. Returns zero on success.
+ */
+static int read_path_var(const char *value)
+{
+	char *var, *names;
+	struct path_dir *dirs;
+	const char *q;
+	size_t i, count = 1;
+	char *p;
+	
+	for(q = value; *q; q++) {
+		if(*q == ':') count++;
+	}
+	
+	var = strdup(value);
+	/* room for a "." in place of each empty element */
+	names = malloc(strlen(value) + count * 2 + 1);
+	dirs = calloc(count, sizeof(struct path_dir));
+	if(!var || !names || !dirs) {
+		free(var);
+		free(names);
+		free(dirs);
+		return ENOMEM;
+	}
+	
+	for(i = 0, p = names; i < count; i++) {
+		const char *end = strchr(value, ':');
+		size_t len = end ? (size_t)(end - value) : strlen(value);
+		
+		/* empty PATH element stands for the current directory */
+		if(len) {
+			memcpy(p, value, len);
+		} else {
+			p[0] = '.';
+			len = 1;
+		}
+		p[len] = '\0';
+		dirs[i].name = p;
+		stat_dir(&dirs[i]);
+		
+		p += len + 1;
+		if(end) value = end + 1;
+	}
+
+	free(path_var);
+	free(dir_names);
+	free(path_dirs);
+	path_var = var;
+	dir_names = names;
+	path_dirs = dirs;
+	path_ndirs = count;
+	return 0;
+}
+
+/*
+ * Updates the directory's signature. Returns non-zero if it changed,
+ * or if it was last modified within the same second it was last checked
+ * in, since further changes made within that second would go unnoticed.
+ */
+static int stat_dir(struct path_dir *dir)
+{
+	struct stat st;
+	int changed;
+	
+	if(stat(dir->name, &st) == -1) {
+		st.st_dev = 0;
+		st.st_ino = 0;
+		st.st_mtime = 0;
+	}
+	
+	changed = (dir->dev != st.st_dev || dir->ino != st.st_ino ||
+		dir->mtime != st.st_mtime || (st.st_mtime &&
+		st.st_mtime >= path_stamp));
+	
+	dir->dev = st.st_dev;
+	dir->ino = st.st_ino;
+	dir->mtime = st.st_mtime;
+	return changed;
+}
+
+static unsigned int name_hash(const char *name)
+{
+	unsigned int hash = 2166136261U;
+	
+	while(*name) {
+		hash ^= (unsigned char)*name++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+/*
+ * Forgets all resolved commands, and increments the generation, since
+ * paths handed out so far are freed
+ */
+static void clear_cache(void)
+{
+	struct resolved *r, *next;
+	unsigned int i;
+	
+	for(i = 0; i < PATH_CACHE_BUCKETS; i++) {
+		for(r = path_cache[i]; r; r = next) {
+			next = r->next;
+			free(r->name);
+			free(r->path);
+			free(r);
+		}
+		path_cache[i] = NULL;
+	}
+	path_cache_count = 0;
+	path_gen++;
+}
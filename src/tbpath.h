@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbpath_h
+#define tbpath_h
+
+/*
+ * Checks whether PATH, or contents of any directory listed in it, changed
+ * since the last check, in which case commands resolved so far are
+ * forgotten and the generation number is incremented. Directories are
+ * checked at most once per second. Returns the current generation.
+ */
+unsigned long tb_path_update(void);
+
+/* Returns the current generation number; never zero */
+unsigned long tb_path_generation(void);
+
+/*
+ * Resolves a command name to the path of an executable file as execvp
+ * would, and caches the result until the generation changes. On success
+ * *path receives the path, which is owned by the cache and remains valid
+ * as long as the generation stays the same. The cache holds a limited
+ * number of names; resolving one more starts it over, incrementing the
+ * generation as well. Returns errno otherwise; ENOENT if not found,
+ * EACCES if found but not executable.
+ */
+int tb_path_resolve(const char *name, const char **path);
+
+#endif /* tbpath_h */
@@ -0,0 +1,393 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Fuzzy search over command entries of a menu, used by the command
+ * palette. Items are flattened into a pair of string pools, one with their
+ * paths and commands as shown, and one with those lowercased for matching,
+ * along with a bitmask of characters each contains, for quick rejection.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include "tbparse.h"
+#include "tbsearch.h"
+
+/* Score components */
+#define SCORE_MATCH 16
+#define SCORE_BOUNDARY 12
+#define SCORE_CONSECUTIVE 8
+#define SCORE_MAX_CONSECUTIVE 32
+#define SCORE_GAP (-1)
+#define SCORE_IN_TITLE 32
+#define SCORE_IN_COMMAND (-24)
+/* shorter items are preferred; penalty per this many bytes */
+#define SCORE_LENGTH_UNIT 16
+
+struct search_item {
+	unsigned int path; /* offsets of strings in the string pool */
+	unsigned int command;
+	unsigned int hay; /* offset of "path\tcommand" in the match pool */
+	unsigned int hay_len;
+	unsigned int path_len;
+	unsigned int title; /* offset of the last path component in hay */
+	uint64_t mask; /* characters present, see char_bit() */
+};
+
+struct tb_search {
+	struct search_item *items;
+	unsigned int count;
+	char *strings;
+	char *hay;
+	/* matches of the previous query, in index order */
+	unsigned int *matches;
+	unsigned int nmatches;
+	char prev[TB_SEARCH_MAX_PATTERN + 1];
+	int have_prev;
+	/* scores of the best matches being collected */
+	int *top_scores;
+	unsigned int top_size;
+};
+
+static unsigned int path_length(const struct tb_menu*, int);
+static char* copy_path(char*, const struct tb_menu*, int, int);
+static int score_item(const struct tb_search*, const struct search_item*,
+	const char*, unsigned int);
+static int find_window(const char*, unsigned int, unsigned int,
+	const char*, unsigned int, unsigned int*);
+static int score_window(const char*, unsigned int, unsigned int,
+	const char*, unsigned int);
+static unsigned int insert_top(struct tb_search*, unsigned int*,
+	unsigned int, unsigned int, unsigned int, int);
+
+#define to_lower(c) (((c) >= 'A' && (c) <= 'Z') ? ((c) + ('a' - 'A')) : (c))
+#define char_bit(c) ((uint64_t)1 << ((unsigned char)(c) & 63))
+#define is_boundary(c) ((c) == ' ' || (c) == '\t' || (c) == '/' || \
+	(c) == '-' || (c) == '_' || (c) == '.' || (c) == '>')
+
+struct tb_search* tb_search_create(void)
+{
+	return calloc(1, sizeof(struct tb_search));
+}
+
+void tb_search_destroy(struct tb_search *s)
+{
+	free(s->items);
+	free(s->strings);
+	free(s->hay);
+	free(s->matches);
+	free(s->top_scores);
+	free(s);
+}
+
+int tb_search_index(struct tb_search *s, const struct tb_menu *menu)
+{
+	size_t size = 0;
+	unsigned int i, n = 0;
+	char *str, *hay;
+	
+	free(s->items);
+	free(s->strings);
+	free(s->hay);
+	free(s->matches);
+	s->items = NULL;
+	s->strings = NULL;
+	s->hay = NULL;
+	s->matches = NULL;
+	s->count = 0;
+	s->nmatches = 0;
+	s->have_prev = 0;
+	
+	for(i = 0; i < menu->count; i++) {
+		const struct tb_entry *e = &menu->entries[i];
+		
+		if(e->type != TBE_COMMAND) continue;
+		size += path_length(menu, i) + strlen(e->command) + 2;
+		n++;
+	}
+	if(!n) return 0;
+	if(size > UINT_MAX) return ENOMEM;
+	
+	s->items = malloc(sizeof(struct search_item) * n);
+	s->matches = malloc(sizeof(unsigned int) * n);
+	s->strings = malloc(size);
+	s->hay = malloc(size);
+	if(!s->items || !s->matches || !s->strings || !s->hay) {
+		free(s->items);
+		free(s->matches);
+		free(s->strings);
+		free(s->hay);
+		s->items = NULL;
+		s->matches = NULL;
+		s->strings = NULL;
+		s->hay = NULL;
+		return ENOMEM;
+	}
+	
+	str = s->strings;
+	hay = s->hay;
+	for(i = 0; i < menu->count; i++) {
+		const struct tb_entry *e = &menu->entries[i];
+		struct search_item *it = &s->items[s->count];
+		size_t len;
+		char *p;
+		
+		if(e->type != TBE_COMMAND) continue;
+		
+		it->path = str - s->strings;
+		p = copy_path(str, menu, i, menu->max_level);
+		it->path_len = p - str;
+		it->title = it->path_len - strlen(e->title);
+		*p++ = '\0';
+		
+		len = strlen(e->command);
+		it->command = p - s->strings;
+		memcpy(p, e->command, len + 1);
+		
+		it->hay = hay - s->hay;
+		it->hay_len = it->path_len + 1 + len;
+		it->mask = 0;
+		for(p = str; p != str + it->hay_len; p++, hay++) {
+			/* path and command are separated by a tab */
+			*hay = *p ? to_lower(*p) : '\t';
+			it->mask |= char_bit(*hay);
+		}
+		*hay++ = '\0';
+		
+		str += it->hay_len + 1;
+		s->count++;
+	}
+	return 0;
+}
+
+unsigned int tb_search_count(struct tb_search *s)
+{
+	return s->count;
+}
+
+const char* tb_search_path(struct tb_search *s, unsigned int item)
+{
+	return s->strings + s->items[item].path;
+}
+
+const char* tb_search_command(struct tb_search *s, unsigned int item)
+{
+	return s->strings + s->items[item].command;
+}
+
+unsigned int tb_search_query(struct tb_search *s, const char *pattern,
+	unsigned int *results, unsigned int max, unsigned int *total)
+{
+	char pat[TB_SEARCH_MAX_PATTERN + 1];
+	unsigned int plen = 0;
+	unsigned int i, n, nfound = 0, ntop = 0;
+	uint64_t pmask = 0;
+	int incremental;
+	
+	for(; *pattern && plen < TB_SEARCH_MAX_PATTERN; pattern++) {
+		if(*pattern == ' ' || *pattern == '\t') continue;
+		pat[plen++] = to_lower(*pattern);
+		pmask |= char_bit(pat[plen - 1]);
+	}
+	pat[plen] = '\0';
+	
+	if(max > s->top_size) {
+		int *p = realloc(s->top_scores, sizeof(int) * max);
+		
+		if(p) {
+			s->top_scores = p;
+			s->top_size = max;
+		} else {
+			max = s->top_size;
+		}
+	}
+	
+	if(!plen) {
+		s->have_prev = 0;
+		if(total) *total = s->count;
+		for(i = 0; i < s->count && i < max; i++) results[i] = i;
+		return i;
+	}
+	
+	/* matches of a pattern are a subset of those of its prefix */
+	incremental = s->have_prev && !strncmp(pat, s->prev, strlen(s->prev));
+	n = incremental ? s->nmatches : s->count;
+	
+	for(i = 0; i < n; i++) {
+		unsigned int item = incremental ? s->matches[i] : i;
+		const struct search_item *it = &s->items[item];
+		int score;
+		
+		if((pmask & it->mask) != pmask) continue;
+		if((score = score_item(s, it, pat, plen)) == INT_MIN) continue;
+		
+		/* never overtakes reading, so the list is filtered in place */
+		s->matches[nfound++] = item;
+		ntop = insert_top(s, results, max, ntop, item, score);
+	}
+	
+	s->nmatches = nfound;
+	memcpy(s->prev, pat, plen + 1);
+	s->have_prev = 1;
+	
+	if(total) *total = nfound;
+	return ntop;
+}
+
+/* Returns length of the path of the entry at 'index' */
+static unsigned int path_length(const struct tb_menu *menu, int index)
+{
+	unsigned int len = strlen(menu->entries[index].title);
+	
+	while((index = menu->entries[index].parent) != -1) {
+		len += strlen(menu->entries[index].title) +
+			(sizeof(TB_SEARCH_PATH_SEP) - 1);
+	}
+	return len;
+}
+
+/*
+ * Writes the path of the entry at 'index' (without terminating zero)
+ * to 'out' and returns the end of it. 'depth' limits recursion.
+ */
+static char* copy_path(char *out, const struct tb_menu *menu,
+	int index, int depth)
+{
+	const struct tb_entry *e = &menu->entries[index];
+	size_t len = strlen(e->title);
+	
+	if(e->parent != -1 && depth > 0) {
+		out = copy_path(out, menu, e->parent, depth - 1);
+		memcpy(out, TB_SEARCH_PATH_SEP, sizeof(TB_SEARCH_PATH_SEP) - 1);
+		out += sizeof(TB_SEARCH_PATH_SEP) - 1;
+	}
+	memcpy(out, e->title, len);
+	return out + len;
+}
+
+/*
+ * Scores a match of the pattern against an item, or returns INT_MIN if
+ * it doesn't match. Matches within the item's own title are preferred.
+ */
+static int score_item(const struct tb_search *s, const struct search_item *it,
+	const char *pat, unsigned int plen)
+{
+	const char *hay = s->hay + it->hay;
+	unsigned int end;
+	int start = -1;
+	int score;
+	
+	if(plen <= it->path_len - it->title)
+		start = find_window(hay, it->title, it->path_len, pat, plen, &end);
+	
+	if(start != -1) {
+		score = score_window(hay, start, end, pat, plen) + SCORE_IN_TITLE;
+	} else {
+		start = find_window(hay, 0, it->hay_len, pat, plen, &end);
+		if(start == -1) return INT_MIN;
+		
+		score = score_window(hay, start, end, pat, plen);
+		if(end > it->path_len) score += SCORE_IN_COMMAND;
+	}
+	return score - (int)(it->hay_len / SCORE_LENGTH_UNIT);
+}
+
+/*
+ * Finds the leftmost occurrence of the pattern as a subsequence of
+ * hay[from, to), and narrows it down to the shortest one ending at the same
+ * position. Returns its start, and its end in *end, or -1 if none.
+ */
+static int find_window(const char *hay, unsigned int from, unsigned int to,
+	const char *pat, unsigned int plen, unsigned int *end)
+{
+	unsigned int i, pos = from;
+	
+	for(i = 0; i < plen; i++) {
+		const char *p = memchr(hay + pos, pat[i], to - pos);
+		
+		if(!p) return -1;
+		pos = p - hay + 1;
+	}
+	
+	*end = pos;
+	while(i) {
+		if(hay[--pos] == pat[i - 1]) i--;
+	}
+	return pos;
+}
+
+/* Scores a window found by find_window */
+static int score_window(const char *hay, unsigned int start, unsigned int end,
+	const char *pat, unsigned int plen)
+{
+	unsigned int pos, i = 0;
+	int score = 0, run = 0;
+	
+	for(pos = start; pos < end && i < plen; pos++) {
+		if(hay[pos] == pat[i]) {
+			score += SCORE_MATCH;
+			if(!pos || is_boundary(hay[pos - 1])) score += SCORE_BOUNDARY;
+			if(run) {
+				int bonus = SCORE_CONSECUTIVE * run;
+				score += (bonus > SCORE_MAX_CONSECUTIVE) ?
+					SCORE_MAX_CONSECUTIVE : bonus;
+			}
+			run++;
+			i++;
+		} else {
+			score += SCORE_GAP;
+			run = 0;
+		}
+	}
+	return score;
+}
+
+/*
+ * Inserts an item into the list of the best 'max' ones, ordered by score,
+ * currently holding 'count' items, and returns the new count.
+ * Items of equal score stay in index order.
+ */
+static unsigned int insert_top(struct tb_search *s, unsigned int *results,
+	unsigned int max, unsigned int count, unsigned int item, int score)
+{
+	int *scores = s->top_scores;
+	unsigned int lo = 0, hi = count;
+	
+	if(count == max && (!max || score <= scores[count - 1])) return count;
+	
+	while(lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		
+		if(scores[mid] >= score) lo = mid + 1;
+		else hi = mid;
+	}
+	if(count == max) count--;
+	memmove(&results[lo + 1], &results[lo], sizeof(unsigned int) * (count - lo));
+	memmove(&scores[lo + 1], &scores[lo], sizeof(int) * (count - lo));
+	results[lo] = item;
+	scores[lo] = score;
+	return count + 1;
+}
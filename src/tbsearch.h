@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbsearch_h
+#define tbsearch_h
+
+#include "tbparse.h"
+
+/* Separator of cascade titles in item paths */
+#define TB_SEARCH_PATH_SEP " > "
+
+/* Maximum length of a search pattern */
+#define TB_SEARCH_MAX_PATTERN 128
+
+/* Opaque search index of the command entries of a menu */
+struct tb_search;
+
+/* Creates an empty index. Returns NULL if out of memory. */
+struct tb_search* tb_search_create(void);
+
+/* Destroys the index */
+void tb_search_destroy(struct tb_search*);
+
+/*
+ * Replaces contents of the index with TBE_COMMAND entries of the menu.
+ * Each is indexed by its path (titles of its cascades and its own, joined
+ * with TB_SEARCH_PATH_SEP) and its command string, which are copied, so
+ * that the menu may be freed afterwards. Returns zero on success, errno
+ * otherwise, in which case the index is left empty.
+ */
+int tb_search_index(struct tb_search*, const struct tb_menu*);
+
+/* Returns the number of items in the index */
+unsigned int tb_search_count(struct tb_search*);
+
+/* Returns the path and command string of an item */
+const char* tb_search_path(struct tb_search*, unsigned int item);
+const char* tb_search_command(struct tb_search*, unsigned int item);
+
+/*
+ * Finds items containing characters of 'pattern' in order (not necessarily
+ * adjacent; case insensitive for ASCII), scored by how closely, and where
+ * they match, preferring matches in titles over those in commands. Stores
+ * up to 'max' best matching items, best first, in 'results', and returns
+ * their number. If 'total' isn't NULL, it receives the number of all
+ * matching items. An empty pattern matches all items, in menu order.
+ *
+ * Blanks in the pattern are ignored, and only the first
+ * TB_SEARCH_MAX_PATTERN bytes of it are used. Matches of the previous
+ * query are remembered, so that a pattern extending it, as when typing,
+ * only needs to be checked against those.
+ */
+unsigned int tb_search_query(struct tb_search*, const char *pattern,
+	unsigned int *results, unsigned int max, unsigned int *total);
+
+#endif /* tbsearch_h */
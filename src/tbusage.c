@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Command usage log. The file consists of a header and a fixed number of
+ * fixed-size slots, addressed by hash of the command they record, and is
+ * mapped shared, so that recording a launch takes just a few stores.
+ * Sessions of the same user may share the file; concurrent updates of the
+ * same slot may be lost, which only affects the ranking.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "tbusage.h"
+
+#define USAGE_MAGIC "XMTBU\0\0\0"
+#define USAGE_VERSION 1
+#define USAGE_SLOTS 256
+
+/* Number of slots a command may go in, starting at its hash */
+#define USAGE_PROBES 16
+
+#define USAGE_TITLE_MAX 64
+#define USAGE_COMMAND_MAX 168
+
+struct usage_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t nslots;
+	uint64_t reserved[2];
+};
+
+struct usage_slot {
+	uint64_t key;
+	int64_t last;
+	uint32_t count;
+	uint32_t reserved;
+	char title[USAGE_TITLE_MAX];
+	char command[USAGE_COMMAND_MAX];
+};
+
+struct tb_usage {
+	struct usage_header *hdr;
+	struct usage_slot *slots;
+	size_t size;
+};
+
+static uint64_t command_key(const char *command);
+static unsigned long frecency(const struct usage_slot*, time_t now);
+
+struct tb_usage* tb_usage_open(const char *path)
+{
+	struct tb_usage *u;
+	struct stat st;
+	size_t size = sizeof(struct usage_header) +
+		USAGE_SLOTS * sizeof(struct usage_slot);
+	void *addr;
+	int fd, err;
+	
+	if((fd = open(path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR)) == -1)
+		return NULL;
+	
+	if(fstat(fd, &st) == -1) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	
+	if(!S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+		close(fd);
+		errno = EINVAL;
+		return NULL;
+	}
+	
+	/* a log of another size is reset; its contents are then checked */
+	if(st.st_size != (off_t)size && (ftruncate(fd, 0) == -1 ||
+		ftruncate(fd, size) == -1)) {
+		err = errno;
+		close(fd);
+		errno = err;
+		return NULL;
+	}
+	
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	err = errno;
+	close(fd);
+	if(addr == MAP_FAILED) {
+		errno = err;
+		return NULL;
+	}
+	
+	if(!(u = malloc(sizeof(struct tb_usage)))) {
+		munmap(addr, size);
+		errno = ENOMEM;
+		return NULL;
+	}
+	u->hdr = addr;
+	u->slots = (struct usage_slot*)(u->hdr + 1);
+	u->size = size;
+	
+	if(memcmp(u->hdr->magic, USAGE_MAGIC, sizeof(u->hdr->magic)) ||
+		u->hdr->version != USAGE_VERSION ||
+		u->hdr->nslots != USAGE_SLOTS) {
+		memset(addr, 0, size);
+		memcpy(u->hdr->magic, USAGE_MAGIC, sizeof(u->hdr->magic));
+		u->hdr->version = USAGE_VERSION;
+		u->hdr->nslots = USAGE_SLOTS;
+	}
+	return u;
+}
+
+void tb_usage_close(struct tb_usage *u)
+{
+	munmap(u->hdr, u->size);
+	free(u);
+}
+
+void tb_usage_record(struct tb_usage *u, const char *title,
+	const char *command, time_t now)
+{
+	uint64_t key;
+	struct usage_slot *s = NULL;
+	struct usage_slot *victim = NULL;
+	unsigned long victim_score = 0;
+	size_t title_len, command_len = strlen(command);
+	unsigned int i;
+	
+	if(!command_len || command_len >= USAGE_COMMAND_MAX) return;
+	
+	key = command_key(command);
+	for(i = 0; i < USAGE_PROBES; i++) {
+		struct usage_slot *cur = &u->slots[(key + i) % USAGE_SLOTS];
+		unsigned long score;
+		
+		if(cur->key == key && !strcmp(cur->command, command)) {
+			s = cur;
+			break;
+		}
+		if(!cur->key) {
+			if(!victim || victim->key) victim = cur;
+			continue;
+		}
+		score = frecency(cur, now);
+		if(!victim || (victim->key && score < victim_score)) {
+			victim = cur;
+			victim_score = score;
+		}
+	}
+	
+	if(!s) {
+		/* the key goes last, so that it never marks a partial slot */
+		s = victim;
+		s->key = 0;
+		s->count = 0;
+		memcpy(s->command, command, command_len + 1);
+		s->title[0] = '\0';
+		s->key = key;
+	}
+	
+	title_len = strlen(title);
+	if(title_len >= USAGE_TITLE_MAX) title_len = USAGE_TITLE_MAX - 1;
+	if(strncmp(s->title, title, title_len) || s->title[title_len]) {
+		memcpy(s->title, title, title_len);
+		s->title[title_len] = '\0';
+	}
+	
+	if(s->count != UINT32_MAX) s->count++;
+	s->last = now;
+}
+
+unsigned int tb_usage_top(struct tb_usage *u, time_t now,
+	unsigned int *slots, unsigned int max)
+{
+	unsigned long scores[USAGE_SLOTS];
+	unsigned int i, n = 0;
+	
+	if(!max) return 0;
+	if(max > USAGE_SLOTS) max = USAGE_SLOTS;
+	
+	for(i = 0; i < USAGE_SLOTS; i++) {
+		unsigned long score;
+		unsigned int pos;
+		
+		if(!u->slots[i].key || !u->slots[i].count) continue;
+		score = frecency(&u->slots[i], now);
+		
+		/* insert into the sorted list, if among the best */
+		for(pos = n; pos > 0 && scores[pos - 1] < score; pos--);
+		if(pos == max) continue;
+		if(n < max) n++;
+		memmove(&scores[pos + 1], &scores[pos],
+			(n - pos - 1) * sizeof(unsigned long));
+		memmove(&slots[pos + 1], &slots[pos],
+			(n - pos - 1) * sizeof(unsigned int));
+		scores[pos] = score;
+		slots[pos] = i;
+	}
+	return n;
+}
+
+uint64_t tb_usage_key(struct tb_usage *u, unsigned int slot)
+{
+	return u->slots[slot].key;
+}
+
+const char* tb_usage_title(struct tb_usage *u, unsigned int slot)
+{
+	const struct usage_slot *s = &u->slots[slot];
+	
+	/* the file may have been written to by anything */
+	if(!s->key || !memchr(s->title, '\0', USAGE_TITLE_MAX)) return "";
+	return s->title;
+}
+
+const char* tb_usage_command(struct tb_usage *u, unsigned int slot)
+{
+	const struct usage_slot *s = &u->slots[slot];
+	
+	if(!s->key || !memchr(s->command, '\0', USAGE_COMMAND_MAX)) return "";
+	return s->command;
+}
+
+/* FNV-1a hash of the command; never zero, which marks free slots */
+static uint64_t command_key(const char *command)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+	
+	while(*command) {
+		h ^= (unsigned char)*command++;
+		h *= 0x100000001b3ULL;
+	}
+	return h ? h : 1;
+}
+
+/*
+ * Launch count weighted by age of the last launch; commands used recently
+ * rank above ones used more often, but long ago.
+ */
+static unsigned long frecency(const struct usage_slot *s, time_t now)
+{
+	int64_t days = (now - s->last) / 86400;
+	unsigned long weight;
+	
+	if(days < 4) weight = 100;
+	else if(days < 14) weight = 70;
+	else if(days < 31) weight = 50;
+	else if(days < 90) weight = 30;
+	else weight = 10;
+	
+	return (unsigned long)s->count * weight;
+}
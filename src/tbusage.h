@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef tbusage_h
+#define tbusage_h
+
+#include <stdint.h>
+#include <time.h>
+
+/* Opaque usage log context */
+struct tb_usage;
+
+/*
+ * Maps the usage log file at 'path', creating it if it doesn't exist or
+ * resetting it if it isn't valid. The log has a fixed number of slots,
+ * each holding launch count and time of a command, along with its title.
+ * Returns NULL on failure, with errno set.
+ */
+struct tb_usage* tb_usage_open(const char *path);
+
+/* Unmaps the log */
+void tb_usage_close(struct tb_usage*);
+
+/*
+ * Records a launch of the command at time 'now'. This only stores into the
+ * mapping; the file is written back by the system. Commands that don't fit
+ * in a slot aren't recorded. If all slots a command may go in are taken, the
+ * one with the lowest score is reused.
+ */
+void tb_usage_record(struct tb_usage*, const char *title,
+	const char *command, time_t now);
+
+/*
+ * Stores slot numbers of up to 'max' commands with the highest frecency
+ * (launch count weighted by how recent the last launch was) at 'now' in
+ * slots, best first. Returns the number of slots stored.
+ */
+unsigned int tb_usage_top(struct tb_usage*, time_t now,
+	unsigned int *slots, unsigned int max);
+
+/*
+ * Returns the key (hash of the command) of a slot, which changes if the
+ * slot is reused for another command, or zero if the slot is free.
+ */
+uint64_t tb_usage_key(struct tb_usage*, unsigned int slot);
+
+/* Return the title and command of a slot; empty strings if it's free */
+const char* tb_usage_title(struct tb_usage*, unsigned int slot);
+const char* tb_usage_command(struct tb_usage*, unsigned int slot);
+
+#endif /* tbusage_h */
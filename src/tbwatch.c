@@ -0,0 +1,410 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Change notification for rc files. See tbwatch.h
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(__linux__)
+#define USE_INOTIFY
+#include <sys/inotify.h>
+#elif defined(__FreeBSD__) || defined(__NetBSD__) || \
+	defined(__OpenBSD__) || defined(__DragonFly__)
+#define USE_KQUEUE
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#include "tbwatch.h"
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+#ifdef USE_INOTIFY
+#define DIR_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | \
+	IN_CREATE | IN_DELETE | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+#define EVENT_BUF_SIZE 4096
+#endif
+
+#ifdef USE_KQUEUE
+#define DIR_NOTES (NOTE_WRITE | NOTE_DELETE | NOTE_RENAME)
+#define FILE_NOTES (NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | \
+	NOTE_DELETE | NOTE_RENAME)
+#endif
+
+/* A watched file, and its signature at the time it was set */
+struct watched_file {
+	struct tb_source sig;
+	const char *name; /* within path */
+	int is_dir;
+	int dir_wd; /* inotify watch of the directory it's in */
+	int self_wd; /* inotify watch of itself, if it's a directory */
+};
+
+/* Descriptor of a file or directory being watched with kqueue */
+struct watched_vnode {
+	int fd;
+	int is_file; /* events on files are always relevant */
+	char *path;
+};
+
+struct tb_watch {
+	int fd;
+	struct watched_file *files;
+	size_t nfiles;
+	/* an event known to concern a watched file was seen */
+	int changed;
+	#ifdef USE_INOTIFY
+	int *wds;
+	size_t nwds;
+	#endif
+	#ifdef USE_KQUEUE
+	struct watched_vnode *vnodes;
+	size_t nvnodes;
+	#endif
+};
+
+static void clear_files(struct tb_watch*);
+static int same_signature(const struct tb_source*, const struct stat*);
+static char* dir_name(const char *path);
+#ifdef USE_INOTIFY
+static int add_wd(struct tb_watch*, const char *path, int *wd);
+#endif
+#ifdef USE_KQUEUE
+static int add_vnode(struct tb_watch*, const char *path, int is_file);
+#endif
+
+
+struct tb_watch* tb_watch_create(void)
+{
+	struct tb_watch *w;
+	
+	if(!(w = calloc(1, sizeof(struct tb_watch)))) return NULL;
+	w->fd = -1;
+	
+	#if defined(USE_INOTIFY)
+	w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	#elif defined(USE_KQUEUE)
+	if((w->fd = kqueue()) != -1) fcntl(w->fd, F_SETFD, FD_CLOEXEC);
+	#endif
+	/* if that fails, changes are merely polled for */
+	return w;
+}
+
+void tb_watch_destroy(struct tb_watch *w)
+{
+	clear_files(w);
+	if(w->fd != -1) close(w->fd);
+	free(w);
+}
+
+int tb_watch_fd(struct tb_watch *w)
+{
+	return w->fd;
+}
+
+int tb_watch_set(struct tb_watch *w,
+	const struct tb_source *files, size_t count)
+{
+	size_t i;
+	int err = 0;
+	
+	clear_files(w);
+	if(!count) return 0;
+	
+	if(!(w->files = calloc(count, sizeof(struct watched_file))))
+		return ENOMEM;
+	
+	for(i = 0; i < count && !err; i++) {
+		struct watched_file *wf = &w->files[i];
+		struct stat st;
+		char *dir;
+		
+		if(!(wf->sig.path = strdup(files[i].path))) {
+			err = ENOMEM;
+			break;
+		}
+		w->nfiles++;
+		
+		wf->sig.dev = files[i].dev;
+		wf->sig.ino = files[i].ino;
+		wf->sig.size = files[i].size;
+		wf->sig.mtime = files[i].mtime;
+		wf->name = strrchr(wf->sig.path, '/');
+		wf->name = wf->name ? wf->name + 1 : wf->sig.path;
+		wf->dir_wd = wf->self_wd = -1;
+		wf->is_dir = (files[i].mtime && !stat(wf->sig.path, &st) &&
+			S_ISDIR(st.st_mode));
+
+		if(w->fd == -1) continue;
+		
+		if(!(dir = dir_name(wf->sig.path))) {
+			err = ENOMEM;
+			break;
+		}
+		
+		/* the directory is watched for files being replaced, created
+		 * or removed, and the file itself for being modified in place */
+		#ifdef USE_INOTIFY
+		err = add_wd(w, dir, &wf->dir_wd);
+		if(!err && wf->is_dir) err = add_wd(w, wf->sig.path, &wf->self_wd);
+		#endif
+		#ifdef USE_KQUEUE
+		err = add_vnode(w, dir, 0);
+		if(!err && files[i].mtime) err = add_vnode(w, wf->sig.path, 1);
+		#endif
+		free(dir);
+		
+		/* files in unreadable locations simply aren't watched */
+		if(err && err != ENOMEM) err = 0;
+	}
+	
+	w->changed = 0;
+	return err;
+}
+
+int tb_watch_read(struct tb_watch *w)
+{
+	int relevant = 0;
+	
+	#ifdef USE_INOTIFY
+	char buf[EVENT_BUF_SIZE]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *evt;
+	ssize_t len;
+	char *p;
+	size_t i;
+	
+	for(;;) {
+		len = read(w->fd, buf, sizeof(buf));
+		if(len == -1 && errno == EINTR) continue;
+		if(len <= 0) break;
+		
+		for(p = buf; p < buf + len; p += sizeof(*evt) + evt->len) {
+			evt = (const struct inotify_event*)p;
+			
+			if(evt->mask & IN_Q_OVERFLOW) {
+				w->changed = 1;
+				continue;
+			}
+			
+			for(i = 0; i < w->nfiles; i++) {
+				const struct watched_file *wf = &w->files[i];
+				
+				if(evt->wd == wf->self_wd || (evt->wd == wf->dir_wd &&
+					(!evt->len || !strcmp(evt->name, wf->name)))) {
+					w->changed = 1;
+					break;
+				}
+			}
+		}
+	}
+	relevant = w->changed;
+	#endif /* USE_INOTIFY */
+	
+	#ifdef USE_KQUEUE
+	struct kevent evts[16];
+	struct timespec ts = { 0, 0 };
+	int i, n;
+	
+	while((n = kevent(w->fd, NULL, 0, evts, 16, &ts)) > 0) {
+		for(i = 0; i < n; i++) {
+			const struct watched_vnode *vn = &w->vnodes[(size_t)evts[i].udata];
+			
+			/* something in the directory changed; maybe a watched file */
+			relevant = 1;
+			if(vn->is_file) w->changed = 1;
+		}
+	}
+	#endif /* USE_KQUEUE */
+	
+	return relevant;
+}
+
+int tb_watch_changed(struct tb_watch *w)
+{
+	struct stat st;
+	size_t i;
+	
+	if(w->changed) return 1;
+	
+	for(i = 0; i < w->nfiles; i++) {
+		const struct watched_file *wf = &w->files[i];
+		
+		if(stat(wf->sig.path, &st) == -1) {
+			/* removed, or not there to begin with */
+			if(wf->sig.mtime) return 1;
+		} else if(!same_signature(&wf->sig, &st)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void tb_watch_rebase(struct tb_watch *w)
+{
+	struct stat st;
+	size_t i;
+	
+	for(i = 0; i < w->nfiles; i++) {
+		struct tb_source *sig = &w->files[i].sig;
+		
+		if(stat(sig->path, &st) == -1) {
+			sig->dev = 0;
+			sig->ino = 0;
+			sig->size = 0;
+			sig->mtime = 0;
+		} else {
+			sig->dev = st.st_dev;
+			sig->ino = st.st_ino;
+			sig->size = st.st_size;
+			sig->mtime = st.st_mtime;
+		}
+	}
+	w->changed = 0;
+}
+
+static int same_signature(const struct tb_source *sig, const struct stat *st)
+{
+	return (sig->dev == st->st_dev && sig->ino == st->st_ino &&
+		sig->size == st->st_size && sig->mtime == st->st_mtime);
+}
+
+/* Stops watching files, and frees the list */
+static void clear_files(struct tb_watch *w)
+{
+	size_t i;
+	
+	#ifdef USE_INOTIFY
+	for(i = 0; i < w->nwds; i++) inotify_rm_watch(w->fd, w->wds[i]);
+	free(w->wds);
+	w->wds = NULL;
+	w->nwds = 0;
+	#endif
+	
+	#ifdef USE_KQUEUE
+	/* closing descriptors removes their events from the queue */
+	for(i = 0; i < w->nvnodes; i++) {
+		close(w->vnodes[i].fd);
+		free(w->vnodes[i].path);
+	}
+	free(w->vnodes);
+	w->vnodes = NULL;
+	w->nvnodes = 0;
+	#endif
+	
+	for(i = 0; i < w->nfiles; i++) free(w->files[i].sig.path);
+	free(w->files);
+	w->files = NULL;
+	w->nfiles = 0;
+}
+
+/* Returns malloc()ed path of the directory the file is in */
+static char* dir_name(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	char *dir;
+	size_t len;
+	
+	if(!slash) return strdup(".");
+	len = (slash == path) ? 1 : (size_t)(slash - path);
+	if(!(dir = malloc(len + 1))) return NULL;
+	memcpy(dir, path, len);
+	dir[len] = '\0';
+	return dir;
+}
+
+#ifdef USE_INOTIFY
+/* Adds an inotify watch. Watching the same directory twice yields the
+ * same descriptor, so each is only recorded once. */
+static int add_wd(struct tb_watch *w, const char *path, int *ret)
+{
+	int wd;
+	size_t i;
+	int *new_ptr;
+	
+	if((wd = inotify_add_watch(w->fd, path, DIR_EVENTS)) == -1)
+		return errno;
+	*ret = wd;
+	
+	for(i = 0; i < w->nwds; i++) {
+		if(w->wds[i] == wd) return 0;
+	}
+	
+	if(!(new_ptr = realloc(w->wds, (w->nwds + 1) * sizeof(int)))) {
+		inotify_rm_watch(w->fd, wd);
+		return ENOMEM;
+	}
+	w->wds = new_ptr;
+	w->wds[w->nwds++] = wd;
+	return 0;
+}
+#endif /* USE_INOTIFY */
+
+#ifdef USE_KQUEUE
+/* Opens the file or directory and adds it to the queue */
+static int add_vnode(struct tb_watch *w, const char *path, int is_file)
+{
+	struct watched_vnode *new_ptr;
+	struct kevent evt;
+	size_t i;
+	int fd;
+	
+	for(i = 0; i < w->nvnodes; i++) {
+		if(!strcmp(w->vnodes[i].path, path)) return 0;
+	}
+	
+	new_ptr = realloc(w->vnodes, (w->nvnodes + 1) * sizeof(struct watched_vnode));
+	if(!new_ptr) return ENOMEM;
+	w->vnodes = new_ptr;
+	
+	if((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return errno;
+	if(!(w->vnodes[w->nvnodes].path = strdup(path))) {
+		close(fd);
+		return ENOMEM;
+	}
+	
+	EV_SET(&evt, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+		is_file ? FILE_NOTES : DIR_NOTES, 0, (void*)w->nvnodes);
+	if(kevent(w->fd, &evt, 1, NULL, 0, NULL) == -1) {
+		int err = errno;
+		
+		close(fd);
+		free(w->vnodes[w->nvnodes].path);
+		return err;
+	}
+	
+	w->vnodes[w->nvnodes].fd = fd;
+	w->vnodes[w->nvnodes].is_file = is_file;
+	w->nvnodes++;
+	return 0;
+}
+#endif /* USE_KQUEUE */
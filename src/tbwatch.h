@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef tbwatch_h
+#define tbwatch_h
+
+#include "tbparse.h"
+
+/*
+ * Watches rc files (the parser's sources) for changes. On Linux inotify
+ * is used, and kqueue on BSD systems; these provide a descriptor that
+ * becomes readable when something happens to the files, or directories
+ * they're in. Elsewhere the descriptor is -1, and tb_watch_changed must
+ * be called periodically instead.
+ */
+struct tb_watch;
+
+/* Creates a watch with no files. Returns NULL if out of memory. */
+struct tb_watch* tb_watch_create(void);
+
+void tb_watch_destroy(struct tb_watch*);
+
+/*
+ * Replaces files watched with those in the list. Signatures in the list
+ * are those changes are detected against. Returns zero on success.
+ */
+int tb_watch_set(struct tb_watch*, const struct tb_source *files, size_t count);
+
+/* Returns the descriptor to wait for, or -1 if changes must be polled for */
+int tb_watch_fd(struct tb_watch*);
+
+/*
+ * Reads pending events from the descriptor. Returns non-zero if any of them
+ * may concern watched files, in which case tb_watch_changed tells for sure.
+ * Events usually come in bursts (e.g. an editor writing a file to a
+ * temporary one and renaming it), so it's best to wait for them to settle.
+ */
+int tb_watch_read(struct tb_watch*);
+
+/*
+ * Returns non-zero if any of the watched files changed since they were set,
+ * or were created or removed.
+ */
+int tb_watch_changed(struct tb_watch*);
+
+/*
+ * Takes the current state of watched files as the one changes are detected
+ * against, e.g. after failing to reload them, so that they're not reported
+ * as changed again until they actually are.
+ */
+void tb_watch_rebase(struct tb_watch*);
+
+#endif /* tbwatch_h */
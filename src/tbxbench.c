@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Benchmark of menu construction, which needs an X display. Pulldowns of
+ * increasing width are filled with push button gadgets, managing each one
+ * as it's created, or all of them with a single XtManageChildren call, as
+ * xmtoolbox does. Results are printed as tab separated values, one
+ * benchmark per line, like those of tbbench.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <Xm/Xm.h>
+#include <Xm/RowColumn.h>
+#include <Xm/PushBG.h>
+
+/* Default minimum run time of each benchmark, in seconds */
+#define DEF_MIN_TIME 0.5
+
+static double build_menu(Widget, unsigned int, Boolean, WidgetList);
+static double now_ns(void);
+static void usage(const char*);
+
+/* Menu widths, in items, to build pulldowns of */
+static const unsigned int widths[] = {
+	10, 25, 50, 100, 250, 500, 1000
+};
+
+#define NUM_WIDTHS (sizeof(widths) / sizeof(widths[0]))
+
+
+int main(int argc, char **argv)
+{
+	XtAppContext app_context;
+	Widget wshell, wmenu;
+	WidgetList items;
+	double min_time = DEF_MIN_TIME;
+	unsigned int i, j;
+	int c;
+	
+	XtSetLanguageProc(NULL, NULL, NULL);
+	XtToolkitInitialize();
+	
+	wshell = XtVaAppInitialize(&app_context, "TbXBench",
+		NULL, 0, &argc, argv, NULL,
+		XmNmappedWhenManaged, False, NULL);
+	
+	while((c = getopt(argc, argv, "t:h")) != -1) {
+		switch(c) {
+			case 't':
+			min_time = atof(optarg);
+			if(min_time <= 0) {
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+			default:
+			usage(argv[0]);
+			return (c == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+	
+	if(!(items = malloc(widths[NUM_WIDTHS - 1] * sizeof(Widget)))) {
+		perror("malloc");
+		return EXIT_FAILURE;
+	}
+	
+	wmenu = XmCreateMenuBar(wshell, "menu", NULL, 0);
+	XtManageChild(wmenu);
+	XtRealizeWidget(wshell);
+	
+	printf("benchmark\tops\tns_per_op\tns_per_item\n");
+	
+	for(i = 0; i < NUM_WIDTHS; i++) {
+		for(j = 0; j < 2; j++) {
+			Boolean batched = (j == 1);
+			unsigned long ops = 0;
+			double elapsed = 0;
+			
+			do {
+				elapsed += build_menu(wmenu, widths[i], batched, items);
+				ops++;
+			} while(elapsed < min_time * 1e9);
+			
+			printf("%s/%u\t%lu\t%.1f\t%.1f\n",
+				batched ? "batched" : "single", widths[i],
+				ops, elapsed / ops, elapsed / ops / widths[i]);
+			fflush(stdout);
+		}
+	}
+	
+	free(items);
+	XtDestroyApplicationContext(app_context);
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Builds a pulldown with 'width' items and destroys it.
+ * Returns the time building it took, in nanoseconds.
+ */
+static double build_menu(Widget wparent, unsigned int width,
+	Boolean batched, WidgetList items)
+{
+	Widget wpulldown;
+	double start, elapsed;
+	unsigned int i;
+	Arg args[1];
+	
+	start = now_ns();
+	wpulldown = XmCreatePulldownMenu(wparent, "benchPulldown", NULL, 0);
+	
+	for(i = 0; i < width; i++) {
+		XmString title;
+		char label[32];
+		
+		snprintf(label, sizeof(label), "Menu Item %u", i);
+		title = XmStringCreateLocalized(label);
+		XtSetArg(args[0], XmNlabelString, title);
+		items[i] = XmCreatePushButtonGadget(wpulldown,
+			"menuButton", args, 1);
+		XmStringFree(title);
+		if(!batched) XtManageChild(items[i]);
+	}
+	if(batched) XtManageChildren(items, width);
+	elapsed = now_ns() - start;
+	
+	XtDestroyWidget(wpulldown);
+	return elapsed;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [X toolkit options] [-t seconds]\n"
+		"  -t  minimum run time of each benchmark (default %.1f)\n",
+		name, DEF_MIN_TIME);
+}
@@ -13,6 +13,7 @@
 #include <Xm/DrawP.h>
 #include "wswitchp.h"
 #include "wswitch.h"
+#include "xmstr.h"
 
 
 /* Local routines */
@@ -392,7 +393,7 @@ static void initialize(Widget wreq, Widget wnew,
 			char sz[7];
 
 			sprintf(sz, "%d", i + 1);
-			p->buttons[i].label = XmStringCreateLocalized(sz);
+			p->buttons[i].label = xmstr_get(sz);
 		}
 	} else {
 		p->nbuttons = 0;
@@ -474,6 +475,10 @@ static Boolean set_values(Widget wcur, Widget wreq,
 		Dimension height;
 		
 		if(set->switcher.buttons) {
+			short i;
+			
+			for(i = 0; i < cur->switcher.nbuttons; i++)
+				xmstr_release(set->switcher.buttons[i].label);
 			XtFree((char*)set->switcher.buttons);
 			set->switcher.buttons = NULL;
 		}
@@ -489,8 +494,7 @@ static Boolean set_values(Widget wcur, Widget wreq,
 				char sz[7];
 
 				sprintf(sz, "%d", i + 1);
-				set->switcher.buttons[i].label =
-					XmStringCreateLocalized(sz);
+				set->switcher.buttons[i].label = xmstr_get(sz);
 			}
 
 
@@ -524,7 +528,7 @@ static void destroy(Widget w)
 		short i;
 		
 		for(i = 0; i < p->nbuttons; i++)
-			XmStringFree(p->buttons[i].label);
+			xmstr_release(p->buttons[i].label);
 
 		XtFree((char*)p->buttons);
 	}
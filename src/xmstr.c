@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * Interned, reference counted compound strings, so that labels which
+ * remain the same from one menu rebuild to the next are converted from
+ * the locale's encoding and allocated only once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <Xm/Xm.h>
+#include "xmstr.h"
+
+/* Initial number of hash table buckets; the table is grown
+ * to keep at most one string per bucket on average */
+#define XMSTR_MIN_BUCKETS 256
+
+/* Number of unreferenced strings kept for reuse; labels are copied by
+ * widgets, so most strings are released as soon as they are set */
+#define XMSTR_MAX_UNUSED 2048
+
+struct xmstr {
+	XmString str;
+	unsigned int refs;
+	unsigned int hash;
+	unsigned int size;
+	/* hash chains by text and by XmString */
+	struct xmstr *next_text;
+	struct xmstr *next_str;
+	/* LRU list of unreferenced strings, most recently released first */
+	struct xmstr *prev_unused;
+	struct xmstr *next_unused;
+	char text[1];
+};
+
+static struct xmstr **text_buckets = NULL;
+static struct xmstr **str_buckets = NULL;
+static unsigned int nbuckets = 0;
+static unsigned int nstrings = 0;
+static struct xmstr *unused_head = NULL;
+static struct xmstr *unused_tail = NULL;
+static unsigned int nunused = 0;
+static struct xmstr_stats stats;
+
+static unsigned int text_hash(const char*);
+static unsigned int str_hash(XmString);
+static struct xmstr* find_str(XmString, struct xmstr***);
+static void grow_table(void);
+static void unlink_unused(struct xmstr*);
+static void free_xmstr(struct xmstr*);
+
+XmString xmstr_get(const char *text)
+{
+	unsigned int hash = text_hash(text);
+	struct xmstr *xs;
+	size_t len;
+	
+	if(nbuckets) {
+		for(xs = text_buckets[hash & (nbuckets - 1)]; xs; xs = xs->next_text) {
+			if(xs->hash != hash || strcmp(xs->text, text)) continue;
+			
+			if(!xs->refs++) unlink_unused(xs);
+			stats.hits++;
+			stats.bytes_saved += xs->size;
+			return xs->str;
+		}
+	}
+	stats.misses++;
+	
+	if(nstrings >= nbuckets) grow_table();
+	
+	/* strings that can't be cached are freed on release */
+	len = strlen(text);
+	if(!nbuckets || !(xs = malloc(sizeof(struct xmstr) + len)))
+		return XmStringCreateLocalized((char*)text);
+	
+	if(!(xs->str = XmStringCreateLocalized((char*)text))) {
+		free(xs);
+		return NULL;
+	}
+	memcpy(xs->text, text, len + 1);
+	xs->refs = 1;
+	xs->hash = hash;
+	xs->size = XmCvtXmStringToByteStream(xs->str, NULL);
+	xs->prev_unused = xs->next_unused = NULL;
+	
+	xs->next_text = text_buckets[hash & (nbuckets - 1)];
+	text_buckets[hash & (nbuckets - 1)] = xs;
+	xs->next_str = str_buckets[str_hash(xs->str) & (nbuckets - 1)];
+	str_buckets[str_hash(xs->str) & (nbuckets - 1)] = xs;
+	nstrings++;
+	return xs->str;
+}
+
+void xmstr_release(XmString str)
+{
+	struct xmstr *xs;
+	
+	if(!str) return;
+	
+	if(!(xs = find_str(str, NULL))) {
+		XmStringFree(str);
+		return;
+	}
+	if(--xs->refs) return;
+	
+	xs->prev_unused = NULL;
+	xs->next_unused = unused_head;
+	if(unused_head) unused_head->prev_unused = xs;
+	unused_head = xs;
+	if(!unused_tail) unused_tail = xs;
+	nunused++;
+	
+	if(nunused > XMSTR_MAX_UNUSED) free_xmstr(unused_tail);
+}
+
+void xmstr_get_stats(struct xmstr_stats *s)
+{
+	*s = stats;
+	s->count = nstrings;
+	s->unused = nunused;
+}
+
+/* FNV-1a */
+static unsigned int text_hash(const char *text)
+{
+	unsigned int hash = 2166136261U;
+	
+	while(*text) {
+		hash ^= (unsigned char)*text++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static unsigned int str_hash(XmString str)
+{
+	unsigned long v = (unsigned long)str;
+	
+	/* allocations are aligned, mix in the higher bits */
+	return (unsigned int)((v >> 4) ^ (v >> 16));
+}
+
+/*
+ * Looks up the cache entry of a string, storing the location of the link
+ * pointing to it in *link, if not NULL. Returns NULL if not cached.
+ */
+static struct xmstr* find_str(XmString str, struct xmstr ***link)
+{
+	struct xmstr **p;
+	
+	if(!nbuckets) return NULL;
+	
+	for(p = &str_buckets[str_hash(str) & (nbuckets - 1)]; *p;
+		p = &(*p)->next_str) {
+		if((*p)->str == str) {
+			if(link) *link = p;
+			return *p;
+		}
+	}
+	return NULL;
+}
+
+/* Doubles the number of hash buckets; the table is left as is on failure */
+static void grow_table(void)
+{
+	unsigned int new_size = nbuckets ? nbuckets * 2 : XMSTR_MIN_BUCKETS;
+	struct xmstr **new_text, **new_str;
+	unsigned int i;
+	
+	new_text = calloc(new_size, sizeof(struct xmstr*));
+	new_str = calloc(new_size, sizeof(struct xmstr*));
+	if(!new_text || !new_str) {
+		free(new_text);
+		free(new_str);
+		return;
+	}
+	
+	for(i = 0; i < nbuckets; i++) {
+		struct xmstr *xs, *next;
+		
+		for(xs = text_buckets[i]; xs; xs = next) {
+			next = xs->next_text;
+			xs->next_text = new_text[xs->hash & (new_size - 1)];
+			new_text[xs->hash & (new_size - 1)] = xs;
+		}
+		for(xs = str_buckets[i]; xs; xs = next) {
+			unsigned int b = str_hash(xs->str) & (new_size - 1);
+			
+			next = xs->next_str;
+			xs->next_str = new_str[b];
+			new_str[b] = xs;
+		}
+	}
+	free(text_buckets);
+	free(str_buckets);
+	text_buckets = new_text;
+	str_buckets = new_str;
+	nbuckets = new_size;
+}
+
+static void unlink_unused(struct xmstr *xs)
+{
+	if(xs->prev_unused)
+		xs->prev_unused->next_unused = xs->next_unused;
+	else
+		unused_head = xs->next_unused;
+	
+	if(xs->next_unused)
+		xs->next_unused->prev_unused = xs->prev_unused;
+	else
+		unused_tail = xs->prev_unused;
+	
+	xs->prev_unused = xs->next_unused = NULL;
+	nunused--;
+}
+
+/* Removes an unreferenced string from the cache and frees it */
+static void free_xmstr(struct xmstr *xs)
+{
+	struct xmstr **link;
+	
+	unlink_unused(xs);
+	
+	link = &text_buckets[xs->hash & (nbuckets - 1)];
+	while(*link != xs) link = &(*link)->next_text;
+	*link = xs->next_text;
+	
+	find_str(xs->str, &link);
+	*link = xs->next_str;
+	
+	XmStringFree(xs->str);
+	free(xs);
+	nstrings--;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018-2026 alx@fastestcode.org
+ * 
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef xmstr_h
+#define xmstr_h
+
+#include <Xm/Xm.h>
+
+/* Counters of the compound string cache, see xmstr_get_stats */
+struct xmstr_stats {
+	unsigned long hits;
+	unsigned long misses;
+	/* size of compound strings that didn't have to be created */
+	unsigned long bytes_saved;
+	unsigned int count; /* strings in the cache */
+	unsigned int unused; /* of those, ones not referenced */
+};
+
+/*
+ * Returns a compound string made from 'text' with XmStringCreateLocalized.
+ * Strings are interned and reference counted, so the same text yields the
+ * same XmString, which must not be modified or freed by the caller, but
+ * released with xmstr_release once no longer needed. Unreferenced strings
+ * are kept for reuse, up to a limit.
+ */
+XmString xmstr_get(const char *text);
+
+/* Releases a string returned by xmstr_get */
+void xmstr_release(XmString);
+
+/* Retrieves cache statistics */
+void xmstr_get_stats(struct xmstr_stats*);
+
+#endif /* xmstr_h */